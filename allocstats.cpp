@@ -0,0 +1,159 @@
+#include "allocstats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace {
+// Plain counters: operator new runs before and after any constructor,
+// so nothing here may need one
+std::atomic<unsigned long long> processAllocations{0};
+std::atomic<unsigned long long> processFrees{0};
+std::atomic<unsigned long long> processBytes{0};
+thread_local unsigned long long threadAllocations = 0;
+thread_local unsigned long long threadFrees = 0;
+thread_local unsigned long long threadBytes = 0;
+
+void *allocate(size_t size)
+{
+    processAllocations.fetch_add(1, std::memory_order_relaxed);
+    processBytes.fetch_add(size, std::memory_order_relaxed);
+    ++threadAllocations;
+    threadBytes += size;
+    return malloc(size ? size : 1);
+}
+
+void release(void *p)
+{
+    if (p) {
+        processFrees.fetch_add(1, std::memory_order_relaxed);
+        ++threadFrees;
+        free(p);
+    }
+}
+}
+
+void *operator new(size_t size)
+{
+    void *p = allocate(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    release(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept
+{
+    release(p);
+}
+
+MyAllocCounts MyAllocStats::process()
+{
+    MyAllocCounts c;
+    c.allocations = processAllocations.load(std::memory_order_relaxed);
+    c.frees = processFrees.load(std::memory_order_relaxed);
+    c.bytes = processBytes.load(std::memory_order_relaxed);
+    return c;
+}
+
+MyAllocCounts MyAllocStats::thisThread()
+{
+    MyAllocCounts c;
+    c.allocations = threadAllocations;
+    c.frees = threadFrees;
+    c.bytes = threadBytes;
+    return c;
+}
+
+const char *MyAllocStats::phaseName(int phase)
+{
+    switch (phase) {
+      case STARTUP: return "startup";
+      case FRAME: return "frame";
+      case MOVE: return "move";
+    }
+    return "?";
+}
+
+void MyAllocStats::add(Phase phase, const MyAllocCounts& counts,
+                       unsigned long long events)
+{
+    Totals& t = phases[phase];
+    t.counts.allocations += counts.allocations;
+    t.counts.frees += counts.frees;
+    t.counts.bytes += counts.bytes;
+    if (events == 0) {
+        return;
+    }
+    t.events += events;
+    t.maxAllocations = std::max(t.maxAllocations,
+                                counts.allocations / events);
+    if (t.events > warmupEvents && counts.allocations > 0) {
+        ++t.eventsAllocating;
+#ifdef _DEBUG
+        if (phase == FRAME) {
+            fprintf(stderr, "frame %llu made %llu heap allocations\n",
+                    t.events, counts.allocations);
+            abort();
+        }
+#endif
+    }
+}
+
+void MyAllocStats::print() const
+{
+    const Totals& startup = phases[STARTUP];
+    printf("allocations: startup %llu (%.1f KB)", startup.counts.allocations,
+           startup.counts.bytes / 1024.0);
+    for (int phase = FRAME; phase < NUM_PHASES; ++phase) {
+        const Totals& t = phases[phase];
+        printf(", per %s %.2f (max %llu, %llu of %llu past warmup)",
+               phaseName(phase),
+               t.events ? double(t.counts.allocations) / t.events : 0.0,
+               t.maxAllocations, t.eventsAllocating,
+               t.events > warmupEvents ? t.events - warmupEvents : 0);
+    }
+    printf("\n");
+}
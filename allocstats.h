@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+
+// Heap allocation counts, from the operator new and delete replacements
+// in allocstats.cpp, which every binary linking it gets. Counted for the
+// whole process and for each thread: a thread's own counts tell its work
+// apart from the threads around it, such as the solver tables' build.
+struct MyAllocCounts {
+    unsigned long long allocations = 0;
+    unsigned long long frees = 0;
+    // Requested by the allocations, not what is still live
+    unsigned long long bytes = 0;
+
+    MyAllocCounts operator-(const MyAllocCounts& rhs) const
+    {
+        MyAllocCounts d;
+        d.allocations = allocations - rhs.allocations;
+        d.frees = frees - rhs.frees;
+        d.bytes = bytes - rhs.bytes;
+        return d;
+    }
+};
+
+// Allocations per phase of the viewer: startup until the first frame,
+// then each frame and each move. Frames are meant not to allocate at all
+// past the first few; frames that do are counted, and with _DEBUG abort.
+struct MyAllocStats {
+    enum Phase { STARTUP, FRAME, MOVE, NUM_PHASES };
+    // Events of a phase that may allocate, filling caches and the like
+    static constexpr unsigned long long warmupEvents = 3;
+
+    struct Totals {
+        // Frames, moves
+        unsigned long long events = 0;
+        MyAllocCounts counts;
+        // Most allocations in one event, and how many events past the
+        // warmup allocated
+        unsigned long long maxAllocations = 0;
+        unsigned long long eventsAllocating = 0;
+    };
+
+    static MyAllocCounts process();
+    static MyAllocCounts thisThread();
+    static const char *phaseName(int phase);
+
+    // Adds counts to phase, over events events
+    void add(Phase phase, const MyAllocCounts& counts,
+             unsigned long long events = 1);
+    const Totals& totals(int phase) const { return phases[phase]; }
+
+    void print() const;
+
+  private:
+    Totals phases[NUM_PHASES];
+};
+
+// The calling thread's allocations from construction to destruction,
+// added to a phase
+struct MyAllocScope {
+    MyAllocScope(MyAllocStats& stats, MyAllocStats::Phase phase)
+        : stats(stats), phase(phase), start(MyAllocStats::thisThread()) {}
+    ~MyAllocScope()
+    {
+        stats.add(phase, MyAllocStats::thisThread() - start, events);
+    }
+
+    MyAllocStats& stats;
+    MyAllocStats::Phase phase;
+    MyAllocCounts start;
+    // Set before the end, 0 for allocations outside any event
+    unsigned long long events = 1;
+};
@@ -0,0 +1,284 @@
+#include "capture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+double seconds()
+{
+    return chrono::duration<double>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
+
+bool MyFrameCapture::initialize(const char *out, int w, int h,
+                                int numBuffers, int numThreads)
+{
+    const size_t len = strlen(out);
+    format = (len > 4 && !strcmp(out + len - 4, ".yuv")) ? YUV : PNG;
+    if (format == PNG && !isNumberedPattern(out)) {
+        printf("capture: %s needs one %%d for the frame number, and no "
+               "other %% but %%%%\n", out);
+        return false;
+    }
+    if (format == YUV) {
+        yuvFile = fopen(out, "wb");
+        if (!yuvFile) {
+            printf("Could not open %s\n", out);
+            return false;
+        }
+    }
+    output = out;
+    width = w;
+    height = h;
+    numBuffers = max(1, numBuffers);
+    numThreads = max(1, numThreads);
+
+    glCall(glGenRenderbuffers(1, &resolveColor));
+    glCall(glBindRenderbuffer(GL_RENDERBUFFER, resolveColor));
+    glCall(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height));
+    glCall(glGenFramebuffers(1, &resolveFrameBuf));
+    glCall(glBindFramebuffer(GL_FRAMEBUFFER, resolveFrameBuf));
+    glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                     GL_RENDERBUFFER, resolveColor));
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    const size_t frameSize = size_t(width) * height * 4;
+    pbos.resize(numBuffers);
+    fences.assign(numBuffers, nullptr);
+    pboFrame.assign(numBuffers, 0);
+    glGenBuffers(numBuffers, pbos.data());
+    for (GLuint pbo : pbos) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glCall(glBufferData(GL_PIXEL_PACK_BUFFER, frameSize, NULL,
+                            GL_STREAM_READ));
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // Enough slots for every worker to be busy with one queued behind it;
+    // all the per frame memory is allocated here
+    slots.resize(numThreads * 2);
+    for (size_t i = 0; i < slots.size(); ++i) {
+        slots[i].rgba.resize(frameSize);
+        if (format == PNG) {
+            slots[i].png.reserve(width, height);
+        }
+        else {
+            const size_t chroma = size_t((width + 1) / 2) * ((height + 1) / 2);
+            slots[i].converted.resize(size_t(width) * height + 2 * chroma);
+        }
+        freeSlots.push_back(i);
+    }
+
+    stopping = false;
+    for (int i = 0; i < numThreads; ++i) {
+        workers.emplace_back(&MyFrameCapture::workerLoop, this);
+    }
+
+    frame = 0;
+    retired = 0;
+    nextYuvFrame = 0;
+    fenceWaits = 0;
+    slotWaits = 0;
+    startTime = seconds();
+    initialized = true;
+    printf("capturing %dx%d to %s, %d PBOs, %d encoder threads\n",
+           width, height, output, numBuffers, numThreads);
+    return true;
+}
+
+void MyFrameCapture::capture(GLuint readFrameBuf)
+{
+    if (!initialized) {
+        return;
+    }
+    const int n = pbos.size();
+    const int p = frame % n;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFrameBuf);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFrameBuf);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, resolveFrameBuf);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[p]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    // With a pack buffer bound this only queues the transfer
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[p] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    pboFrame[p] = frame;
+    ++frame;
+    glBindFramebuffer(GL_FRAMEBUFFER, readFrameBuf);
+
+    // Keep at most n-1 transfers in flight behind the one just issued
+    while (frame - retired > (unsigned long long) (n - 1)) {
+        retire();
+    }
+}
+
+void MyFrameCapture::retire()
+{
+    const int p = retired % pbos.size();
+    if (glClientWaitSync(fences[p], 0, 0) == GL_TIMEOUT_EXPIRED) {
+        ++fenceWaits;
+        glClientWaitSync(fences[p], GL_SYNC_FLUSH_COMMANDS_BIT,
+                         GLuint64(5000000000));
+    }
+    glDeleteSync(fences[p]);
+    fences[p] = nullptr;
+
+    const int s = acquireSlot();
+    Slot& slot = slots[s];
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[p]);
+    const void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                       slot.rgba.size(), GL_MAP_READ_BIT);
+    if (ptr) {
+        memcpy(slot.rgba.data(), ptr, slot.rgba.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.frame = pboFrame[p];
+    ++retired;
+
+    lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(s);
+    cond.notify_all();
+}
+
+int MyFrameCapture::acquireSlot()
+{
+    unique_lock<std::mutex> lock(mutex);
+    if (freeSlots.empty()) {
+        // The encoders are behind, this is where capture slows rendering
+        ++slotWaits;
+        cond.wait(lock, [this] { return !freeSlots.empty(); });
+    }
+    const int s = freeSlots.front();
+    freeSlots.pop_front();
+    return s;
+}
+
+void MyFrameCapture::workerLoop()
+{
+    for (;;) {
+        int s;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) {
+                return;
+            }
+            s = jobs.front();
+            jobs.pop_front();
+        }
+        encode(slots[s]);
+        lock_guard<std::mutex> lock(mutex);
+        freeSlots.push_back(s);
+        cond.notify_all();
+    }
+}
+
+void MyFrameCapture::encode(Slot& slot)
+{
+    if (format == PNG) {
+        writePng(slot);
+    }
+    else {
+        writeYuv(slot);
+    }
+}
+
+bool MyFrameCapture::writePng(Slot& slot)
+{
+    char filename[1024];
+    return numberedName(filename, sizeof(filename), output, int(slot.frame))
+        && slot.png.write(filename, slot.rgba.data(), width, height,
+                          size_t(width) * 4, true);
+}
+
+void MyFrameCapture::writeYuv(Slot& slot)
+{
+    // BT.601 limited range I420, chroma averaged over 2x2 blocks
+    const int cw = (width + 1) / 2;
+    const int ch = (height + 1) / 2;
+    unsigned char *yPlane = slot.converted.data();
+    unsigned char *uPlane = yPlane + size_t(width) * height;
+    unsigned char *vPlane = uPlane + size_t(cw) * ch;
+    auto pixel = [&](int x, int y) {
+        x = min(x, width - 1);
+        y = min(y, height - 1);
+        return slot.rgba.data() + (size_t(height - 1 - y) * width + x) * 4;
+    };
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const unsigned char *p = pixel(x, y);
+            yPlane[size_t(y) * width + x] =
+                    16 + ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8);
+        }
+    }
+    for (int y = 0; y < ch; ++y) {
+        for (int x = 0; x < cw; ++x) {
+            int r = 0, g = 0, b = 0;
+            for (int i = 0; i < 4; ++i) {
+                const unsigned char *p = pixel(2 * x + (i & 1),
+                                               2 * y + (i >> 1));
+                r += p[0];
+                g += p[1];
+                b += p[2];
+            }
+            r /= 4;
+            g /= 4;
+            b /= 4;
+            uPlane[size_t(y) * cw + x] =
+                    128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+            vPlane[size_t(y) * cw + x] =
+                    128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+        }
+    }
+
+    // Frames may finish out of order, the stream is written in order
+    {
+        unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return nextYuvFrame == slot.frame; });
+    }
+    fwrite(slot.converted.data(), 1, slot.converted.size(), yuvFile);
+    lock_guard<std::mutex> lock(mutex);
+    ++nextYuvFrame;
+    cond.notify_all();
+}
+
+void MyFrameCapture::finish()
+{
+    if (!initialized) {
+        return;
+    }
+    while (retired < frame) {
+        retire();
+    }
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        cond.notify_all();
+    }
+    for (thread& t : workers) {
+        t.join();
+    }
+    workers.clear();
+
+    const double elapsed = seconds() - startTime;
+    printf("captured %llu frames in %.2fs (%.1f fps), %llu fence waits, "
+           "%llu encoder waits\n", frame, elapsed,
+           elapsed > 0.0 ? frame / elapsed : 0.0, fenceWaits, slotWaits);
+
+    glDeleteBuffers(pbos.size(), pbos.data());
+    glDeleteFramebuffers(1, &resolveFrameBuf);
+    glDeleteRenderbuffers(1, &resolveColor);
+    if (yuvFile) {
+        fclose(yuvFile);
+        yuvFile = nullptr;
+    }
+    initialized = false;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "glutil.h"
+#include "image.h"
+
+// Frame sequence capture without pipeline stalls. Each captured frame is
+// resolved into a single sampled FBO and read into one of N pixel buffer
+// objects with a fence behind it; the PBO is only mapped N-1 frames later,
+// when its transfer has long completed, so with 3 buffers the readback of
+// frame k overlaps the rendering of frame k+2. Mapped pixels are copied to
+// a preallocated slot and encoded (PNG or raw I420) on a worker pool.
+struct MyFrameCapture {
+    enum Format {
+        PNG,  // one file per frame, the output name contains %d
+        YUV   // raw I420 stream in a single file, e.g. for ffmpeg
+    };
+
+    MyFrameCapture() = default;
+    MyFrameCapture(MyFrameCapture&) = delete;
+    ~MyFrameCapture() { finish(); }
+
+    // The format is chosen from the output name, ".yuv" for YUV
+    bool initialize(const char *output, int width, int height,
+                    int numBuffers, int numThreads);
+
+    // Reads back the color of readFrameBuf (0 for the window)
+    void capture(GLuint readFrameBuf);
+
+    // Drains the PBOs and the workers, then prints the statistics
+    void finish();
+
+    bool active() const { return initialized; }
+
+  private:
+    struct Slot {
+        std::vector<unsigned char> rgba;
+        // I420 planes, top row first
+        std::vector<unsigned char> converted;
+        MyPngWriter png;
+        unsigned long long frame = 0;
+    };
+
+    void retire();
+    int acquireSlot();
+    void workerLoop();
+    void encode(Slot& slot);
+    bool writePng(Slot& slot);
+    void writeYuv(Slot& slot);
+
+    bool initialized = false;
+    Format format = PNG;
+    const char *output = nullptr;
+    FILE *yuvFile = nullptr;
+    int width = 0;
+    int height = 0;
+
+    GLuint resolveFrameBuf = 0;
+    GLuint resolveColor = 0;
+
+    std::vector<GLuint> pbos;
+    std::vector<GLsync> fences;
+    std::vector<unsigned long long> pboFrame;
+    unsigned long long frame = 0;
+    unsigned long long retired = 0;
+
+    std::vector<Slot> slots;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<int> freeSlots;
+    std::deque<int> jobs;
+    unsigned long long nextYuvFrame = 0;
+    bool stopping = false;
+
+    // Statistics
+    unsigned long long fenceWaits = 0;
+    unsigned long long slotWaits = 0;
+    double startTime = 0.0;
+};
@@ -0,0 +1,327 @@
+#include "control.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+namespace {
+// Longest command line, and most replies buffered for a client that does
+// not read them
+constexpr size_t maxLine = 64 * 1024;
+constexpr size_t maxPendingOutput = 1024 * 1024;
+
+#ifdef MSG_NOSIGNAL
+constexpr int sendFlags = MSG_NOSIGNAL;
+#else
+constexpr int sendFlags = 0;
+#endif
+
+bool setNonBlocking(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+}
+
+bool MyControlServer::open(const char *path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("control socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        printf("socket failed: %s\n", strerror(errno));
+        return false;
+    }
+    // A stale socket from a previous run
+    unlink(path);
+    if (bind(listenFd, (const sockaddr *) &addr, sizeof(addr)) != 0
+     || listen(listenFd, 8) != 0 || !setNonBlocking(listenFd)) {
+        printf("control socket %s: %s\n", path, strerror(errno));
+        ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    socketPath = path;
+    printf("control socket listening on %s\n", path);
+    return true;
+}
+
+void MyControlServer::close()
+{
+    for (Client& c : clients) {
+        ::close(c.fd);
+    }
+    clients.clear();
+    if (listenFd >= 0) {
+        ::close(listenFd);
+        unlink(socketPath.c_str());
+        listenFd = -1;
+    }
+}
+
+void MyControlServer::poll(MySimulation& sim, double now)
+{
+    if (listenFd < 0) {
+        return;
+    }
+    TRACE_SCOPE("MyControlServer::poll");
+
+    fds.resize(clients.size() + 1);
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    for (size_t i = 0; i < clients.size(); ++i) {
+        fds[i + 1].fd = clients[i].fd;
+        fds[i + 1].events = POLLIN;
+        if (!clients[i].out.empty()) {
+            fds[i + 1].events |= POLLOUT;
+        }
+    }
+    if (::poll(fds.data(), fds.size(), 0) <= 0) {
+        return;
+    }
+
+    // The clients gone are dropped in place
+    size_t kept = 0;
+    for (size_t i = 0; i < clients.size(); ++i) {
+        Client& c = clients[i];
+        const short ev = fds[i + 1].revents;
+        bool ok = true;
+        if (ev & (POLLIN | POLLHUP | POLLERR)) {
+            ok = receive(c, sim, now);
+        }
+        if (ok) {
+            ok = flush(c);
+        }
+        if (!ok) {
+            ::close(c.fd);
+        }
+        else if (kept++ != i) {
+            clients[kept - 1] = std::move(c);
+        }
+    }
+    clients.erase(clients.begin() + kept, clients.end());
+
+    if (fds[0].revents & POLLIN) {
+        for (;;) {
+            const int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) {
+                break;
+            }
+            if (!setNonBlocking(fd)) {
+                ::close(fd);
+                continue;
+            }
+#ifdef SO_NOSIGPIPE
+            const int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+            Client c;
+            c.fd = fd;
+            clients.push_back(std::move(c));
+            ++connections;
+        }
+    }
+}
+
+bool MyControlServer::receive(Client& c, MySimulation& sim, double now)
+{
+    char buf[16384];
+    bool open = true;
+    // No more than a line too long: what is past it waits in the socket
+    // for the next step
+    while (c.in.size() <= maxLine) {
+        const size_t room = std::min(sizeof(buf), maxLine + 1 - c.in.size());
+        const ssize_t n = recv(c.fd, buf, room, 0);
+        if (n > 0) {
+            c.in.append(buf, n);
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK
+                       && errno != EINTR)) {
+            open = false;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        break;
+    }
+
+    // Every complete line, the rest waits for the next read
+    size_t start = 0;
+    for (;;) {
+        const size_t end = c.in.find('\n', start);
+        if (end == std::string::npos) {
+            break;
+        }
+        c.in[end] = '\0';
+        runCommand(c, &c.in[start], sim, now);
+        start = end + 1;
+    }
+    c.in.erase(0, start);
+    if (c.in.size() > maxLine) {
+        c.out += "error line too long\n";
+        flush(c);
+        return false;
+    }
+    if (!open) {
+        // Let the replies go out before closing
+        flush(c);
+    }
+    return open;
+}
+
+void MyControlServer::runCommand(Client& c, char *line, MySimulation& sim,
+                                 double now)
+{
+    // Trim
+    while (*line == ' ' || *line == '\t') {
+        ++line;
+    }
+    size_t len = strlen(line);
+    while (len > 0 && strchr(" \t\r", line[len - 1])) {
+        line[--len] = '\0';
+    }
+    if (len == 0) {
+        return;
+    }
+
+    if (!strcmp(line, "ping")) {
+        c.out += "pong\n";
+        return;
+    }
+    if (!strcmp(line, "state")) {
+        char facelets[55];
+        sim.rubik.facelets(facelets);
+        char reply[128];
+        snprintf(reply, sizeof(reply), "state %s queued %zu busy %d "
+                 "turns %llu\n", facelets, sim.queuedTurns(),
+                 sim.inFaceRotation() ? 1 : 0, sim.turnsDone);
+        c.out += reply;
+        return;
+    }
+    if (!strcmp(line, "stats")) {
+        float p50, p99, max;
+        latencyPercentiles(p50, p99, max);
+        char reply[160];
+        snprintf(reply, sizeof(reply), "stats batches %llu p50_ms %.3f "
+                 "p99_ms %.3f max_ms %.3f\n", batches, p50, p99, max);
+        c.out += reply;
+        return;
+    }
+    if (!strcmp(line, "reset")) {
+        sim.resetView();
+        return;
+    }
+    if (!strncmp(line, "view ", 5)) {
+        const char *dir = line + 5;
+        if (!strcmp(dir, "up")) {
+            sim.rotateView(MySimulation::VIEW_UP);
+        }
+        else if (!strcmp(dir, "down")) {
+            sim.rotateView(MySimulation::VIEW_DOWN);
+        }
+        else if (!strcmp(dir, "left")) {
+            sim.rotateView(MySimulation::VIEW_LEFT);
+        }
+        else if (!strcmp(dir, "right")) {
+            sim.rotateView(MySimulation::VIEW_RIGHT);
+        }
+        else {
+            c.out += "error invalid view rotation\n";
+        }
+        return;
+    }
+
+    if (strspn(line, "UFRLDB'2 \t") != len) {
+        c.out += "error invalid command\n";
+        return;
+    }
+    const unsigned first = sim.lastRequestedTurn() + 1;
+    const unsigned last = sim.queueMoves(line);
+    if (last == 0) {
+        c.out += "error no turn\n";
+        return;
+    }
+    pending.emplace_back(first, now);
+    ++batches;
+    turns += last - first + 1;
+}
+
+bool MyControlServer::flush(Client& c)
+{
+    while (!c.out.empty()) {
+        const ssize_t n = send(c.fd, c.out.data(), c.out.size(), sendFlags);
+        if (n > 0) {
+            c.out.erase(0, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Not reading its replies, drop it rather than buffer forever
+            return c.out.size() <= maxPendingOutput;
+        }
+        return false;
+    }
+    return true;
+}
+
+void MyControlServer::update(const MySimulation& sim, double now)
+{
+    const unsigned started = sim.lastStartedTurn();
+    while (!pending.empty() && pending.front().first <= started) {
+        const float ms = float((now - pending.front().second) * 1000.0);
+        if (latencies.size() < maxLatencies) {
+            latencies.push_back(ms);
+        }
+        else {
+            latencies[nextLatency] = ms;
+            nextLatency = (nextLatency + 1) % maxLatencies;
+        }
+        pending.pop_front();
+    }
+}
+
+void MyControlServer::latencyPercentiles(float& p50, float& p99,
+                                         float& max) const
+{
+    p50 = p99 = max = 0.0f;
+    if (latencies.empty()) {
+        return;
+    }
+    std::vector<float> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+    const size_t n = sorted.size();
+    p50 = sorted[n / 2];
+    p99 = sorted[std::min(n - 1, n * 99 / 100)];
+    max = sorted.back();
+}
+
+void MyControlServer::printStats() const
+{
+    if (listenFd < 0) {
+        return;
+    }
+    float p50, p99, max;
+    latencyPercentiles(p50, p99, max);
+    printf("control: %llu connections, %llu turns in %llu batches, "
+           "receive to animation start p50 %.2fms p99 %.2fms max %.2fms\n",
+           connections, turns, batches, p50, p99, max);
+}
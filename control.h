@@ -0,0 +1,71 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+
+#include "simulation.h"
+
+// Local control socket, for other processes (solvers, training tools) to
+// stream moves into the viewer and query its state. Unix domain stream
+// socket, text protocol, one command per line:
+//
+//   R U R' U2       turns in the usual notation, spaces optional
+//   view left       22.5 degree view rotation (up, down, left or right)
+//   reset           back to the initial view
+//   state           "state <54 facelets, see MyRubik::facelets>
+//                   queued <turns> busy <0|1> turns <done>"
+//   stats           "stats batches <n> p50_ms <x> p99_ms <x> max_ms <x>"
+//   ping            "pong"
+//
+// Turns are not acknowledged, errors are answered "error <reason>".
+// Everything received, up to 64 KB, is run before the next simulation step.
+// All sockets are non-blocking and everything runs from poll() on the
+// input thread: a slow or stuck client never stalls input nor rendering.
+struct MyControlServer {
+    MyControlServer() = default;
+    MyControlServer(MyControlServer&) = delete;
+    ~MyControlServer() { close(); }
+
+    bool open(const char *path);
+    void close();
+
+    // Accepts clients and runs the complete commands received. now is the
+    // frame clock, for the latency.
+    void poll(MySimulation& sim, double now);
+    // After the simulation stepped: latency, from receive to animation
+    // start, of the batches of turns that started
+    void update(const MySimulation& sim, double now);
+    void printStats() const;
+
+  private:
+    struct Client {
+        int fd;
+        std::string in;
+        std::string out;
+    };
+    // False when the client is gone or misbehaved
+    bool receive(Client& c, MySimulation& sim, double now);
+    void runCommand(Client& c, char *line, MySimulation& sim, double now);
+    bool flush(Client& c);
+    void latencyPercentiles(float& p50, float& p99, float& max) const;
+
+    int listenFd = -1;
+    std::string socketPath;
+    std::vector<Client> clients;
+    // Listening socket then clients, kept between polls
+    std::vector<pollfd> fds;
+
+    // First turn of every batch waiting to start, and when it came in
+    std::deque<std::pair<unsigned, double>> pending;
+    // The last maxLatencies, in ms
+    static constexpr size_t maxLatencies = 4096;
+    std::vector<float> latencies;
+    size_t nextLatency = 0;
+    unsigned long long batches = 0;
+    unsigned long long turns = 0;
+    unsigned long long connections = 0;
+};
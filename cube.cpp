@@ -1,4 +1,5 @@
 #include "cube.h"
+#include "trace.h"
 
 #include <cstdio>
 #include <cmath>
@@ -250,28 +251,35 @@ void MyCube::transform(const MyMatrix& m)
     }
 }
 
-MyQuaternion MyRubik::rotTypeToQuat(int type)
+MyPoint MyRubik::rotTypeToAxis(int type)
 {
-    MyQuaternion ret;
     switch (type) {
-      case MyCube::TOP: ret.rotateY(-M_PI/2.0f); return ret;
-      case MyCube::BOTTOM: ret.rotateY(M_PI/2.0f); return ret;
-      case MyCube::FRONT: ret.rotateZ(-M_PI/2.0f); return ret;
-      case MyCube::BACK: ret.rotateZ(M_PI/2.0f); return ret;
-      case MyCube::RIGHT: ret.rotateX(-M_PI/2.0f); return ret;
-      case MyCube::LEFT: ret.rotateX(M_PI/2.0f); return ret;
+      case MyCube::TOP: return MyPoint(0, 1, 0);
+      case MyCube::BOTTOM: return MyPoint(0, -1, 0);
+      case MyCube::FRONT: return MyPoint(0, 0, 1);
+      case MyCube::BACK: return MyPoint(0, 0, -1);
+      case MyCube::RIGHT: return MyPoint(1, 0, 0);
+      case MyCube::LEFT: return MyPoint(-1, 0, 0);
     }
+    return MyPoint();
+}
+
+MyQuaternion MyRubik::rotTypeToQuat(int type)
+{
+    MyQuaternion ret;
+    ret.setRotation(-M_PI/2.0f, rotTypeToAxis(type));
     return ret;
 }
 
-void MyRubik::endRot(int type, bool inv)
+void MyRubik::endRot(int type, bool inv, int turns)
 {
+    TRACE_SCOPE("MyRubik::endRot");
     for (int i = 0; i < 9; ++i) {
         qTransforms[pos[srcIndices[type][i]]] = faceRotationEnd[i];
         mTransforms[pos[srcIndices[type][i]]] =
                                             faceRotationEnd[i].toMatrix();
     }
-    int numIterations = inv ? 3 : 1;
+    int numIterations = ((inv ? -turns : turns) % 4 + 4) % 4;
     for (int iterations = 0 ; iterations < numIterations; ++iterations) {
         int tmpBuf[9];
         for (int i = 0; i < 9; ++i) {
@@ -286,28 +294,143 @@ void MyRubik::endRot(int type, bool inv)
 
 void MyRubik::doIncRot(int type, float t)
 {
+    TRACE_SCOPE("MyRubik::doIncRot");
+    MyQuaternion q;
+    q.setRotation(faceRotationAngle * t, faceRotationAxis);
     for (int i = 0; i < 9; ++i) {
-        const MyQuaternion& cur = qTransforms[pos[srcIndices[type][i]]];
-        mTransforms[pos[srcIndices[type][i]]] = MyQuaternion::slerp(
-                                                    cur,
-                                                    faceRotationEnd[i],
-                                                    t).toMatrix();
+        mTransforms[pos[srcIndices[type][i]]] =
+                                    (q * faceRotationStart[i]).toMatrix();
     }
 }
 
-void MyRubik::startRot(int type, bool inv)
+void MyRubik::startRot(int type, bool inv, int turns)
 {
-    MyQuaternion endQuat = rotTypeToQuat(type);
+    TRACE_SCOPE("MyRubik::startRot");
+    float angle = -M_PI/2.0f;
+    faceRotationAxis = rotTypeToAxis(type);
     if (inv) {
-        endQuat.toOppositeAxis();
+        angle = -angle;
     }
+    faceRotationAngle = angle * turns;
+
+    MyQuaternion endQuat;
+    endQuat.setRotation(faceRotationAngle, faceRotationAxis);
     for (int i = 0; i < 9; ++i) {
         const MyQuaternion& c = qTransforms[pos[srcIndices[type][i]]];
+        faceRotationStart[i] = c;
         faceRotationEnd[i] = endQuat * c;
         faceRotationEnd[i].normalize();
     }
 }
 
+int MyRubik::faceFromLetter(char c)
+{
+    switch (c) {
+      case 'F': return MyCube::FRONT;
+      case 'R': return MyCube::RIGHT;
+      case 'L': return MyCube::LEFT;
+      case 'B': return MyCube::BACK;
+      case 'D': return MyCube::BOTTOM;
+      case 'U': return MyCube::TOP;
+    }
+    return -1;
+}
+
+int MyRubik::applyMoves(const char *moves)
+{
+    int count = 0;
+    for (const char *c = moves; *c; ++c) {
+        if (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r') {
+            continue;
+        }
+        const int face = faceFromLetter(*c);
+        if (face < 0) {
+            return -1;
+        }
+        int turns = 1;
+        bool inv = false;
+        if (c[1] == '2') {
+            turns = 2;
+            ++c;
+        }
+        else if (c[1] == '\'') {
+            inv = true;
+            ++c;
+        }
+        startRot(face, inv, turns);
+        endRot(face, inv, turns);
+        ++count;
+    }
+    return count;
+}
+
+void MyRubik::resetTransforms()
+{
+    for (int i = 0; i < 27; ++i) {
+        qTransforms[i] = MyQuaternion();
+        mTransforms[i].reset();
+        pos[i] = i;
+    }
+}
+
+void MyRubik::facelets(char *out) const
+{
+    // Per face: outward normal, then the directions of rows and columns
+    struct FaceAxes {
+        MyPoint normal;
+        MyPoint down;
+        MyPoint right;
+    };
+    static const FaceAxes faces[6] = {
+        { MyPoint(0, 1, 0), MyPoint(0, 0, 1), MyPoint(1, 0, 0) },   // U
+        { MyPoint(1, 0, 0), MyPoint(0, -1, 0), MyPoint(0, 0, -1) }, // R
+        { MyPoint(0, 0, 1), MyPoint(0, -1, 0), MyPoint(1, 0, 0) },  // F
+        { MyPoint(0, -1, 0), MyPoint(0, 0, -1), MyPoint(1, 0, 0) }, // D
+        { MyPoint(-1, 0, 0), MyPoint(0, -1, 0), MyPoint(0, 0, 1) }, // L
+        { MyPoint(0, 0, -1), MyPoint(0, -1, 0), MyPoint(-1, 0, 0) } // B
+    };
+    static const MyPoint faceColor[6] = { yellow, green, red, white, blue,
+                                          orange };
+    static const char letters[] = "URFDLB";
+
+    for (int f = 0; f < 6; ++f) {
+        const FaceAxes& a = faces[f];
+        for (int i = 0; i < 9; ++i) {
+            const MyPoint p = a.normal + a.down * float(i / 3 - 1)
+                            + a.right * float(i % 3 - 1);
+            // Same layout as initialize(): x, then y, then z from the front
+            const int position = int(p.x + 1) + 3 * int(p.y + 1)
+                               + 9 * int(1 - p.z);
+            const int cubie = pos[position];
+
+            // The cubie's own face now looking towards the normal
+            MyQuaternion inverse = qTransforms[cubie];
+            inverse.toOppositeAxis();
+            const MyPoint n = a.normal.transform(inverse);
+            int face = MyCube::FRONT;
+            if (fabsf(n.x) > 0.5f) {
+                face = n.x > 0.0f ? MyCube::RIGHT : MyCube::LEFT;
+            }
+            else if (fabsf(n.y) > 0.5f) {
+                face = n.y > 0.0f ? MyCube::TOP : MyCube::BOTTOM;
+            }
+            else if (n.z < 0.0f) {
+                face = MyCube::BACK;
+            }
+
+            const MyPoint& c = colors[cubie].vertices[face * 6];
+            char letter = '?';
+            for (int k = 0; k < 6; ++k) {
+                if ((c - faceColor[k]).length() < 1e-3f) {
+                    letter = letters[k];
+                }
+            }
+            out[f * 9 + i] = letter;
+        }
+    }
+    out[54] = '\0';
+}
+
 void MyRubik::initialize()
 {
     faceNormal[0].z = 1;
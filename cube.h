@@ -106,7 +106,10 @@ struct MyRubik {
     MyMatrix mTransforms[27];
     int pos[27];
     MyPoint faceNormal[6];
+    MyQuaternion faceRotationStart[9];
     MyQuaternion faceRotationEnd[9];
+    MyPoint faceRotationAxis;
+    float faceRotationAngle = 0.0f;
 
     constexpr static MyPoint red{186.0f/255.0f, 12.0f/255.0f, 47.0f/255.0f};
     constexpr static MyPoint green{0.0f/255.0f, 154.0f/255.0f, 68.0f/255.0f};
@@ -137,11 +140,29 @@ struct MyRubik {
        ,{ 24, 15,  6, 25, 16,  7, 26, 17,  8 } // up
     };
 
+    // Outward axis of a face: a clockwise quarter turn of it is -pi/2
+    // around it
+    static MyPoint rotTypeToAxis(int type);
     MyQuaternion rotTypeToQuat(int type);
 
-    void startRot(int type, bool inv);
+    // turns is 1 or 2 quarter turns; the animation interpolates the angle
+    // rather than slerping, which has no defined path for half turns
+    void startRot(int type, bool inv, int turns = 1);
     void doIncRot(int type, float t);
-    void endRot(int type, bool inv = false);
+    void endRot(int type, bool inv = false, int turns = 1);
+
+    // 'U', 'F', ... to the face type, -1 if c is not a face
+    static int faceFromLetter(char c);
+    // Applies turns written in the usual notation ("R U R' U2") without
+    // animation, faces named in the cube's own frame. Returns the number
+    // of turns, or -1 if the notation is invalid.
+    int applyMoves(const char *moves);
+    // Back to the solved state, geometry and colors are kept
+    void resetTransforms();
+    // The stickers as 54 face letters (plus a nul), in the cube's own
+    // frame: faces U, R, F, D, L, B, each row by row as seen from outside
+    // with U above F, R, L and B, and B above U and below D
+    void facelets(char *out) const;
 
     constexpr float radius() const { return 0.40f; }
 
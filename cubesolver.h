@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "cubiecube.h"
+
+// What a solver returning one solution of a cube looks like, for code that
+// runs any of them: the two-phase solver, or the small Thistlethwaite one
+// where memory is short
+struct MySolver {
+    enum Result {
+        SOLVED,
+        TIMEOUT,
+        CANCELLED,
+        // The cube is not a cube, or maxLength is too short
+        UNSOLVABLE
+    };
+    typedef std::chrono::steady_clock Clock;
+
+    virtual ~MySolver() = default;
+
+    // Stops early when deadline passes or cancel becomes true (checked
+    // every few thousand nodes), cancel may be null
+    virtual Result solve(const MyCubieCube& cube, int maxLength,
+                         Clock::time_point deadline,
+                         const std::atomic<bool> *cancel,
+                         std::string& solution) = 0;
+
+    // Search nodes of the last solve
+    unsigned long long nodes = 0;
+};
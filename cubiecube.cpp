@@ -0,0 +1,541 @@
+#include "cubiecube.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+typedef MyCubieCube C;
+
+// Facelet indices: U1..U9 are 0..8, then R, F, D, L and B
+enum {
+    U1, U2, U3, U4, U5, U6, U7, U8, U9,
+    R1, R2, R3, R4, R5, R6, R7, R8, R9,
+    F1, F2, F3, F4, F5, F6, F7, F8, F9,
+    D1, D2, D3, D4, D5, D6, D7, D8, D9,
+    L1, L2, L3, L4, L5, L6, L7, L8, L9,
+    B1, B2, B3, B4, B5, B6, B7, B8, B9
+};
+
+// Facelets of each corner and edge, clockwise for corners, starting with
+// the U or D one (the F or B one for the slice edges)
+const int cornerFacelet[8][3] = {
+    { U9, R1, F3 }, { U7, F1, L3 }, { U1, L1, B3 }, { U3, B1, R3 },
+    { D3, F9, R7 }, { D1, L9, F7 }, { D7, B9, L7 }, { D9, R9, B7 }
+};
+const int edgeFacelet[12][2] = {
+    { U6, R2 }, { U8, F2 }, { U4, L2 }, { U2, B2 },
+    { D6, R8 }, { D2, F8 }, { D4, L8 }, { D8, B8 },
+    { F6, R4 }, { F4, L6 }, { B6, L4 }, { B4, R6 }
+};
+}
+
+const uint8_t MyCubieCube::cornerFaces[8][3] = {
+    { C::U, C::R, C::F }, { C::U, C::F, C::L }, { C::U, C::L, C::B },
+    { C::U, C::B, C::R }, { C::D, C::F, C::R }, { C::D, C::L, C::F },
+    { C::D, C::B, C::L }, { C::D, C::R, C::B }
+};
+const uint8_t MyCubieCube::edgeFaces[12][2] = {
+    { C::U, C::R }, { C::U, C::F }, { C::U, C::L }, { C::U, C::B },
+    { C::D, C::R }, { C::D, C::F }, { C::D, C::L }, { C::D, C::B },
+    { C::F, C::R }, { C::F, C::L }, { C::B, C::L }, { C::B, C::R }
+};
+
+namespace {
+// Quarter turns of the faces, clockwise seen from outside
+struct BasicMove {
+    uint8_t cp[8];
+    uint8_t co[8];
+    uint8_t ep[12];
+    uint8_t eo[12];
+};
+const BasicMove basicMoves[6] = {
+    // U
+    { { C::UBR, C::URF, C::UFL, C::ULB, C::DFR, C::DLF, C::DBL, C::DRB },
+      { 0, 0, 0, 0, 0, 0, 0, 0 },
+      { C::UB, C::UR, C::UF, C::UL, C::DR, C::DF, C::DL, C::DB,
+        C::FR, C::FL, C::BL, C::BR },
+      { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+    // R
+    { { C::DFR, C::UFL, C::ULB, C::URF, C::DRB, C::DLF, C::DBL, C::UBR },
+      { 2, 0, 0, 1, 1, 0, 0, 2 },
+      { C::FR, C::UF, C::UL, C::UB, C::BR, C::DF, C::DL, C::DB,
+        C::DR, C::FL, C::BL, C::UR },
+      { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+    // F
+    { { C::UFL, C::DLF, C::ULB, C::UBR, C::URF, C::DFR, C::DBL, C::DRB },
+      { 1, 2, 0, 0, 2, 1, 0, 0 },
+      { C::UR, C::FL, C::UL, C::UB, C::DR, C::FR, C::DL, C::DB,
+        C::UF, C::DF, C::BL, C::BR },
+      { 0, 1, 0, 0, 0, 1, 0, 0, 1, 1, 0, 0 } },
+    // D
+    { { C::URF, C::UFL, C::ULB, C::UBR, C::DLF, C::DBL, C::DRB, C::DFR },
+      { 0, 0, 0, 0, 0, 0, 0, 0 },
+      { C::UR, C::UF, C::UL, C::UB, C::DF, C::DL, C::DB, C::DR,
+        C::FR, C::FL, C::BL, C::BR },
+      { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+    // L
+    { { C::URF, C::ULB, C::DBL, C::UBR, C::DFR, C::UFL, C::DLF, C::DRB },
+      { 0, 1, 2, 0, 0, 2, 1, 0 },
+      { C::UR, C::UF, C::BL, C::UB, C::DR, C::DF, C::FL, C::DB,
+        C::FR, C::UL, C::DL, C::BR },
+      { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+    // B
+    { { C::URF, C::UFL, C::UBR, C::DRB, C::DFR, C::DLF, C::ULB, C::DBL },
+      { 0, 0, 1, 2, 0, 0, 2, 1 },
+      { C::UR, C::UF, C::UL, C::BR, C::DR, C::DF, C::DL, C::BL,
+        C::FR, C::FL, C::UB, C::DB },
+      { 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 1 } }
+};
+
+const char faceLetters[] = "URFDLB";
+
+// n choose k for n < 12 and k < 5, 0 when k > n: what the slice
+// coordinate ranks combinations with
+struct ChooseTable {
+    int v[12][5];
+
+    constexpr ChooseTable() : v()
+    {
+        for (int n = 0; n < 12; ++n) {
+            v[n][0] = 1;
+            for (int k = 1; k < 5; ++k) {
+                v[n][k] = n > 0 ? v[n - 1][k - 1] + v[n - 1][k] : 0;
+            }
+        }
+    }
+};
+constexpr ChooseTable chooseTable;
+
+// The positions of the 4 slice edges, as bits, to the rank of that
+// combination in the slice coordinate, and back
+struct SliceTables {
+    uint16_t rank[1 << 12];
+    uint16_t bits[C::numSlices];
+
+    constexpr SliceTables() : rank(), bits()
+    {
+        for (int m = 0; m < 1 << 12; ++m) {
+            int a = 0;
+            int x = 0;
+            for (int j = 11; j >= 0 && x < 5; --j) {
+                if (m >> j & 1 && ++x < 5) {
+                    a += chooseTable.v[11 - j][x];
+                }
+            }
+            if (x == 4) {
+                rank[m] = a;
+                bits[a] = m;
+            }
+        }
+    }
+};
+constexpr SliceTables sliceTables;
+
+// Over the masks of up to 8 bits: how many bits are set, and where the
+// i-th set bit is
+struct BitTables {
+    uint8_t count[256];
+    uint8_t nth[256][8];
+
+    constexpr BitTables() : count(), nth()
+    {
+        for (int m = 0; m < 256; ++m) {
+            for (int b = 0; b < 8; ++b) {
+                if (m >> b & 1) {
+                    nth[m][count[m]++] = b;
+                }
+            }
+        }
+    }
+};
+constexpr BitTables bitTables;
+
+// The positions in left, as bits, rotated to start at start
+template<int n>
+unsigned rotateMask(unsigned left, int start)
+{
+    return ((left >> start) | (left << (n - start))) & ((1u << n) - 1);
+}
+
+// Rank of the permutation of a[0..n), which holds 0..n-1: for j from n-1
+// down, how many times a[0..j] is rotated left to bring j to a[j]. The
+// rotations keep the cyclic order of what is left, so that count follows
+// from how many of the entries left come before j, counting from just
+// after the last one placed: a bit count, not a rotation.
+template<int n, typename T>
+int permRank(const T *perm)
+{
+    static_assert(n <= 8, "masks of 8 bits");
+    int where[n];
+    for (int i = 0; i < n; ++i) {
+        where[perm[i]] = i;
+    }
+    unsigned left = (1u << n) - 1;
+    int start = 0;
+    int rank = 0;
+    for (int j = n - 1; j > 0; --j) {
+        const int p = where[j];
+        const int offset = p >= start ? p - start : p - start + n;
+        const unsigned m = rotateMask<n>(left, start);
+        const int ahead = bitTables.count[m & ((1u << offset) - 1)];
+        rank = (j + 1) * rank + (ahead == j ? 0 : ahead + 1);
+        left &= ~(1u << p);
+        start = p + 1;
+    }
+    return rank;
+}
+
+// The permutation of that rank: the same count, from j = n-1 down, says
+// which of the entries left, cyclically from just after the last one
+// placed, j goes to
+template<int n, typename T>
+void permUnrank(T *a, int rank)
+{
+    static_assert(n <= 8, "masks of 8 bits");
+    int k[n];
+    for (int j = 1; j < n; ++j) {
+        k[j] = rank % (j + 1);
+        rank /= j + 1;
+    }
+    unsigned left = (1u << n) - 1;
+    int start = 0;
+    for (int j = n - 1; j > 0; --j) {
+        const unsigned m = rotateMask<n>(left, start);
+        int p = start + bitTables.nth[m][k[j] ? k[j] - 1 : j];
+        if (p >= n) {
+            p -= n;
+        }
+        a[p] = T(j);
+        left &= ~(1u << p);
+        start = p + 1;
+    }
+    a[bitTables.nth[left][0]] = 0;
+}
+
+// Even or odd number of swaps
+template<typename T>
+int parity(const T *a, int n)
+{
+    int s = 0;
+    for (int i = n - 1; i > 0; --i) {
+        for (int j = i - 1; j >= 0; --j) {
+            if (a[j] > a[i]) {
+                ++s;
+            }
+        }
+    }
+    return s % 2;
+}
+}
+
+const char *MyCubieCube::moveName(int m)
+{
+    static const char *names[numMoves] = {
+        "U", "U2", "U'", "R", "R2", "R'", "F", "F2", "F'",
+        "D", "D2", "D'", "L", "L2", "L'", "B", "B2", "B'"
+    };
+    return m >= 0 && m < numMoves ? names[m] : "?";
+}
+
+bool MyCubieCube::parseMoves(const char *s, std::vector<int>& moves)
+{
+    for (const char *c = s; *c; ++c) {
+        if (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r') {
+            continue;
+        }
+        const char *face = strchr(faceLetters, *c);
+        if (!face) {
+            return false;
+        }
+        int turns = 1;
+        if (c[1] == '2') {
+            turns = 2;
+            ++c;
+        }
+        else if (c[1] == '\'') {
+            turns = 3;
+            ++c;
+        }
+        moves.push_back(int(face - faceLetters) * 3 + turns - 1);
+    }
+    return true;
+}
+
+std::string MyCubieCube::formatMoves(const int *moves, int n)
+{
+    std::string s;
+    for (int i = 0; i < n; ++i) {
+        if (i > 0) {
+            s += ' ';
+        }
+        s += moveName(moves[i]);
+    }
+    return s;
+}
+
+MyCubieCube::MyCubieCube()
+{
+    for (int i = 0; i < 8; ++i) {
+        cp[i] = i;
+        co[i] = 0;
+    }
+    for (int i = 0; i < 12; ++i) {
+        ep[i] = i;
+        eo[i] = 0;
+    }
+}
+
+bool MyCubieCube::fromFacelets(const char *f)
+{
+    if (strlen(f) != 54) {
+        return false;
+    }
+    // Colors by center
+    int color[54];
+    for (int i = 0; i < 54; ++i) {
+        color[i] = -1;
+        for (int face = 0; face < 6; ++face) {
+            if (f[i] == f[face * 9 + 4]) {
+                color[i] = face;
+            }
+        }
+        if (color[i] < 0) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        int ori = 0;
+        while (ori < 3 && color[cornerFacelet[i][ori]] != U
+               && color[cornerFacelet[i][ori]] != D) {
+            ++ori;
+        }
+        if (ori == 3) {
+            return false;
+        }
+        const int c1 = color[cornerFacelet[i][(ori + 1) % 3]];
+        const int c2 = color[cornerFacelet[i][(ori + 2) % 3]];
+        int j = 0;
+        while (j < 8 && (cornerFaces[j][1] != c1
+                      || cornerFaces[j][2] != c2)) {
+            ++j;
+        }
+        if (j == 8) {
+            return false;
+        }
+        cp[i] = j;
+        co[i] = ori;
+    }
+    for (int i = 0; i < 12; ++i) {
+        const int c0 = color[edgeFacelet[i][0]];
+        const int c1 = color[edgeFacelet[i][1]];
+        int j = 0;
+        for (; j < 12; ++j) {
+            if (edgeFaces[j][0] == c0 && edgeFaces[j][1] == c1) {
+                eo[i] = 0;
+                break;
+            }
+            if (edgeFaces[j][0] == c1 && edgeFaces[j][1] == c0) {
+                eo[i] = 1;
+                break;
+            }
+        }
+        if (j == 12) {
+            return false;
+        }
+        ep[i] = j;
+    }
+    return isValid();
+}
+
+void MyCubieCube::toFacelets(char *out) const
+{
+    for (int face = 0; face < 6; ++face) {
+        for (int i = 0; i < 9; ++i) {
+            out[face * 9 + i] = faceLetters[face];
+        }
+    }
+    for (int i = 0; i < 8; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            out[cornerFacelet[i][(k + co[i]) % 3]] =
+                faceLetters[cornerFaces[cp[i]][k]];
+        }
+    }
+    for (int i = 0; i < 12; ++i) {
+        for (int k = 0; k < 2; ++k) {
+            out[edgeFacelet[i][(k + eo[i]) % 2]] =
+                faceLetters[edgeFaces[ep[i]][k]];
+        }
+    }
+    out[54] = '\0';
+}
+
+bool MyCubieCube::isValid() const
+{
+    int seen = 0;
+    int twists = 0;
+    for (int i = 0; i < 8; ++i) {
+        seen |= 1 << cp[i];
+        twists += co[i];
+    }
+    if (seen != 0xff || twists % 3 != 0) {
+        return false;
+    }
+    seen = 0;
+    int flips = 0;
+    for (int i = 0; i < 12; ++i) {
+        seen |= 1 << ep[i];
+        flips += eo[i];
+    }
+    if (seen != 0xfff || flips % 2 != 0) {
+        return false;
+    }
+    return parity(cp, 8) == parity(ep, 12);
+}
+
+bool MyCubieCube::isSolved() const
+{
+    for (int i = 0; i < 8; ++i) {
+        if (cp[i] != i || co[i] != 0) {
+            return false;
+        }
+    }
+    for (int i = 0; i < 12; ++i) {
+        if (ep[i] != i || eo[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MyCubieCube::multiply(const MyCubieCube& b)
+{
+    uint8_t p[12];
+    uint8_t o[12];
+    for (int i = 0; i < 8; ++i) {
+        p[i] = cp[b.cp[i]];
+        o[i] = (co[b.cp[i]] + b.co[i]) % 3;
+    }
+    std::copy(p, p + 8, cp);
+    std::copy(o, o + 8, co);
+    for (int i = 0; i < 12; ++i) {
+        p[i] = ep[b.ep[i]];
+        o[i] = eo[b.ep[i]] ^ b.eo[i];
+    }
+    std::copy(p, p + 12, ep);
+    std::copy(o, o + 12, eo);
+}
+
+void MyCubieCube::move(int m)
+{
+    const BasicMove& b = basicMoves[moveFace(m)];
+    MyCubieCube q;
+    std::copy(b.cp, b.cp + 8, q.cp);
+    std::copy(b.co, b.co + 8, q.co);
+    std::copy(b.ep, b.ep + 12, q.ep);
+    std::copy(b.eo, b.eo + 12, q.eo);
+    for (int i = m % 3; i >= 0; --i) {
+        multiply(q);
+    }
+}
+
+void MyCubieCube::moves(const std::vector<int>& ms)
+{
+    for (int m : ms) {
+        move(m);
+    }
+}
+
+int MyCubieCube::twist() const
+{
+    int t = 0;
+    for (int i = URF; i < DRB; ++i) {
+        t = 3 * t + co[i];
+    }
+    return t;
+}
+
+void MyCubieCube::setTwist(int t)
+{
+    int sum = 0;
+    for (int i = DRB - 1; i >= URF; --i) {
+        co[i] = t % 3;
+        sum += co[i];
+        t /= 3;
+    }
+    co[DRB] = (3 - sum % 3) % 3;
+}
+
+int MyCubieCube::flip() const
+{
+    int f = 0;
+    for (int i = UR; i < BR; ++i) {
+        f = 2 * f + eo[i];
+    }
+    return f;
+}
+
+void MyCubieCube::setFlip(int f)
+{
+    int sum = 0;
+    for (int i = BR - 1; i >= UR; --i) {
+        eo[i] = f % 2;
+        sum += eo[i];
+        f /= 2;
+    }
+    eo[BR] = sum % 2;
+}
+
+int MyCubieCube::sliceSorted() const
+{
+    // Positions, as a combination, then the order of the slice edges
+    int bits = 0;
+    int x = 0;
+    uint8_t edges[4];
+    for (int j = UR; j <= BR; ++j) {
+        if (ep[j] >= FR) {
+            bits |= 1 << j;
+            edges[x++] = ep[j] - FR;
+        }
+    }
+    return 24 * sliceTables.rank[bits] + permRank<4>(edges);
+}
+
+void MyCubieCube::setSliceSorted(int s)
+{
+    static const uint8_t otherEdges[8] = { UR, UF, UL, UB, DR, DF, DL, DB };
+    uint8_t sliceEdges[4];
+    permUnrank<4>(sliceEdges, s % 24);
+    for (uint8_t& e : sliceEdges) {
+        e += FR;
+    }
+    const int bits = sliceTables.bits[s / 24];
+    int x = 0;
+    int y = 0;
+    for (int j = UR; j <= BR; ++j) {
+        ep[j] = bits >> j & 1 ? sliceEdges[x++] : otherEdges[y++];
+    }
+}
+
+int MyCubieCube::cornerPerm() const
+{
+    return permRank<8>(cp);
+}
+
+void MyCubieCube::setCornerPerm(int perm)
+{
+    permUnrank<8>(cp, perm);
+}
+
+int MyCubieCube::udEdgePerm() const
+{
+    return permRank<8>(ep);
+}
+
+void MyCubieCube::setUdEdgePerm(int perm)
+{
+    permUnrank<8>(ep, perm);
+    for (int i = FR; i <= BR; ++i) {
+        ep[i] = i;
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The cube as the solvers see it: where each of the 8 corners and 12 edges
+// is and how it is twisted. Faces and facelets follow MyRubik's
+// conventions: 54 letter URFDLB strings as written by MyRubik::facelets,
+// and turns named in the cube's own frame, as MyRubik::applyMoves reads
+// them, so a solution found here plays back on the viewer's cube.
+struct MyCubieCube {
+    enum Corner { URF, UFL, ULB, UBR, DFR, DLF, DBL, DRB };
+    enum Edge { UR, UF, UL, UB, DR, DF, DL, DB, FR, FL, BL, BR };
+    enum Face { U, R, F, D, L, B };
+    // Faces of each corner and edge in the order of its facelets, the U
+    // or D one first (F or B for the slice edges), corners clockwise
+    static const uint8_t cornerFaces[8][3];
+    static const uint8_t edgeFaces[12][2];
+
+    // Moves are face * 3 + quarter turns - 1: U, U2, U', R, R2, R', ...
+    static constexpr int numMoves = 18;
+    static constexpr int moveFace(int m) { return m / 3; }
+    // Whether m right after last is pointless in a search: same face, or
+    // the opposite face in the order not searched, as the two commute
+    static constexpr bool redundantAfter(int m, int last)
+    {
+        return moveFace(m) == moveFace(last)
+            || moveFace(m) + 3 == moveFace(last);
+    }
+    // "U", "U2", "U'", ...
+    static const char *moveName(int m);
+    // Moves written in the usual notation to move indices, false if the
+    // notation is invalid
+    static bool parseMoves(const char *s, std::vector<int>& moves);
+    static std::string formatMoves(const int *moves, int n);
+
+    // Solved
+    MyCubieCube();
+
+    // From the 54 facelets, false if they are not a cube (wrong colors,
+    // twisted corner, flipped edge, swapped pieces); the colors are named
+    // after the centers so any 6 letters do
+    bool fromFacelets(const char *facelets);
+    void toFacelets(char *out) const;
+    // Whether the corners and edges make a reachable cube
+    bool isValid() const;
+    bool isSolved() const;
+
+    // this = this * b, b applied after this
+    void multiply(const MyCubieCube& b);
+    void move(int m);
+    void moves(const std::vector<int>& ms);
+
+    // Coordinates, the dense integers the move and pruning tables are
+    // indexed with. Each only looks at and sets its own part of the cube.
+    static constexpr int numTwists = 2187;       // 3^7
+    static constexpr int numFlips = 2048;        // 2^11
+    static constexpr int numSlices = 495;        // 12 choose 4
+    static constexpr int numSlicesSorted = 11880; // 12 * 11 * 10 * 9
+    static constexpr int numCornerPerms = 40320; // 8!
+    static constexpr int numUdEdgePerms = 40320; // 8!, in phase 2
+    // Corner orientations
+    int twist() const;
+    void setTwist(int twist);
+    // Edge orientations
+    int flip() const;
+    void setFlip(int flip);
+    // Positions of the FR, FL, BL and BR edges and their order, 0 when
+    // solved; slice() = sliceSorted() / 24 leaves the order out
+    int sliceSorted() const;
+    void setSliceSorted(int slice);
+    int slice() const { return sliceSorted() / 24; }
+    int cornerPerm() const;
+    void setCornerPerm(int perm);
+    // Permutation of the 8 U and D edges, only meaningful once they are
+    // all in the U and D layers
+    int udEdgePerm() const;
+    void setUdEdgePerm(int perm);
+
+    uint8_t cp[8];
+    uint8_t co[8];
+    uint8_t ep[12];
+    uint8_t eo[12];
+};
@@ -0,0 +1,286 @@
+#include "endgame.h"
+
+#include <atomic>
+#include <cstdio>
+
+#include "prunetable.h"
+
+namespace {
+typedef MyCubieCube C;
+
+const char endgameMagic[8] = "CUBEEND";
+
+// Cubes at each distance from solved, in face turns
+const size_t cubesAtDistance[MyEndgameTable::maxDepth + 1] = {
+    1, 18, 243, 3240, 43239, 574908, 7618438, 100803036, 1332343288
+};
+
+size_t cubesWithin(int depth)
+{
+    size_t n = 0;
+    for (int d = 0; d <= depth; ++d) {
+        n += cubesAtDistance[d];
+    }
+    return n;
+}
+
+// At most 80% full
+size_t slotsFor(int depth)
+{
+    return cubesWithin(depth) / 4 * 5 + 8;
+}
+
+uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// The low 4 bits of an entry are the distance, the rest the hash; 0 is
+// empty
+constexpr uint64_t distanceMask = 0xf;
+
+uint64_t keyOf(uint64_t h)
+{
+    const uint64_t key = h & ~distanceMask;
+    return key ? key : distanceMask + 1;
+}
+}
+
+size_t MyEndgameTable::bytes(int depth)
+{
+    return slotsFor(depth) * sizeof(uint64_t);
+}
+
+bool MyEndgameTable::load(const char *path, int depth, int threads)
+{
+    if (depth < 1 || depth > maxDepth) {
+        printf("Endgame depth %d is not 1 to %d\n", depth, maxDepth);
+        return false;
+    }
+    maxDistance = depth;
+    slots = slotsFor(depth);
+    if (path && file.map(path, endgameMagic, depth, bytes(depth))) {
+        entries = (const uint64_t *) file.data();
+        return check(path, threads);
+    }
+
+    build(threads);
+    if (!check(path ? path : "built", threads)) {
+        return false;
+    }
+    if (path && MyTableFile::write(path, endgameMagic, depth, owned,
+                                   bytes(depth))
+     && file.map(path, endgameMagic, depth, bytes(depth))) {
+        entries = (const uint64_t *) file.data();
+        delete[] owned;
+        owned = nullptr;
+    }
+    return true;
+}
+
+// Two cubes may share the 60 bits of an entry, which keeps only one of
+// them: about once among the cubes at distance 8, never closer
+bool MyEndgameTable::check(const char *name, int threads) const
+{
+    // Last, any farther than depth(): a damaged table
+    std::atomic<size_t> counts[maxDepth + 2] = {};
+    parallelFor(slots, 1 << 20, threads, [&](size_t first, size_t end) {
+        size_t local[distanceMask + 1] = {};
+        for (size_t s = first; s < end; ++s) {
+            if (entries[s]) {
+                ++local[entries[s] & distanceMask];
+            }
+        }
+        for (int d = 0; d <= int(distanceMask); ++d) {
+            counts[std::min(d, maxDistance + 1)] += local[d];
+        }
+    });
+    for (int d = 0; d <= maxDistance + 1; ++d) {
+        const size_t expected = d <= maxDistance ? cubesAtDistance[d] : 0;
+        if (counts[d] > expected || expected - counts[d] > expected >> 28) {
+            printf("endgame table %s: %zu cubes at distance %d, not %zu\n",
+                   name, counts[d].load(), d, expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t MyEndgameTable::hash(const MyCubieCube& cube)
+{
+    uint64_t corners = 0;
+    uint64_t edges = 0;
+    for (int i = 0; i < 8; ++i) {
+        corners = corners << 5 | cube.cp[i] << 2 | cube.co[i];
+    }
+    for (int i = 0; i < 12; ++i) {
+        edges = edges << 5 | cube.ep[i] << 1 | cube.eo[i];
+    }
+    return mix(corners * 0x9e3779b97f4a7c15ull ^ mix(edges));
+}
+
+size_t MyEndgameTable::slotOf(uint64_t h) const
+{
+    return size_t((unsigned __int128) h * slots >> 64);
+}
+
+int MyEndgameTable::distance(const MyCubieCube& cube) const
+{
+    const uint64_t h = hash(cube);
+    const uint64_t key = keyOf(h);
+    for (size_t s = slotOf(h);; s = s + 1 == slots ? 0 : s + 1) {
+        const uint64_t e = entries[s];
+        if (e == 0) {
+            return -1;
+        }
+        if ((e & ~distanceMask) == key) {
+            return int(e & distanceMask);
+        }
+    }
+}
+
+bool MyEndgameTable::solve(const MyCubieCube& cube,
+                           std::vector<int>& moves, int maxLength) const
+{
+    moves.clear();
+    const int k = distance(cube);
+    if (k >= 0) {
+        return k <= maxLength && descend(cube, moves);
+    }
+    // Every cube n moves on is depth() or more away, as the shorter ones
+    // found nothing
+    for (int n = 1; maxDistance + n <= maxLength; ++n) {
+        if (forward(cube, n, -1, moves)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MyEndgameTable::forward(const MyCubieCube& cube, int n, int last,
+                             std::vector<int>& moves) const
+{
+    for (int m = 0; m < C::numMoves; ++m) {
+        if (last >= 0 && C::redundantAfter(m, last)) {
+            continue;
+        }
+        MyCubieCube next = cube;
+        next.move(m);
+        moves.push_back(m);
+        if (n > 1 ? forward(next, n - 1, m, moves)
+                  : distance(next) == maxDistance && descend(next, moves)) {
+            return true;
+        }
+        moves.pop_back();
+    }
+    return false;
+}
+
+bool MyEndgameTable::descend(const MyCubieCube& cube,
+                             std::vector<int>& moves) const
+{
+    const size_t start = moves.size();
+    MyCubieCube c = cube;
+    // Some move always leads one closer
+    for (int d = distance(c); d > 0; --d) {
+        int m = 0;
+        MyCubieCube next;
+        for (; m < C::numMoves; ++m) {
+            next = c;
+            next.move(m);
+            if (distance(next) == d - 1) {
+                break;
+            }
+        }
+        if (m == C::numMoves) {
+            break;
+        }
+        moves.push_back(m);
+        c = next;
+    }
+    if (c.isSolved()) {
+        return true;
+    }
+    moves.resize(start);
+    return false;
+}
+
+bool MyEndgameTable::insert(uint64_t h, int distance)
+{
+    const uint64_t key = keyOf(h);
+    const uint64_t entry = key | uint64_t(distance);
+    for (size_t s = slotOf(h);; s = s + 1 == slots ? 0 : s + 1) {
+        uint64_t e = __atomic_load_n(owned + s, __ATOMIC_RELAXED);
+        while (e == 0) {
+            if (__atomic_compare_exchange_n(owned + s, &e, entry, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                return true;
+            }
+        }
+        if ((e & ~distanceMask) != key) {
+            continue;
+        }
+        // Whoever set a distance as close goes on from there
+        while (int(e & distanceMask) > distance) {
+            if (__atomic_compare_exchange_n(owned + s, &e, entry, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+// Depth first from solved over the canonical move sequences, one first
+// move per task. A cube reached again no closer than before is not gone
+// on from, so the work is about the number of cubes, not sequences.
+void MyEndgameTable::build(int threads)
+{
+    owned = new uint64_t[slots]();
+    entries = owned;
+    const MyCubieCube solved;
+    insert(hash(solved), 0);
+
+    struct Step {
+        MyCubieCube cube;
+        int move;
+    };
+    parallelFor(C::numMoves, 1, threads, [this](size_t first, size_t end) {
+        Step stack[maxDepth + 1];
+        for (; first < end; ++first) {
+            int n = 1;
+            stack[1].cube = MyCubieCube();
+            stack[1].cube.move(int(first));
+            stack[1].move = int(first);
+            bool descend = insert(hash(stack[1].cube), 1);
+            for (;;) {
+                if (descend && n < maxDistance) {
+                    stack[++n].move = -1;
+                }
+                // Next sibling of stack[n], or back up
+                int m = stack[n].move + 1;
+                while (n > 1 && m < C::numMoves
+                    && C::redundantAfter(m, stack[n - 1].move)) {
+                    ++m;
+                }
+                if (n == 1 || m >= C::numMoves) {
+                    if (--n < 1) {
+                        break;
+                    }
+                    descend = false;
+                    continue;
+                }
+                stack[n].cube = stack[n - 1].cube;
+                stack[n].cube.move(m);
+                stack[n].move = m;
+                descend = insert(hash(stack[n].cube), n);
+            }
+        }
+    });
+}
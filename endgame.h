@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "cubiecube.h"
+#include "tablefile.h"
+
+// Every cube within depth moves of solved, with its distance: an open
+// addressed hash table of 8 byte entries, mapped from a file like the
+// other tables. A search that gets within depth moves of the end looks
+// the rest up instead of searching it, so a position of up to twice
+// depth moves only needs a search of depth moves.
+//
+// Entries keep 60 bits of a 64-bit hash of the cube, not the cube
+// itself (which takes 66 bits), so another cube can, very rarely, pass
+// for one in the table; solve() checks its moves.
+struct MyEndgameTable {
+    typedef MyCubieCube C;
+    // Cubes at each distance up to 8 are known, which sizes the table;
+    // 8 takes 14 GB
+    static constexpr int maxDepth = 8;
+
+    MyEndgameTable() = default;
+    MyEndgameTable(MyEndgameTable&) = delete;
+    ~MyEndgameTable() { delete[] owned; }
+
+    // Bytes of the table for depth
+    static size_t bytes(int depth);
+
+    // Maps path, or builds the table on threads threads and writes it
+    // there first; null only builds it. False if depth is over maxDepth,
+    // or if the table misses cubes or has too many.
+    bool load(const char *path, int depth, int threads);
+
+    int depth() const { return maxDistance; }
+    // Distance to solved, -1 if over depth()
+    int distance(const MyCubieCube& cube) const;
+    // The moves of a shortest solution of cube, false if it takes over
+    // maxLength. Past depth(), searches the first moves until a cube in
+    // the table is depth() moves away: fast for a few moves more.
+    bool solve(const MyCubieCube& cube, std::vector<int>& moves,
+               int maxLength) const;
+
+  private:
+    static uint64_t hash(const MyCubieCube& cube);
+    size_t slotOf(uint64_t h) const;
+    // Sets the distance of the cube with hash h, if it is new or closer
+    // than before. True if the caller is to go on from it.
+    bool insert(uint64_t h, int distance);
+    // Appends the moves down to solved from a cube in the table
+    bool descend(const MyCubieCube& cube, std::vector<int>& moves) const;
+    // Appends n moves to a cube depth() away and the rest
+    bool forward(const MyCubieCube& cube, int n, int last,
+                 std::vector<int>& moves) const;
+    void build(int threads);
+    // Whether the table holds as many cubes at each distance as there are
+    bool check(const char *name, int threads) const;
+
+    int maxDistance = 0;
+    size_t slots = 0;
+    MyTableFile file;
+    uint64_t *owned = nullptr;
+    const uint64_t *entries = nullptr;
+};
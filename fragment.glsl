@@ -8,7 +8,17 @@ uniform int passThroughShader;
 uniform vec3 lightPos;
 out vec4 color;
 
+#ifdef SHADOW_VSM
+// The blurred depth and depth squared, see fragment_shadowmap.glsl
+uniform sampler2D shadowMap;
+// Keeps the variance off 0 on flat surfaces, against acne
+const float minVariance = 0.00001;
+// Share of the Chebyshev bound cut off, against light bleeding where
+// shadows overlap
+const float bleedReduction = 0.2;
+#else
 uniform sampler2DShadow shadowMap;
+#endif
 
 const vec3 diffuseColor = vec3(0.2, 0.2, 0.2);
 const vec3 specColor = vec3(1.0, 1.0, 1.0);
@@ -37,6 +47,20 @@ void main(void)
 {
     float visibility=1.0;
 
+#ifdef SHADOW_VSM
+    // The Chebyshev upper bound of the share of the filtered area lit,
+    // darkened to the same 0.2 as the PCF below
+    vec3 coord = shadowCoord.xyz / shadowCoord.w;
+    vec2 moments = texture(shadowMap, coord.xy).rg;
+    if (coord.z > moments.x) {
+        float variance = max(moments.y - moments.x * moments.x, minVariance);
+        float d = coord.z - moments.x;
+        float lit = variance / (variance + d * d);
+        lit = clamp((lit - bleedReduction) / (1.0 - bleedReduction),
+                    0.0, 1.0);
+        visibility = 0.2 + 0.8 * lit;
+    }
+#else
     // Fixed bias, or...
     float bias = 0.005;
 
@@ -49,6 +73,7 @@ void main(void)
                           (shadowCoord.z-bias)/shadowCoord.w);
         visibility -= 0.2*(1.0-texture(shadowMap, coord));
     }
+#endif
     if (passThroughShader == 0) {
         vec3 n = normalize(outNormal);
         vec3 l = normalize(lightPos - vertPos);
@@ -0,0 +1,26 @@
+#version 410 core
+
+layout (location = 0) out vec2 blurred;
+
+// One pass of a separable 9 tap Gaussian over the VSM moments, along
+// direction, in whole texels
+uniform sampler2D moments;
+uniform ivec2 direction;
+
+const float weights[5] = float[](0.2270270270, 0.1945945946, 0.1216216216,
+                                 0.0540540541, 0.0162162162);
+
+void main(void)
+{
+    ivec2 last = textureSize(moments, 0) - 1;
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec2 sum = weights[0] * texelFetch(moments, p, 0).rg;
+    for (int i = 1; i < 5; ++i) {
+        sum += weights[i] * (
+            texelFetch(moments, clamp(p + i * direction, ivec2(0), last),
+                       0).rg +
+            texelFetch(moments, clamp(p - i * direction, ivec2(0), last),
+                       0).rg);
+    }
+    blurred = sum;
+}
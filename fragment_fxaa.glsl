@@ -0,0 +1,72 @@
+#version 410 core
+
+layout (location = 0) out vec4 color;
+
+// Like fragment_upscale.glsl, smoothing the edges on the way: FXAA, after
+// the simplest variant in Timothy Lottes' paper. Edges are found from the
+// luma of the corners around each pixel, then blurred along their
+// direction over up to spanMax texels.
+uniform sampler2D scene;
+uniform vec2 uvScale;
+uniform vec2 uvMax;
+in vec2 UV;
+
+// Contrast below which nothing is done, relative then absolute
+const float edgeThreshold = 1.0 / 8.0;
+const float edgeThresholdMin = 1.0 / 16.0;
+const float spanMax = 8.0;
+const float reduceMul = 1.0 / 8.0;
+const float reduceMin = 1.0 / 128.0;
+
+float luma(vec3 c)
+{
+    return dot(c, vec3(0.299, 0.587, 0.114));
+}
+
+vec3 fetch(vec2 uv)
+{
+    return texture(scene, min(uv, uvMax)).rgb;
+}
+
+// The texel at p, unfiltered, which is cheaper
+float lumaAt(ivec2 p, ivec2 last)
+{
+    return luma(texelFetch(scene, clamp(p, ivec2(0), last), 0).rgb);
+}
+
+void main(void)
+{
+    vec2 size = vec2(textureSize(scene, 0));
+    vec2 texel = 1.0 / size;
+    vec2 uv = min(UV * uvScale, uvMax);
+    vec3 rgbM = fetch(uv);
+    float lumaM = luma(rgbM);
+    ivec2 p = ivec2(uv * size);
+    ivec2 last = ivec2(uvMax * size);
+    float lumaNW = lumaAt(p + ivec2(-1, 1), last);
+    float lumaNE = lumaAt(p + ivec2(1, 1), last);
+    float lumaSW = lumaAt(p + ivec2(-1, -1), last);
+    float lumaSE = lumaAt(p + ivec2(1, -1), last);
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+    if (lumaMax - lumaMin < max(edgeThresholdMin, lumaMax * edgeThreshold)) {
+        color = vec4(rgbM, 1.0);
+        return;
+    }
+
+    // Along the edge, across the gradient
+    vec2 dir = vec2((lumaNW + lumaNE) - (lumaSW + lumaSE),
+                    (lumaNW + lumaSW) - (lumaNE + lumaSE));
+    float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25
+                          * reduceMul, reduceMin);
+    float rcpDirMin = 1.0 / (min(abs(dir.x), abs(dir.y)) + dirReduce);
+    dir = clamp(dir * rcpDirMin, -spanMax, spanMax) * texel;
+
+    vec3 rgbA = 0.5 * (fetch(uv + dir * (1.0 / 3.0 - 0.5))
+                       + fetch(uv + dir * (2.0 / 3.0 - 0.5)));
+    vec3 rgbB = 0.5 * rgbA + 0.25 * (fetch(uv - dir * 0.5)
+                                     + fetch(uv + dir * 0.5));
+    // The wider blur only if it didn't cross into another edge
+    float lumaB = luma(rgbB);
+    color = vec4(lumaB < lumaMin || lumaB > lumaMax ? rgbA : rgbB, 1.0);
+}
@@ -0,0 +1,9 @@
+#version 410 core
+
+in vec3 vsColor;
+layout (location = 0) out vec4 color;
+
+void main(void)
+{
+    color = vec4(vsColor, 1.0);
+}
@@ -1,8 +1,19 @@
 #version 410 core
 
+#ifdef SHADOW_VSM
+// The depth and its square, to be filtered like any texture
+layout (location = 0) out vec2 moments;
+
+void main(void)
+{
+    float z = gl_FragCoord.z;
+    moments = vec2(z, z * z);
+}
+#else
 //layout (location = 0) out float depth;
 
 void main(void)
 {
     //depth = gl_FragCoord.z;
 }
+#endif
@@ -0,0 +1,16 @@
+#version 410 core
+
+layout (location = 0) out vec4 color;
+
+// The scene, drawn into the bottom left corner of the texture
+uniform sampler2D scene;
+// Texture coordinates of the top right of what was drawn, and of the
+// last texel center in it, not to filter in what lies beyond
+uniform vec2 uvScale;
+uniform vec2 uvMax;
+in vec2 UV;
+
+void main(void)
+{
+    color = vec4(texture(scene, min(UV * uvScale, uvMax)).rgb, 1.0);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+#define GLFW_NO_GLU 1
+#define GLFW_INCLUDE_GLCOREARB 1
+#include "GLFW/glfw3.h"
+
+#define STR(s) #s
+
+#define glCall(x) \
+do { \
+    (x); \
+    GLenum ret = glGetError(); \
+    if (ret != GL_NO_ERROR) { \
+        printf("error: %s returned %d\n", STR(x), int(ret)); \
+        exit(1); \
+    } \
+} while(0)
@@ -0,0 +1,95 @@
+#include "headless.h"
+
+#include <cstdio>
+
+#ifdef HAVE_EGL
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "glutil.h"
+
+bool MyHeadlessContext::create(int major, int minor)
+{
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+                            eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!getPlatformDisplay) {
+        puts("EGL_EXT_platform_base is not supported");
+        return false;
+    }
+
+    EGLDisplay dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                        EGL_DEFAULT_DISPLAY, nullptr);
+    EGLint eglMajor, eglMinor;
+    if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, &eglMajor, &eglMinor)) {
+        printf("eglInitialize failed: 0x%x\n", eglGetError());
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        printf("eglBindAPI failed: 0x%x\n", eglGetError());
+        eglTerminate(dpy);
+        return false;
+    }
+
+    const EGLint attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, major,
+        EGL_CONTEXT_MINOR_VERSION, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    // Surfaceless contexts need no config (EGL_KHR_no_config_context)
+    EGLContext ctx = eglCreateContext(dpy, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT,
+                                      attribs);
+    if (ctx == EGL_NO_CONTEXT) {
+        printf("eglCreateContext failed: 0x%x\n", eglGetError());
+        eglTerminate(dpy);
+        return false;
+    }
+    if (!eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+        printf("eglMakeCurrent failed: 0x%x\n", eglGetError());
+        eglDestroyContext(dpy, ctx);
+        eglTerminate(dpy);
+        return false;
+    }
+
+    display = dpy;
+    context = ctx;
+    return true;
+}
+
+void MyHeadlessContext::destroy()
+{
+    if (!display) {
+        return;
+    }
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(display, context);
+    eglTerminate(display);
+    display = nullptr;
+    context = nullptr;
+}
+
+const char *MyHeadlessContext::renderer() const
+{
+    return context ? (const char *) glGetString(GL_RENDERER) : "none";
+}
+
+#else
+
+bool MyHeadlessContext::create(int, int)
+{
+    puts("headless rendering needs EGL, rebuild with HAVE_EGL");
+    return false;
+}
+
+void MyHeadlessContext::destroy()
+{
+}
+
+const char *MyHeadlessContext::renderer() const
+{
+    return "none";
+}
+
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+
+// OpenGL core context without a window or display server, created through
+// EGL's surfaceless platform (Mesa; llvmpipe is used when no GPU is
+// present). Rendering goes to framebuffer objects only. Builds without
+// HAVE_EGL get a stub whose create() fails.
+struct MyHeadlessContext {
+    MyHeadlessContext() = default;
+    MyHeadlessContext(MyHeadlessContext&) = delete;
+    ~MyHeadlessContext() { destroy(); }
+
+    bool create(int major, int minor);
+    void destroy();
+
+    const char *renderer() const;
+
+  private:
+    void *display = nullptr;
+    void *context = nullptr;
+};
@@ -0,0 +1,119 @@
+#include "image.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <zlib.h>
+
+using namespace std;
+
+namespace {
+void putBe32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+void writeChunk(FILE *f, const char *type, const unsigned char *data,
+                uint32_t len)
+{
+    unsigned char buf[4];
+    putBe32(buf, len);
+    fwrite(buf, 1, 4, f);
+    fwrite(type, 1, 4, f);
+    uLong crc = crc32(0, (const Bytef *) type, 4);
+    if (len) {
+        fwrite(data, 1, len, f);
+        crc = crc32(crc, data, len);
+    }
+    putBe32(buf, crc);
+    fwrite(buf, 1, 4, f);
+}
+}
+
+void MyPngWriter::reserve(int width, int height)
+{
+    const size_t size = size_t(height) * (1 + size_t(width) * 3);
+    if (scanlines.size() < size) {
+        scanlines.resize(size);
+        compressed.resize(compressBound(size));
+    }
+}
+
+bool MyPngWriter::write(const char *filename, const unsigned char *rgba,
+                        int width, int height, size_t stride, bool bottomUp)
+{
+    reserve(width, height);
+
+    // Unfiltered RGB scanlines
+    unsigned char *dst = scanlines.data();
+    for (int y = 0; y < height; ++y) {
+        const int row = bottomUp ? height - 1 - y : y;
+        const unsigned char *src = rgba + row * stride;
+        *dst++ = 0;
+        for (int x = 0; x < width; ++x) {
+            *dst++ = src[0];
+            *dst++ = src[1];
+            *dst++ = src[2];
+            src += 4;
+        }
+    }
+    const size_t size = dst - scanlines.data();
+    uLongf compressedLen = compressed.size();
+    if (compress2(compressed.data(), &compressedLen, scanlines.data(), size,
+                  Z_BEST_SPEED) != Z_OK) {
+        printf("compression of %s failed\n", filename);
+        return false;
+    }
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        printf("Could not open %s\n", filename);
+        return false;
+    }
+    constexpr unsigned char signature[8] = { 0x89, 'P', 'N', 'G',
+                                             '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, 8, f);
+    unsigned char ihdr[13];
+    putBe32(ihdr, width);
+    putBe32(ihdr + 4, height);
+    ihdr[8] = 8;   // bit depth
+    ihdr[9] = 2;   // RGB
+    ihdr[10] = 0;  // deflate
+    ihdr[11] = 0;  // adaptive filtering
+    ihdr[12] = 0;  // no interlace
+    writeChunk(f, "IHDR", ihdr, 13);
+    writeChunk(f, "IDAT", compressed.data(), compressedLen);
+    writeChunk(f, "IEND", nullptr, 0);
+    fclose(f);
+    return true;
+}
+
+bool isNumberedPattern(const char *pattern)
+{
+    int conversions = 0;
+    for (const char *p = pattern; *p; ++p) {
+        if (*p != '%' || *++p == '%') {
+            continue;
+        }
+        p += strspn(p, "-+ #0");
+        p += strspn(p, "0123456789");
+        if (*p != 'd') {
+            return false;
+        }
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+bool numberedName(char *name, size_t size, const char *pattern, int n)
+{
+    if (!isNumberedPattern(pattern)) {
+        return false;
+    }
+    const int len = snprintf(name, size, pattern, n);
+    return len >= 0 && size_t(len) < size;
+}
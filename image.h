@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// PNG encoder for 8-bit RGBA pixels as read back from GL. The scanline and
+// deflate buffers are kept between calls so encoding a sequence of frames
+// of the same size does not allocate.
+struct MyPngWriter {
+    // stride is in bytes; bottomUp flips the rows, GL returns them bottom
+    // first
+    bool write(const char *filename, const unsigned char *rgba,
+               int width, int height, size_t stride, bool bottomUp);
+
+    // Sizes the buffers for width x height images ahead of time
+    void reserve(int width, int height);
+
+  private:
+    std::vector<unsigned char> scanlines;
+    std::vector<unsigned char> compressed;
+};
+
+// Names of numbered files, e.g. "frame%04d.png". The pattern goes to
+// snprintf, so it must hold exactly one %d (flags and width allowed) and
+// no other conversion but %%.
+bool isNumberedPattern(const char *pattern);
+// The pattern's name for n; false if it is not one or name is too short
+bool numberedName(char *name, size_t size, const char *pattern, int n);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+
+// Latest value handoff from one writer thread to one reader thread, wait
+// free on both sides. Three slots: the writer fills its own back slot and
+// swaps it with the shared middle one; the reader swaps the middle slot
+// with its front one when it holds something newer. Neither side ever
+// touches the other's slot, so a writer faster than the reader simply
+// overwrites values that were never read.
+template <typename T>
+struct MyMailbox {
+    MyMailbox() = default;
+    MyMailbox(MyMailbox&) = delete;
+
+    // Writer side: fill the slot, then publish() it
+    T& back() { return slots[backIndex]; }
+    void publish()
+    {
+        const unsigned prev = middle.exchange(backIndex | NEW,
+                                              std::memory_order_acq_rel);
+        backIndex = prev & INDEX;
+    }
+    void write(const T& value)
+    {
+        back() = value;
+        publish();
+    }
+
+    // Reader side: picks up the latest published value, if any is newer
+    // than front(). Returns false when there is none.
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & NEW)) {
+            return false;
+        }
+        const unsigned prev = middle.exchange(frontIndex,
+                                              std::memory_order_acq_rel);
+        frontIndex = prev & INDEX;
+        return true;
+    }
+    const T& front() const { return slots[frontIndex]; }
+
+  private:
+    static constexpr unsigned INDEX = 3;
+    static constexpr unsigned NEW = 4;
+
+    T slots[3];
+    // Slot index, with NEW set until the reader takes it
+    alignas(64) std::atomic<unsigned> middle{1};
+    // Writer only
+    alignas(64) unsigned backIndex = 0;
+    // Reader only
+    alignas(64) unsigned frontIndex = 2;
+};
@@ -1,31 +1,40 @@
 #include <cmath>
 #include <cstring>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <algorithm>
 
+#include <sys/resource.h>
+
+#include "allocstats.h"
+#include "capture.h"
 #include "cube.h"
+#include "glutil.h"
+#include "headless.h"
+#include "image.h"
+#include "mailbox.h"
+#include "profiler.h"
+#include "control.h"
+#include "replay.h"
+#include "resolution.h"
+#include "scramble.h"
+#include "simulation.h"
+#include "softrender.h"
+#include "solver.h"
+#include "trace.h"
 
 using namespace std;
 
-#define GLFW_NO_GLU 1
-#define GLFW_INCLUDE_GLCOREARB 1
-#include "GLFW/glfw3.h"
-
-#define STR(s) #s
-
-#define glCall(x) \
-do { \
-    (x); \
-    GLenum ret = glGetError(); \
-    if (ret != GL_NO_ERROR) { \
-        printf("error: %s returned %d\n", STR(x), int(ret)); \
-        exit(1); \
-    } \
-} while(0)
-
 #define SHADOWMAP_SIZE 4096
+// Variance shadow maps: filtered, so a much smaller map does
+#define VSM_SIZE 512
+#define OVERLAY_MAX_VERTICES 12288
 
 namespace {
 string getFileAsString(const char *filename) {
@@ -35,6 +44,27 @@ string getFileAsString(const char *filename) {
     return string((std::istreambuf_iterator<char>(ifs)),
                    std::istreambuf_iterator<char>());
 }
+
+// Real time, for benchmarks where the GLFW clock is not running
+double wallTime()
+{
+    return chrono::duration<double>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Peak resident set size in KiB
+long peakRssKb()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
 }
 
 MyMatrix lookAt(const MyPoint& eye, const MyPoint& center, const MyPoint& up)
@@ -66,6 +96,57 @@ MyMatrix lookAt(const MyPoint& eye, const MyPoint& center, const MyPoint& up)
     return rot * trans;
 }
 
+struct MyOptions {
+    bool headless = false;
+    int width = 800;
+    int height = 600;
+    int samples = 4;
+    // Headless only: 0 renders until all the turns are done
+    int frames = 0;
+    double fps = 60.0;
+    // Headless only: frame output, a %d in the name writes every frame
+    const char *output = nullptr;
+    // Turns applied at startup, e.g. "R U R' U2"
+    const char *moves = nullptr;
+    // Frame sequence capture: frame%d.png files or a raw .yuv stream
+    const char *capture = nullptr;
+    int captureBuffers = 3;
+    int captureThreads = 0;
+    bool showShadowMap = true;
+    // Headless only: render on the CPU with MySoftRenderer, no GL at all
+    bool software = false;
+    // Quarter turn animation time, shortened while turns are queued down
+    // to minTurnTime; turns shorter than a frame are applied at once
+    double turnTime = 0.4;
+    double minTurnTime = 0.05;
+    // Batch thumbnails: moves file ("-" for stdin), one state per line,
+    // written to --output, which contains a %d for the state number
+    const char *batch = nullptr;
+    int tileSize = 128;
+    int atlasSize = 2048;
+    // Headless benchmark: events injected into the simulation (see
+    // replay.h), with the frame times, turn rate and peak memory written
+    // as JSON to report, stdout if null
+    const char *replay = nullptr;
+    const char *report = nullptr;
+    // Window only: Unix socket other processes stream moves into (see
+    // control.h)
+    const char *control = nullptr;
+    // GL only: milliseconds a frame may take; the scene is drawn at a
+    // lower resolution and stretched to the window while it is over, back
+    // at full resolution once nothing moves. 0 always draws at full size.
+    float frameBudget = 0.0f;
+    // GL only: MSAA draws the scene with samples; FXAA draws it with none
+    // and smooths the edges in a full screen pass after
+    enum Antialiasing { MSAA, FXAA };
+    Antialiasing antialiasing = MSAA;
+    // GL only: PCF takes 4 depth compares in a SHADOWMAP_SIZE depth map;
+    // VSM one filtered fetch in a blurred, mipmapped VSM_SIZE map of the
+    // depth and its square
+    enum ShadowFilter { PCF, VSM };
+    ShadowFilter shadows = PCF;
+};
+
 struct MyApp
 {
     static void errorCallback(int error, const char *desc)
@@ -77,9 +158,23 @@ struct MyApp
     MyApp() = default;
     MyApp(MyApp&) = delete;
 
+    MyOptions options;
+
     GLFWwindow *window = nullptr;
     void run()
     {
+        if (options.control && (options.batch || options.headless)) {
+            puts("--control needs the window, ignored");
+        }
+        if (options.batch) {
+            runBatch();
+            return;
+        }
+        if (options.headless) {
+            runHeadless();
+            return;
+        }
+
         bool running = true;
 
         if (!glfwInit()) {
@@ -89,8 +184,10 @@ struct MyApp
         glfwSetErrorCallback(errorCallback);
 
 
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+        // As the shaders' #version, and the headless context; the
+        // profiler's GL_TIME_ELAPSED queries need 3.3
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
 
 #ifdef _DEBUG
         glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
@@ -98,41 +195,898 @@ struct MyApp
 
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-        glfwWindowHint(GLFW_SAMPLES, 4);
+        glfwWindowHint(GLFW_SAMPLES, windowSamples());
         glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
-        window = glfwCreateWindow(800, 600, "CubeSolver",
+        window = glfwCreateWindow(options.width, options.height, "CubeSolver",
                                   NULL, nullptr);
         if (!window) {
             puts("window creation failed");
             return;
         }
 
-        glfwMakeContextCurrent(window);
         glfwSetWindowUserPointer(window, this);
         glfwSetWindowSizeCallback(window, glfw_onResize);
         glfwSetKeyCallback(window, glfw_onKey);
         //glfwSetCursorPosCallback(window, glfw_onMouseMove);
 
         glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+        glfwGetCursorPos(window, &curX, &curY);
 
-        startup();
+        // This thread handles input and steps the simulation, GL is all on
+        // the render thread: a slow frame or swap never delays input
+        TRACE_THREAD_NAME("main");
+        initSimulation();
+        if (options.moves) {
+            sim.queueMoves(options.moves);
+        }
+        if (options.control) {
+            control.open(options.control);
+        }
+        thread renderThread(&MyApp::renderLoop, this);
+        // After the first frame's work is under way, and off both threads
+        solverTables.loadInBackground(
+            "twophase.tables", max(1, int(thread::hardware_concurrency()) - 1));
 
         do
         {
-            render(glfwGetTime());
-
-            glfwSwapBuffers(window);
-            glfwPollEvents();
+            // Sockets are only checked here, commands wait at most a step
+            control.poll(sim, glfwGetTime());
+            pollSolver();
+            stepSimulation(glfwGetTime());
+            control.update(sim, glfwGetTime());
+            {
+                // Until the next step is due, or input comes
+                TRACE_SCOPE("waitEvents");
+                const double wait = simFrame.clockOffset + sim.time()
+                                  + MySimulation::dt - glfwGetTime();
+                if (wait > 0.0) {
+                    glfwWaitEventsTimeout(wait);
+                }
+                else {
+                    glfwPollEvents();
+                }
+            }
 
             running &= (glfwGetKey(window, GLFW_KEY_ESCAPE ) == GLFW_RELEASE);
             running &= !glfwWindowShouldClose(window);
         } while(running);
 
-        shutdown();
+        stopRendering = true;
+        renderThread.join();
+        solveCancel = true;
+        if (solveThread.joinable()) {
+            solveThread.join();
+        }
+        control.printStats();
+        control.close();
+        printMemory();
 
         glfwTerminate();
     }
+
+    atomic<bool> stopRendering{false};
+    void renderLoop()
+    {
+        TRACE_THREAD_NAME("render");
+        glfwMakeContextCurrent(window);
+        startup();
+        startCapture();
+
+        while (!stopRendering) {
+            applyResize();
+            if (profileDumpRequested.exchange(false)
+             && profiler.dumpCsv("profile.csv")
+             && profiler.dumpJson("profile.json")) {
+                puts("profile written to profile.csv and profile.json");
+            }
+
+            render(glfwGetTime());
+            if (capture.active()) {
+                capture.capture(sceneFrameBuf);
+            }
+
+            TRACE_SCOPE("swapBuffers");
+            glfwSwapBuffers(window);
+        }
+
+        shutdown();
+        glfwMakeContextCurrent(nullptr);
+    }
+
+    // Same startup and render paths as the window, drawing into an FBO
+    // of arbitrary size on a surfaceless context, with a simulated clock
+    void runHeadless()
+    {
+        MyHeadlessContext context;
+        if (!options.software && !context.create(4, 1)) {
+            puts("headless context creation failed");
+            return;
+        }
+        printf("headless rendering %dx%d on %s\n", options.width,
+               options.height,
+               options.software ? "the CPU" : context.renderer());
+
+        TRACE_THREAD_NAME("main");
+        windowWidth = options.width;
+        windowHeight = options.height;
+        simulatedClock = true;
+        simTime = 0.0;
+
+        if (options.software) {
+            startupSoftware();
+        }
+        else {
+            initSimulation();
+            startup();
+            initOffscreenTarget();
+        }
+        if (options.moves) {
+            sim.queueMoves(options.moves);
+        }
+        if (options.replay) {
+            if (!replay.load(options.replay)) {
+                exit(1);
+            }
+            replaying = true;
+        }
+        if (options.software && options.frameBudget > 0.0f) {
+            puts("--frame-budget needs GL, ignored with --software");
+        }
+        if (options.software && options.antialiasing == MyOptions::FXAA) {
+            puts("--aa fxaa needs GL, ignored with --software");
+        }
+        if (options.software && options.shadows == MyOptions::VSM) {
+            puts("--shadows vsm needs GL, ignored with --software");
+        }
+        if (options.software && options.capture) {
+            puts("--capture needs GL, ignored with --software");
+        }
+        else {
+            startCapture();
+        }
+
+        const bool everyFrame = options.output
+                             && isNumberedPattern(options.output);
+        // With no frame count, stop once every queued turn is done
+        constexpr int maxFrames = 100000;
+        int frame = 0;
+        vector<double> frameTimes;
+        const double startTime = wallTime();
+        do {
+            const double frameStart = wallTime();
+            simTime = frame / options.fps;
+            stepSimulation(simTime);
+            if (options.software) {
+                renderSoftware(simTime);
+            }
+            else {
+                render(simTime);
+                if (replaying) {
+                    // Frame times include the GPU work
+                    glFinish();
+                }
+            }
+            if (capture.active()) {
+                capture.capture(sceneFrameBuf);
+            }
+            if (everyFrame) {
+                char filename[1024];
+                if (numberedName(filename, sizeof(filename), options.output,
+                                 frame)) {
+                    writeFrame(filename);
+                }
+            }
+            if (replaying) {
+                frameTimes.push_back(wallTime() - frameStart);
+            }
+            ++frame;
+        } while (options.frames > 0 ? frame < options.frames
+                                    : (!isIdle() || (replaying
+                                                     && !replay.done()))
+                                      && frame < maxFrames);
+
+        if (options.output && !everyFrame) {
+            writeFrame(options.output);
+        }
+        const double elapsed = wallTime() - startTime;
+        printf("rendered %d frames in %.2fs (%.1f fps)\n", frame, elapsed,
+               elapsed > 0.0 ? frame / elapsed : 0.0);
+        printMemory();
+        if (replaying) {
+            writeReport(frameTimes, elapsed,
+                        options.software ? "software" : context.renderer());
+        }
+
+        if (options.software) {
+            softRenderer.shutdown();
+        }
+        else {
+            shutdown();
+        }
+    }
+
+    MyReplay replay;
+    bool replaying = false;
+    MyControlServer control;
+
+    // Window only: Enter solves the cube with the two-phase solver. Its
+    // tables load in the background; solving works as soon as the move
+    // tables are there, faster as the pruning tables fill in. Solves run
+    // on solveThread, the input thread queues the moves they find.
+    MyTwoPhaseTables solverTables;
+    bool tablesReported = false;
+    thread solveThread;
+    atomic<bool> solving{false};
+    atomic<bool> solveCancel{false};
+    atomic<bool> solutionReady{false};
+    string solution;
+    // Turns requested when the solve started, later ones make it stale
+    unsigned solvedTurn = 0;
+
+    void solveCube()
+    {
+        if (!solverTables.ready()) {
+            puts("solver tables not ready yet");
+            return;
+        }
+        if (solving) {
+            return;
+        }
+        if (!sim.isIdle()) {
+            puts("the cube is still turning");
+            return;
+        }
+        char facelets[55];
+        sim.rubik.facelets(facelets);
+        MyCubieCube cube;
+        if (!cube.fromFacelets(facelets)) {
+            puts("not a solvable cube");
+            return;
+        }
+        if (solveThread.joinable()) {
+            solveThread.join();
+        }
+        solving = true;
+        solvedTurn = sim.lastRequestedTurn();
+        solveThread = thread([this, cube]() {
+            typedef MyTwoPhaseSolver::Clock Clock;
+            const MyTwoPhaseTables::Progress p = solverTables.progress();
+            MyTwoPhaseSolver solver(solverTables);
+            const Clock::time_point start = Clock::now();
+            string moves;
+            const MyTwoPhaseSolver::Result r = solver.solve(
+                cube, 21, start + chrono::seconds(10), &solveCancel, moves);
+            const double ms = chrono::duration<double, milli>(
+                Clock::now() - start).count();
+            if (r == MyTwoPhaseSolver::SOLVED) {
+                printf("solved in %.0fms, tables %.0f%% built: %s\n", ms,
+                       100.0 * p.entries / p.total, moves.c_str());
+                solution = moves;
+                solutionReady = true;
+            }
+            else if (r == MyTwoPhaseSolver::TIMEOUT) {
+                puts("no solution found in time");
+            }
+            solving = false;
+        });
+    }
+
+    // Window only: M queues a random scramble
+    static constexpr int scrambleLength = 25;
+    MyRandom scrambleRandom{uint64_t(
+        chrono::steady_clock::now().time_since_epoch().count())};
+
+    void scrambleCube()
+    {
+        int moves[scrambleLength];
+        MyScrambler::randomMoves(scrambleRandom, moves, scrambleLength);
+        sim.queueCubeMoves(
+            MyCubieCube::formatMoves(moves, scrambleLength).c_str());
+    }
+
+    // Input thread: queues finished solutions, reports the tables' build
+    void pollSolver()
+    {
+        if (solutionReady.exchange(false)) {
+            if (sim.lastRequestedTurn() == solvedTurn) {
+                sim.queueCubeMoves(solution.c_str());
+            }
+            else {
+                puts("the cube turned while solving, solution dropped");
+            }
+        }
+        if (!tablesReported && solverTables.complete()) {
+            tablesReported = true;
+            const MyTwoPhaseTables::Progress p = solverTables.progress();
+            if (p.seconds > 0.0) {
+                printf("solver tables built in %.1fs, %.0f entries/s\n",
+                       p.seconds, p.entries / p.seconds);
+            }
+        }
+    }
+
+    // Heap allocations per phase, see allocstats.h; only render() and
+    // the simulation steps are watched
+    MyAllocStats allocStats;
+
+    // Startup ends with the first frame
+    void countStartupAllocations()
+    {
+        if (allocStats.totals(MyAllocStats::FRAME).events == 0) {
+            allocStats.add(MyAllocStats::STARTUP, MyAllocStats::process(),
+                           0);
+        }
+    }
+
+    // What the main parts of the viewer hold, in bytes. GPU memory as
+    // requested, whatever the driver adds.
+    struct MemoryUse {
+        size_t vertexArrays = 0;
+        size_t shadowMap = 0;
+        size_t framebuffers = 0;
+        size_t solverTables = 0;
+    };
+    MemoryUse memoryUse() const
+    {
+        const MyRubik& rubik = sim.rubik;
+        MemoryUse m;
+        if (!options.software) {
+            m.vertexArrays = sizeof(rubik.cubes) + sizeof(rubik.colors)
+                           + sizeof(rubik.normals) + sizeof(groundVec)
+                           + sizeof(groundColor) + sizeof(groundNormal)
+                           + 6 * 3 * sizeof(GLfloat)
+                           + sizeof(overlayVertices) + sizeof(overlayColors);
+            if (vsm()) {
+                // Two float moments with their mipmaps, the blur target,
+                // and the depth
+                const size_t texels = size_t(VSM_SIZE) * VSM_SIZE;
+                m.shadowMap = texels * 8 * 4 / 3 + texels * 8 + texels * 4;
+            }
+            else {
+                m.shadowMap = size_t(SHADOWMAP_SIZE) * SHADOWMAP_SIZE * 2;
+            }
+            // Multisampled color and depth, and the resolved color
+            const size_t pixels = size_t(windowWidth) * windowHeight;
+            m.framebuffers = pixels * (max(windowSamples(), 1) * 8 + 4);
+            if (postFrameBuf) {
+                // Color and depth, and the texture it resolves into
+                m.framebuffers += pixels * (max(postSamples(), 1) * 8
+                                            + (postSamples() ? 4 : 0));
+            }
+        }
+        if (solverTables.ready()) {
+            m.solverTables = sizeof(MyTwoPhaseTables::Data);
+        }
+        return m;
+    }
+
+    void printMemory() const
+    {
+        const MemoryUse m = memoryUse();
+        printf("memory: vertex arrays %.0f KB, shadow map %.0f KB, "
+               "framebuffers %.0f KB, solver tables %.0f KB, peak RSS "
+               "%ld KB\n", m.vertexArrays / 1024.0, m.shadowMap / 1024.0,
+               m.framebuffers / 1024.0, m.solverTables / 1024.0,
+               peakRssKb());
+        allocStats.print();
+    }
+
+    // The replay benchmark's results, as JSON
+    void writeReport(vector<double>& frameTimes, double elapsed,
+                     const char *renderer)
+    {
+        FILE *f = options.report ? fopen(options.report, "w") : stdout;
+        if (!f) {
+            printf("Could not open %s\n", options.report);
+            return;
+        }
+        sort(frameTimes.begin(), frameTimes.end());
+        double total = 0.0;
+        for (double t : frameTimes) {
+            total += t;
+        }
+        const size_t n = frameTimes.size();
+        auto percentile = [&](double p) {
+            return n ? frameTimes[min(n - 1, size_t(p * n))] * 1000.0 : 0.0;
+        };
+
+        fprintf(f, "{\n  \"replay\": \"%s\",\n  \"renderer\": \"%s\",\n"
+                   "  \"width\": %d,\n  \"height\": %d,\n"
+                   "  \"antialiasing\": \"%s\",\n  \"samples\": %d,\n"
+                   "  \"shadows\": \"%s\",\n  \"fps\": %.2f,\n"
+                   "  \"frames\": %zu,\n  \"events\": %zu,\n"
+                   "  \"simulated_s\": %.4f,\n  \"wall_s\": %.4f,\n",
+                options.replay, renderer, windowWidth, windowHeight,
+                fxaa() ? "fxaa" : "msaa", fxaa() ? 0 : options.samples,
+                vsm() ? "vsm" : "pcf", options.fps, n, replay.size(),
+                sim.time(), elapsed);
+        fprintf(f, "  \"frame_ms\": { \"min\": %.4f, \"mean\": %.4f, "
+                   "\"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, "
+                   "\"p99\": %.4f, \"max\": %.4f },\n",
+                percentile(0.0), n ? total / n * 1000.0 : 0.0,
+                percentile(0.5), percentile(0.9), percentile(0.95),
+                percentile(0.99), percentile(1.0));
+        fprintf(f, "  \"turns\": %llu,\n  \"instant_turns\": %llu,\n"
+                   "  \"turns_per_s\": %.2f,\n",
+                sim.turnsDone, sim.instantTurns,
+                elapsed > 0.0 ? sim.turnsDone / elapsed : 0.0);
+        fprintf(f, "  \"frame_budget_ms\": %.2f,\n"
+                   "  \"resolution_scale\": { \"mean\": %.3f, "
+                   "\"min\": %.3f },\n",
+                options.frameBudget,
+                scaledFrames ? scaleTotal / scaledFrames : 1.0,
+                scaledFrames ? scaleMin : 1.0f);
+        const MemoryUse m = memoryUse();
+        fprintf(f, "  \"memory_kb\": { \"vertex_arrays\": %.1f, "
+                   "\"shadow_map\": %.1f, \"framebuffers\": %.1f, "
+                   "\"solver_tables\": %.1f },\n",
+                m.vertexArrays / 1024.0, m.shadowMap / 1024.0,
+                m.framebuffers / 1024.0, m.solverTables / 1024.0);
+        fprintf(f, "  \"allocations\": {");
+        for (int phase = 0; phase < MyAllocStats::NUM_PHASES; ++phase) {
+            const MyAllocStats::Totals& t = allocStats.totals(phase);
+            fprintf(f, "%s\n    \"%s\": { \"events\": %llu, "
+                       "\"count\": %llu, \"kb\": %.1f, \"max\": %llu, "
+                       "\"events_allocating\": %llu }",
+                    phase ? "," : "", MyAllocStats::phaseName(phase),
+                    t.events, t.counts.allocations, t.counts.bytes / 1024.0,
+                    t.maxAllocations, t.eventsAllocating);
+        }
+        fprintf(f, "\n  },\n  \"peak_rss_kb\": %ld\n}\n", peakRssKb());
+        if (f != stdout) {
+            fclose(f);
+        }
+    }
+
+    // What startup() sets up for the scene, without GL
+    MySoftRenderer softRenderer;
+    void startupSoftware()
+    {
+        initSimulation();
+        initGround();
+        const float aspect = (float) windowWidth / (float)windowHeight;
+        projMatrix = perspective(50.0f, aspect, 0.1f, 1000.0f);
+        softRenderer.initialize(windowWidth, windowHeight, options.samples,
+                                max(1, int(thread::hardware_concurrency())),
+                                SHADOWMAP_SIZE / 2);
+        pixels.resize(size_t(windowWidth) * windowHeight * 3);
+    }
+
+    void renderSoftware(double currentTime)
+    {
+        TRACE_SCOPE("renderSoftware");
+        countStartupAllocations();
+        MyAllocScope allocScope(allocStats, MyAllocStats::FRAME);
+        showSimulation(currentTime);
+
+        MySoftScene scene;
+        scene.rubik = &sim.rubik;
+        scene.transforms = cubieTransforms;
+        scene.groundVertices = groundVec;
+        scene.groundColors = groundColor;
+        scene.projMatrix = projMatrix;
+        scene.cameraTransform = cameraTransform;
+        scene.cubeRot = shown.cubeRot.toMatrix();
+        lightSetup(scene.lightPos, scene.lightView, scene.lightProj);
+        softRenderer.render(scene);
+    }
+
+    // Thumbnails for a stream of cube states: every state is an instance
+    // of the cube drawn into its own tile of a large multisampled atlas,
+    // with the cubie transforms in a buffer texture. Each atlas is read
+    // back once and sliced into one PNG per state on worker threads while
+    // the next one renders.
+    GLuint batchProgram = 0;
+    GLuint batchProjLoc;
+    GLuint batchMvLoc;
+    GLuint batchShadowMvpLoc;
+    GLuint batchPassThroughLoc;
+    GLuint batchShadowMapLoc;
+    GLuint batchTransformsLoc;
+    GLuint batchTilesPerRowLoc;
+    GLuint batchTileSizeLoc;
+    GLuint batchLightPosLoc;
+    GLuint batchTransformBuffer = 0;
+    GLuint batchTransformTexture = 0;
+    vector<MyMatrix> batchTransforms;
+    vector<unsigned char> batchPixels[2];
+    vector<int> batchStates[2];
+    vector<MyPngWriter> batchWriters;
+
+    bool compileBatchShaders()
+    {
+        GLuint vertexShader = compileShader("vertex_batch.glsl",
+                                            GL_VERTEX_SHADER);
+        GLuint fragmentShader = compileShader("fragment.glsl",
+                                              GL_FRAGMENT_SHADER);
+
+        if (!vertexShader || !fragmentShader) {
+            return false;
+        }
+
+        batchProgram = glCreateProgram();
+        glAttachShader(batchProgram, vertexShader);
+        glAttachShader(batchProgram, fragmentShader);
+        glLinkProgram(batchProgram);
+
+        GLint status;
+        glGetProgramiv(batchProgram, GL_LINK_STATUS, &status);
+        if (status != GL_TRUE) {
+            printf("link program failed: %s\n",
+                   getProgramLog(batchProgram).c_str());
+            return false;
+        }
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+
+        batchProjLoc = getUniform(batchProgram, "projMatrix");
+        batchMvLoc = getUniform(batchProgram, "mvMatrix");
+        batchShadowMvpLoc = getUniform(batchProgram, "shadowMvp");
+        batchPassThroughLoc = getUniform(batchProgram, "passThroughShader");
+        batchShadowMapLoc = getUniform(batchProgram, "shadowMap");
+        batchTransformsLoc = getUniform(batchProgram, "transforms");
+        batchTilesPerRowLoc = getUniform(batchProgram, "tilesPerRow");
+        batchTileSizeLoc = getUniform(batchProgram, "tileSize");
+        batchLightPosLoc = getUniform(batchProgram, "lightPos");
+        return true;
+    }
+
+    // Reads up to maxStates states, one line of moves each ('#' starts a
+    // comment line, an empty line is the solved cube), into
+    // batchTransforms. Returns how many were read; states is filled with
+    // their numbers in the input, which invalid lines still use up.
+    int readBatchStates(FILE *in, int maxStates, vector<int>& states,
+                        int& nextState, int& lineNo)
+    {
+        char line[4096];
+        int n = 0;
+        while (n < maxStates && fgets(line, sizeof(line), in)) {
+            ++lineNo;
+            if (line[0] == '#') {
+                continue;
+            }
+            const int state = nextState++;
+            sim.rubik.resetTransforms();
+            if (sim.rubik.applyMoves(line) < 0) {
+                printf("%s:%d: invalid moves, state %d skipped\n",
+                       options.batch, lineNo, state);
+                continue;
+            }
+            memcpy(&batchTransforms[size_t(n) * 27], sim.rubik.mTransforms,
+                   sizeof(sim.rubik.mTransforms));
+            states[n++] = state;
+        }
+        return n;
+    }
+
+    // Draws numStates instances into the atlas and reads it back
+    void renderBatchAtlas(int numStates, vector<unsigned char>& rgba,
+                          const MyMatrix& groundMv,
+                          const MyMatrix& groundShadowMvp,
+                          const MyMatrix& cubeMv,
+                          const MyMatrix& cubeShadowMvp)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, batchTransformBuffer);
+        // Orphan the storage rather than wait for the previous draw
+        glBufferData(GL_TEXTURE_BUFFER,
+                     batchTransforms.size() * sizeof(MyMatrix), NULL,
+                     GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0,
+                        size_t(numStates) * 27 * sizeof(MyMatrix),
+                        batchTransforms.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFrameBuf);
+        glViewport(0, 0, windowWidth, windowHeight);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        constexpr GLfloat background[] = { 210.0f/255.0f, 230.0f/255.0f,
+                                           255.0f/255.0f, 1.0f };
+        glClearBufferfv(GL_COLOR, 0, background);
+
+        // The ground is instanced too, so that every tile gets one
+        glUniform1i(batchPassThroughLoc, 1);
+        glUniformMatrix4fv(batchMvLoc, 1, GL_FALSE, groundMv.buf);
+        glUniformMatrix4fv(batchShadowMvpLoc, 1, GL_FALSE,
+                           groundShadowMvp.buf);
+        glDrawArraysInstanced(GL_TRIANGLES, 36*27, 6, numStates);
+        glUniform1i(batchPassThroughLoc, 0);
+        glUniformMatrix4fv(batchMvLoc, 1, GL_FALSE, cubeMv.buf);
+        glUniformMatrix4fv(batchShadowMvpLoc, 1, GL_FALSE,
+                           cubeShadowMvp.buf);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 36*27, numStates);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFrameBuf);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFrameBuf);
+        glBlitFramebuffer(0, 0, windowWidth, windowHeight,
+                          0, 0, windowWidth, windowHeight,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, resolveFrameBuf);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glCall(glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA,
+                            GL_UNSIGNED_BYTE, rgba.data()));
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void runBatch()
+    {
+        if (!options.output || !isNumberedPattern(options.output)) {
+            puts("batch: --output needs a %d for the state number");
+            return;
+        }
+        FILE *in = strcmp(options.batch, "-") ? fopen(options.batch, "r")
+                                              : stdin;
+        if (!in) {
+            printf("Could not open %s\n", options.batch);
+            return;
+        }
+        MyHeadlessContext context;
+        if (!context.create(4, 1)) {
+            puts("headless context creation failed");
+            return;
+        }
+
+        const int tile = options.tileSize;
+        const int tilesPerRow = max(1, options.atlasSize / tile);
+        const int tilesPerAtlas = tilesPerRow * tilesPerRow;
+        int threads = options.captureThreads;
+        if (threads <= 0) {
+            threads = max(1, int(thread::hardware_concurrency()) - 1);
+        }
+        printf("batch rendering %dx%d thumbnails, %d per atlas, %d encoder "
+               "threads on %s\n", tile, tile, tilesPerAtlas, threads,
+               context.renderer());
+
+        // A square window the size of the atlas, so startup() sets up a
+        // square projection and initOffscreenTarget() the atlas target
+        windowWidth = tilesPerRow * tile;
+        windowHeight = windowWidth;
+        simulatedClock = true;
+        initSimulation();
+        startup();
+        initOffscreenTarget();
+        if (!compileBatchShaders()) {
+            exit(1);
+        }
+
+        // Closer than the interactive view and tilted so that the top,
+        // front and right faces all show
+        MyQuaternion tilt;
+        tilt.rotateX(M_PI / 6.0f);
+        sim.snapshot(shown);
+        shown.cubeRot = tilt * shown.cubeRot;
+        shown.cubeRot.normalize();
+        shown.eye.z = 3.0f;
+        updateCamera();
+
+        // Every state casts the same shadow, render it once
+        MyPoint lightPos;
+        MyMatrix l;
+        MyMatrix p;
+        lightSetup(lightPos, l, p);
+        const MyMatrix mCubeRot = shown.cubeRot.toMatrix();
+        MyMatrix tmp = l * mCubeRot;
+        renderShadowMap(tmp, p, l);
+
+        glUseProgram(batchProgram);
+        glUniformMatrix4fv(batchProjLoc, 1, GL_FALSE, projMatrix.buf);
+        glUniform1i(batchShadowMapLoc, 0);
+        glUniform1i(batchTransformsLoc, 1);
+        glUniform1i(batchTilesPerRowLoc, tilesPerRow);
+        glUniform2f(batchTileSizeLoc, 2.0f / tilesPerRow, 2.0f / tilesPerRow);
+        lightPos = lightPos.transform(cameraTransform);
+        glUniform3f(batchLightPosLoc, lightPos.x, lightPos.y, lightPos.z);
+        for (int i = 0; i < 4; ++i) {
+            glEnable(GL_CLIP_DISTANCE0 + i);
+        }
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glGenBuffers(1, &batchTransformBuffer);
+        glGenTextures(1, &batchTransformTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, batchTransformTexture);
+        batchTransforms.resize(size_t(tilesPerAtlas) * 27);
+        glBindBuffer(GL_TEXTURE_BUFFER, batchTransformBuffer);
+        glBufferData(GL_TEXTURE_BUFFER,
+                     batchTransforms.size() * sizeof(MyMatrix), NULL,
+                     GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glCall(glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F,
+                           batchTransformBuffer));
+        glActiveTexture(GL_TEXTURE0);
+
+        const MyMatrix groundMv = cameraTransform;
+        const MyMatrix groundShadowMvp = p * l;
+        const MyMatrix cubeMv = cameraTransform * mCubeRot;
+        const MyMatrix cubeShadowMvp = p * tmp;
+        for (int i = 0; i < 2; ++i) {
+            batchPixels[i].resize(size_t(windowWidth) * windowHeight * 4);
+            batchStates[i].resize(tilesPerAtlas);
+        }
+        batchWriters.resize(threads);
+        for (MyPngWriter& w : batchWriters) {
+            w.reserve(tile, tile);
+        }
+        vector<int> failures(threads);
+
+        vector<thread> writers;
+        auto joinWriters = [&] {
+            for (thread& t : writers) {
+                t.join();
+            }
+            writers.clear();
+        };
+
+        const double startTime = wallTime();
+        double renderTime = 0.0;
+        int nextState = 0;
+        int lineNo = 0;
+        int rendered = 0;
+        int atlases = 0;
+        for (int cur = 0;; cur ^= 1) {
+            const int n = readBatchStates(in, tilesPerAtlas, batchStates[cur],
+                                          nextState, lineNo);
+            if (n == 0) {
+                break;
+            }
+            const double renderStart = wallTime();
+            renderBatchAtlas(n, batchPixels[cur], groundMv, groundShadowMvp,
+                             cubeMv, cubeShadowMvp);
+            renderTime += wallTime() - renderStart;
+
+            // The previous atlas' writers were encoding while this one
+            // rendered; its buffers get reused next
+            joinWriters();
+            for (int t = 0; t < threads; ++t) {
+                writers.emplace_back([&, t, n, cur] {
+                    const size_t stride = size_t(windowWidth) * 4;
+                    for (int i = t; i < n; i += threads) {
+                        char filename[1024];
+                        const unsigned char *src = batchPixels[cur].data()
+                            + size_t(i / tilesPerRow) * tile * stride
+                            + size_t(i % tilesPerRow) * tile * 4;
+                        if (!numberedName(filename, sizeof(filename),
+                                          options.output,
+                                          batchStates[cur][i])
+                         || !batchWriters[t].write(filename, src, tile, tile,
+                                                   stride, true)) {
+                            ++failures[t];
+                        }
+                    }
+                });
+            }
+            rendered += n;
+            ++atlases;
+        }
+        joinWriters();
+        const double elapsed = wallTime() - startTime;
+        if (in != stdin) {
+            fclose(in);
+        }
+
+        int failed = 0;
+        for (int f : failures) {
+            failed += f;
+        }
+        printf("batch: %d states in %d atlases, %.2fs (%.0f states/s), "
+               "render+readback %.2fs (%.0f states/s), %d write failures\n",
+               rendered, atlases, elapsed,
+               elapsed > 0.0 ? rendered / elapsed : 0.0, renderTime,
+               renderTime > 0.0 ? rendered / renderTime : 0.0, failed);
+
+        glDeleteTextures(1, &batchTransformTexture);
+        glDeleteBuffers(1, &batchTransformBuffer);
+        glDeleteProgram(batchProgram);
+        shutdown();
+    }
+
+    MyFrameCapture capture;
+    void startCapture()
+    {
+        if (!options.capture) {
+            return;
+        }
+        int threads = options.captureThreads;
+        if (threads <= 0) {
+            threads = max(1, int(thread::hardware_concurrency()) - 1);
+        }
+        if (!capture.initialize(options.capture, windowWidth, windowHeight,
+                                options.captureBuffers, threads)) {
+            exit(1);
+        }
+    }
+
+    bool simulatedClock = false;
+    double simTime = 0.0;
+
+    // Nothing left to animate, and the last frame showed it
+    bool isIdle() const
+    {
+        return sim.isIdle() && !simFrame.moving;
+    }
+
+    // Multisampled scene target and its single sampled resolve for readback
+    GLuint offscreenFrameBuf = 0;
+    GLuint offscreenColor = 0;
+    GLuint offscreenDepth = 0;
+    GLuint resolveFrameBuf = 0;
+    GLuint resolveColor = 0;
+    vector<unsigned char> pixels;
+
+    void initOffscreenTarget()
+    {
+        glCall(glGenRenderbuffers(1, &offscreenColor));
+        glCall(glBindRenderbuffer(GL_RENDERBUFFER, offscreenColor));
+        glCall(glRenderbufferStorageMultisample(GL_RENDERBUFFER,
+                                                windowSamples(), GL_RGBA8,
+                                                windowWidth, windowHeight));
+        glCall(glGenRenderbuffers(1, &offscreenDepth));
+        glCall(glBindRenderbuffer(GL_RENDERBUFFER, offscreenDepth));
+        glCall(glRenderbufferStorageMultisample(GL_RENDERBUFFER,
+                                                windowSamples(),
+                                                GL_DEPTH_COMPONENT24,
+                                                windowWidth, windowHeight));
+
+        glCall(glGenFramebuffers(1, &offscreenFrameBuf));
+        glCall(glBindFramebuffer(GL_FRAMEBUFFER, offscreenFrameBuf));
+        glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                         GL_RENDERBUFFER, offscreenColor));
+        glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                         GL_RENDERBUFFER, offscreenDepth));
+        checkFrameBuf();
+
+        glCall(glGenRenderbuffers(1, &resolveColor));
+        glCall(glBindRenderbuffer(GL_RENDERBUFFER, resolveColor));
+        glCall(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8,
+                                     windowWidth, windowHeight));
+        glCall(glGenFramebuffers(1, &resolveFrameBuf));
+        glCall(glBindFramebuffer(GL_FRAMEBUFFER, resolveFrameBuf));
+        glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                         GL_RENDERBUFFER, resolveColor));
+        checkFrameBuf();
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        sceneFrameBuf = offscreenFrameBuf;
+        pixels.resize(size_t(windowWidth) * windowHeight * 3);
+    }
+
+    // Resolves the scene (or takes the software renderer's) and writes it
+    // as a binary PPM
+    bool writeFrame(const char *filename)
+    {
+        if (options.software) {
+            memcpy(pixels.data(), softRenderer.pixels(), pixels.size());
+        }
+        else {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFrameBuf);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFrameBuf);
+            glBlitFramebuffer(0, 0, windowWidth, windowHeight,
+                              0, 0, windowWidth, windowHeight,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, resolveFrameBuf);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glCall(glReadPixels(0, 0, windowWidth, windowHeight, GL_RGB,
+                                GL_UNSIGNED_BYTE, pixels.data()));
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        FILE *f = fopen(filename, "wb");
+        if (!f) {
+            printf("Could not open %s\n", filename);
+            return false;
+        }
+        fprintf(f, "P6\n%d %d\n255\n", windowWidth, windowHeight);
+        // GL rows go bottom up
+        const size_t stride = size_t(windowWidth) * 3;
+        for (int y = windowHeight - 1; y >= 0; --y) {
+            fwrite(pixels.data() + y * stride, 1, stride, f);
+        }
+        fclose(f);
+        return true;
+    }
     static void glfw_onResize(GLFWwindow *window, int w, int h)
     {
         MyApp *app = (MyApp *) glfwGetWindowUserPointer(window);
@@ -169,7 +1123,9 @@ struct MyApp
         return str;
     }
 
-    GLuint compileShader(const char *filename, GLenum shaderType)
+    // defines, e.g. "#define X\n", go right after the #version line
+    GLuint compileShader(const char *filename, GLenum shaderType,
+                         const char *defines = "")
     {
         GLuint shader = glCreateShader(shaderType);
         if (shader == 0) {
@@ -181,6 +1137,7 @@ struct MyApp
             printf("Could not read %s\n", filename);
             return 0;
         }
+        src.insert(src.find('\n') + 1, defines);
         GLchar *srcPtr = (GLchar *) src.c_str();
         glShaderSource(shader, 1, &srcPtr, 0);
         glCompileShader(shader);
@@ -197,6 +1154,10 @@ struct MyApp
     GLuint program;
     GLuint shadowProgram;
     GLuint debugProgram;
+    GLuint overlayProgram;
+    // Indexed by whether it does FXAA
+    GLuint postProgram[2];
+    GLuint blurProgram;
     GLuint projMatrixLocation = -1;
     GLuint mvMatrixLocation;
     GLuint vertexTransformLocation;
@@ -222,11 +1183,17 @@ struct MyApp
     }
 
     GLuint debugTexIDLoc;
+    GLuint blurTexIDLoc;
+    GLuint blurDirectionLoc;
+    GLuint postUvScaleLoc[2];
+    GLuint postUvMaxLoc[2];
     bool compileShaders()
     {
+        const char *shadowDefines = vsm() ? "#define SHADOW_VSM\n" : "";
         GLuint vertexShader = compileShader("vertex.glsl", GL_VERTEX_SHADER);
         GLuint fragmentShader = compileShader("fragment.glsl",
-                                              GL_FRAGMENT_SHADER);
+                                              GL_FRAGMENT_SHADER,
+                                              shadowDefines);
 
         if (!vertexShader || !fragmentShader) {
             return false;
@@ -258,7 +1225,7 @@ struct MyApp
 
         vertexShader = compileShader("vertex_shadowmap.glsl", GL_VERTEX_SHADER);
         fragmentShader = compileShader("fragment_shadowmap.glsl",
-                                       GL_FRAGMENT_SHADER);
+                                       GL_FRAGMENT_SHADER, shadowDefines);
 
         if (!vertexShader || !fragmentShader) {
             return false;
@@ -304,27 +1271,128 @@ struct MyApp
         }
         debugTexIDLoc = getUniform(debugProgram, "text");
 
-        glUseProgram(program);
+        vertexShader = compileShader("vertex_overlay.glsl", GL_VERTEX_SHADER);
+        fragmentShader = compileShader("fragment_overlay.glsl",
+                                       GL_FRAGMENT_SHADER);
 
-        return true;
-    }
+        if (!vertexShader || !fragmentShader) {
+            return false;
+        }
 
-    GLuint vao;
-    GLuint buffer;
+        overlayProgram = glCreateProgram();
+
+        glAttachShader(overlayProgram, vertexShader);
+        glAttachShader(overlayProgram, fragmentShader);
+        glLinkProgram(overlayProgram);
+
+        glGetProgramiv(overlayProgram, GL_LINK_STATUS, &status);
+        if (status != GL_TRUE) {
+            printf("link program failed: %s\n",
+                   getProgramLog(overlayProgram).c_str());
+            return false;
+        }
+
+        // Both stretch the scene over the window, one with FXAA
+        const char *postShaders[2] = { "fragment_upscale.glsl",
+                                       "fragment_fxaa.glsl" };
+        for (int i = 0; i < 2; ++i) {
+            vertexShader = compileShader("vertex_passthrough.glsl",
+                                         GL_VERTEX_SHADER);
+            fragmentShader = compileShader(postShaders[i],
+                                           GL_FRAGMENT_SHADER);
+
+            if (!vertexShader || !fragmentShader) {
+                return false;
+            }
+
+            postProgram[i] = glCreateProgram();
+
+            glAttachShader(postProgram[i], vertexShader);
+            glAttachShader(postProgram[i], fragmentShader);
+            glLinkProgram(postProgram[i]);
+
+            glGetProgramiv(postProgram[i], GL_LINK_STATUS, &status);
+            if (status != GL_TRUE) {
+                printf("link program failed: %s\n",
+                       getProgramLog(postProgram[i]).c_str());
+                return false;
+            }
+            postUvScaleLoc[i] = getUniform(postProgram[i], "uvScale");
+            postUvMaxLoc[i] = getUniform(postProgram[i], "uvMax");
+            // The shadow map keeps unit 0
+            glUseProgram(postProgram[i]);
+            glUniform1i(getUniform(postProgram[i], "scene"), 1);
+        }
+
+        vertexShader = compileShader("vertex_passthrough.glsl",
+                                     GL_VERTEX_SHADER);
+        fragmentShader = compileShader("fragment_blur.glsl",
+                                       GL_FRAGMENT_SHADER);
+
+        if (!vertexShader || !fragmentShader) {
+            return false;
+        }
+
+        blurProgram = glCreateProgram();
+
+        glAttachShader(blurProgram, vertexShader);
+        glAttachShader(blurProgram, fragmentShader);
+        glLinkProgram(blurProgram);
+
+        glGetProgramiv(blurProgram, GL_LINK_STATUS, &status);
+        if (status != GL_TRUE) {
+            printf("link program failed: %s\n",
+                   getProgramLog(blurProgram).c_str());
+            return false;
+        }
+        blurTexIDLoc = getUniform(blurProgram, "moments");
+        blurDirectionLoc = getUniform(blurProgram, "direction");
+
+        glUseProgram(program);
+
+        return true;
+    }
+
+    GLuint vao;
+    GLuint buffer;
     GLuint bufferColor;
     GLuint normals;
 
-    MyRubik rubik;
-
     MyPoint groundVec[6];
     MyPoint groundColor[6];
     MyPoint groundNormal[6];
 
     GLuint frameBuf;
-    GLuint depthTexture;
+    GLuint depthTexture = 0;
+    // With VSM, frameBuf draws into momentsTexture instead, with
+    // momentsDepth for the depth test; blurFrameBuf holds the first of
+    // the two blur passes
+    GLuint momentsTexture = 0;
+    GLuint momentsDepth = 0;
+    GLuint blurFrameBuf = 0;
+    GLuint blurTexture = 0;
+    // What the scene's shadowMap samples, one of the above
+    GLuint shadowTexture = 0;
+    // Where the scene goes, the default framebuffer unless headless
+    GLuint sceneFrameBuf = 0;
+
+    // Not for the batch thumbnails, which always use PCF
+    bool vsm() const
+    {
+        return options.shadows == MyOptions::VSM && !options.batch
+            && !options.software;
+    }
+    int shadowMapSize() const
+    {
+        return vsm() ? VSM_SIZE : SHADOWMAP_SIZE;
+    }
 
     void initFrameBuf()
     {
+        if (vsm()) {
+            initMomentsMap();
+            return;
+        }
 
         glCall(glGenFramebuffers(1, &frameBuf));
         glCall(glBindFramebuffer(GL_FRAMEBUFFER, frameBuf));
@@ -353,6 +1421,90 @@ struct MyApp
         glDrawBuffer(GL_NONE);
         glReadBuffer(GL_NONE);
 
+        checkFrameBuf();
+        shadowTexture = depthTexture;
+    }
+
+    static GLuint momentsTarget(bool mipmaps)
+    {
+        GLuint texture;
+        glCall(glGenTextures(1, &texture));
+        glCall(glBindTexture(GL_TEXTURE_2D, texture));
+        glCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, VSM_SIZE, VSM_SIZE,
+                            0, GL_RG, GL_FLOAT, 0));
+        glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                               GL_LINEAR));
+        glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                               mipmaps ? GL_LINEAR_MIPMAP_LINEAR
+                                       : GL_LINEAR));
+        // Beyond the light's frustum lies the far plane: all lit
+        constexpr GLfloat far[] = { 1.0f, 1.0f, 0.0f, 0.0f };
+        glCall(glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, far));
+        glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                               GL_CLAMP_TO_BORDER));
+        glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                               GL_CLAMP_TO_BORDER));
+        if (mipmaps) {
+            glCall(glGenerateMipmap(GL_TEXTURE_2D));
+        }
+        return texture;
+    }
+
+    void initMomentsMap()
+    {
+        momentsTexture = momentsTarget(true);
+        glCall(glGenRenderbuffers(1, &momentsDepth));
+        glCall(glBindRenderbuffer(GL_RENDERBUFFER, momentsDepth));
+        glCall(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+                                     VSM_SIZE, VSM_SIZE));
+        glCall(glGenFramebuffers(1, &frameBuf));
+        glCall(glBindFramebuffer(GL_FRAMEBUFFER, frameBuf));
+        glCall(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                    momentsTexture, 0));
+        glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                         GL_RENDERBUFFER, momentsDepth));
+        checkFrameBuf();
+
+        blurTexture = momentsTarget(false);
+        glCall(glGenFramebuffers(1, &blurFrameBuf));
+        glCall(glBindFramebuffer(GL_FRAMEBUFFER, blurFrameBuf));
+        glCall(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                    blurTexture, 0));
+        checkFrameBuf();
+        shadowTexture = momentsTexture;
+    }
+
+    // Blurs the moments across into blurTexture, then down back into
+    // momentsTexture, and builds its mipmaps
+    void blurMoments()
+    {
+        glUseProgram(blurProgram);
+        glDisable(GL_DEPTH_TEST);
+        glDisableVertexAttribArray(1);
+        glDisableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVertexBuffer);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(blurTexIDLoc, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, blurFrameBuf);
+        glBindTexture(GL_TEXTURE_2D, momentsTexture);
+        glUniform2i(blurDirectionLoc, 1, 0);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, frameBuf);
+        glBindTexture(GL_TEXTURE_2D, blurTexture);
+        glUniform2i(blurDirectionLoc, 0, 1);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+
+        glBindTexture(GL_TEXTURE_2D, momentsTexture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        bindSceneAttribs();
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    static void checkFrameBuf()
+    {
         GLenum ret = glCheckFramebufferStatus(GL_FRAMEBUFFER);
         if (ret != GL_FRAMEBUFFER_COMPLETE) {
             printf("glCheckFramebufferStatus returned %d\n", int(ret));
@@ -362,48 +1514,203 @@ struct MyApp
         }
     }
 
-    GLuint quadVertexBuffer;
-    void startup()
+    // With a frame budget or FXAA the scene is drawn into the bottom left
+    // of postFrameBuf, which has the window's size so that changing the
+    // scale never reallocates. It is resolved into postTexture, or drawn
+    // there directly without samples, and stretched over sceneFrameBuf.
+    // The window needs no samples of its own then. Not for the batch
+    // thumbnails, which don't go through render().
+    bool dynamicResolution() const
     {
-        if (!compileShaders())
-            exit(1);
+        return options.frameBudget > 0.0f && !options.batch
+            && !options.software;
+    }
+    bool fxaa() const
+    {
+        return options.antialiasing == MyOptions::FXAA && !options.batch
+            && !options.software;
+    }
+    bool postProcessing() const
+    {
+        return dynamicResolution() || fxaa();
+    }
+    int windowSamples() const
+    {
+        return postProcessing() ? 0 : options.samples;
+    }
+    int postSamples() const
+    {
+        return fxaa() ? 0 : options.samples;
+    }
 
-        glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
+    MyResolutionScaler resolution;
+    GLuint postFrameBuf = 0;
+    GLuint postColor = 0;
+    GLuint postDepth = 0;
+    GLuint postResolveFrameBuf = 0;
+    GLuint postTexture = 0;
+    // The scale of the last frame and when it was at this point, negative
+    // when there is no last frame to time
+    float lastScale = 1.0f;
+    double lastScaleTime = -1.0;
+    // Over all frames, for the report
+    double scaleTotal = 0.0;
+    float scaleMin = 1.0f;
+    unsigned long long scaledFrames = 0;
+
+    void initPostTarget()
+    {
+        glCall(glGenTextures(1, &postTexture));
+        glCall(glBindTexture(GL_TEXTURE_2D, postTexture));
+        glCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, windowWidth,
+                            windowHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0));
+        glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                               GL_LINEAR));
+        glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                               GL_LINEAR));
+        glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                               GL_CLAMP_TO_EDGE));
+        glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                               GL_CLAMP_TO_EDGE));
 
-        rubik.initialize();
+        const int samples = postSamples();
+        glCall(glGenRenderbuffers(1, &postDepth));
+        glCall(glBindRenderbuffer(GL_RENDERBUFFER, postDepth));
+        glCall(glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples,
+                                                GL_DEPTH_COMPONENT24,
+                                                windowWidth, windowHeight));
+        glCall(glGenFramebuffers(1, &postFrameBuf));
+        glCall(glBindFramebuffer(GL_FRAMEBUFFER, postFrameBuf));
+        glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                         GL_RENDERBUFFER, postDepth));
+        if (samples == 0) {
+            glCall(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                        postTexture, 0));
+            checkFrameBuf();
+        }
+        else {
+            glCall(glGenRenderbuffers(1, &postColor));
+            glCall(glBindRenderbuffer(GL_RENDERBUFFER, postColor));
+            glCall(glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples,
+                                                    GL_RGBA8, windowWidth,
+                                                    windowHeight));
+            glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                                             GL_COLOR_ATTACHMENT0,
+                                             GL_RENDERBUFFER, postColor));
+            checkFrameBuf();
+
+            glCall(glGenFramebuffers(1, &postResolveFrameBuf));
+            glCall(glBindFramebuffer(GL_FRAMEBUFFER, postResolveFrameBuf));
+            glCall(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                        postTexture, 0));
+            checkFrameBuf();
+        }
 
-        glGenBuffers(1, &buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(rubik.cubes) + sizeof(groundVec),
-                     NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(rubik.cubes), rubik.cubes);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        lastScaleTime = -1.0;
+    }
+
+    void deletePostTarget()
+    {
+        glDeleteFramebuffers(1, &postResolveFrameBuf);
+        glDeleteTextures(1, &postTexture);
+        glDeleteFramebuffers(1, &postFrameBuf);
+        glDeleteRenderbuffers(1, &postDepth);
+        glDeleteRenderbuffers(1, &postColor);
+        postFrameBuf = 0;
+        postResolveFrameBuf = 0;
+        postColor = 0;
+    }
+
+    // The scale of this frame, from the time the last one took, measured
+    // from here to here so that it holds the GPU work, swap and all. The
+    // GPU sections don't do: llvmpipe, for one, runs draws at the next
+    // flush, in whichever section that falls. Full resolution while
+    // nothing moves.
+    float updateResolution()
+    {
+        const double now = wallTime();
+        if (!frameMailbox.front().moving) {
+            resolution.reset();
+        }
+        else if (lastScaleTime >= 0.0) {
+            resolution.update(float((now - lastScaleTime) * 1000.0),
+                              lastScale);
+        }
+        const float scale = resolution.scale();
+        lastScale = scale;
+        lastScaleTime = now;
+        scaleTotal += scale;
+        scaleMin = min(scaleMin, scale);
+        ++scaledFrames;
+        return scale;
+    }
+
+    // Resolves the w x h corner the scene was drawn into if it has
+    // samples, and stretches it over sceneFrameBuf, with FXAA or without
+    void postProcess(int w, int h)
+    {
+        MyGpuSection section(profiler, MyProfiler::POST_PROCESS);
+        TRACE_SCOPE("postProcess");
+        GLuint resolved = postFrameBuf;
+        if (postResolveFrameBuf) {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, postFrameBuf);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, postResolveFrameBuf);
+            glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT,
+                              GL_NEAREST);
+            resolved = postResolveFrameBuf;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFrameBuf);
+        glViewport(0, 0, windowWidth, windowHeight);
+        // For the debug quad, which is depth tested
+        glClear(GL_DEPTH_BUFFER_BIT);
+        const bool antialias = fxaa();
+        if (!antialias && w == windowWidth && h == windowHeight) {
+            // Nothing to do but copy, cheaper than the quad
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, resolved);
+            glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT,
+                              GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFrameBuf);
+            return;
+        }
+
+        glUseProgram(postProgram[antialias]);
+        glDisable(GL_DEPTH_TEST);
+        glDisableVertexAttribArray(1);
+        glDisableVertexAttribArray(2);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, postTexture);
+        glUniform2f(postUvScaleLoc[antialias], float(w) / windowWidth,
+                    float(h) / windowHeight);
+        glUniform2f(postUvMaxLoc[antialias], (w - 0.5f) / windowWidth,
+                    (h - 0.5f) / windowHeight);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVertexBuffer);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-        glEnableVertexAttribArray(0);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
 
-        glGenBuffers(1, &bufferColor);
-        glBindBuffer(GL_ARRAY_BUFFER, bufferColor);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(rubik.colors) + sizeof(groundColor)
-                     , NULL,
-                     GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(rubik.colors), rubik.colors);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-        glEnableVertexAttribArray(1);
+        glActiveTexture(GL_TEXTURE0);
+        bindSceneAttribs();
+        glEnable(GL_DEPTH_TEST);
+        glUseProgram(program);
+    }
 
-        glGenBuffers(1, &normals);
-        glBindBuffer(GL_ARRAY_BUFFER, normals);
-        glBufferData(GL_ARRAY_BUFFER,
-                     sizeof(rubik.normals)+sizeof(groundNormal),
-                     NULL,
-                     GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(rubik.normals),
-                        rubik.normals);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-        glEnableVertexAttribArray(2);
+    GLuint quadVertexBuffer;
 
+    MyProfiler profiler;
+    // Toggled from the input thread
+    atomic<bool> showOverlay{false};
+    atomic<bool> profileDumpRequested{false};
+    GLuint overlayVertexBuffer;
+    GLuint overlayColorBuffer;
+    MyPoint overlayVertices[OVERLAY_MAX_VERTICES];
+    MyPoint overlayColors[OVERLAY_MAX_VERTICES];
+
+    // Ground quad under the cube, in world space
+    void initGround()
+    {
         constexpr float groundBase = 50.f;
         // -(Half of the rubik cube diagonal plus some)
-        const float groundYBase = -sqrtf(3.0f)*1.5f*rubik.radius()-0.2f;
+        const float groundYBase = -sqrtf(3.0f)*1.5f*sim.rubik.radius()-0.2f;
         constexpr float groundYDisp = 0.0f;
 
         groundVec[0].x = -groundBase;
@@ -440,6 +1747,47 @@ struct MyApp
             groundNormal[i].y = 1.0f;
             groundNormal[i].z = 0.0f;
         }
+    }
+
+    void startup()
+    {
+        if (!compileShaders())
+            exit(1);
+
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+
+        const MyRubik& rubik = sim.rubik;
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(rubik.cubes) + sizeof(groundVec),
+                     NULL, GL_STATIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(rubik.cubes), rubik.cubes);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+        glEnableVertexAttribArray(0);
+
+        glGenBuffers(1, &bufferColor);
+        glBindBuffer(GL_ARRAY_BUFFER, bufferColor);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(rubik.colors) + sizeof(groundColor)
+                     , NULL,
+                     GL_STATIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(rubik.colors), rubik.colors);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+        glEnableVertexAttribArray(1);
+
+        glGenBuffers(1, &normals);
+        glBindBuffer(GL_ARRAY_BUFFER, normals);
+        glBufferData(GL_ARRAY_BUFFER,
+                     sizeof(rubik.normals)+sizeof(groundNormal),
+                     NULL,
+                     GL_STATIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(rubik.normals),
+                        rubik.normals);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+        glEnableVertexAttribArray(2);
+
+        initGround();
 
         glBindBuffer(GL_ARRAY_BUFFER, buffer);
         glBufferSubData(GL_ARRAY_BUFFER, sizeof(rubik.cubes),
@@ -467,11 +1815,11 @@ struct MyApp
         glUniformMatrix4fv(projMatrixLocation, 1, GL_FALSE,
                            projMatrix.buf);
         glUniformMatrix4fv(vertexTransformLocation, 28, GL_FALSE,
-                           (const GLfloat *) rubik.mTransforms);
+                           (const GLfloat *) cubieTransforms);
 
         glUseProgram(shadowProgram);
         glUniformMatrix4fv(shadowVertexTransformLoc, 28, GL_FALSE,
-                           (const GLfloat *) rubik.mTransforms);
+                           (const GLfloat *) cubieTransforms);
         glUseProgram(program);
 
         // The quad's FBO. Used only for visualizing the shadowmap.
@@ -490,13 +1838,27 @@ struct MyApp
                      quadVertexBufferData, GL_STATIC_DRAW);
 
         initFrameBuf();
+        resolution.budgetMs = options.frameBudget;
+        if (postProcessing()) {
+            initPostTarget();
+        }
 
-        resetState();
-        glfwGetCursorPos(window, &curX, &curY);
+        glGenBuffers(1, &overlayVertexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, overlayVertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(overlayVertices), NULL,
+                     GL_STREAM_DRAW);
+        glGenBuffers(1, &overlayColorBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, overlayColorBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(overlayColors), NULL,
+                     GL_STREAM_DRAW);
+
+        profiler.initialize();
     }
 
     void shutdown()
     {
+        capture.finish();
+        profiler.shutdown();
         glDeleteVertexArrays(1, &vao);
         glDeleteProgram(program);
     }
@@ -533,97 +1895,42 @@ struct MyApp
     }
     int windowWidth = 0;
     int windowHeight = 0;
+    // Framebuffer size from the input thread, width << 32 | height, 0 when
+    // the render thread has applied it
+    atomic<uint64_t> pendingFramebufferSize{0};
     void onResize(int w, int h)
     {
         printf("resize %d %d\n", w, h);
-        glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+        pendingFramebufferSize.store(uint64_t(fbWidth) << 32
+                                     | uint32_t(fbHeight));
+    }
+
+    void applyResize()
+    {
+        const uint64_t size = pendingFramebufferSize.exchange(0);
+        if (!size) {
+            return;
+        }
+        windowWidth = int(size >> 32);
+        windowHeight = int(size & 0xffffffff);
         float aspect = (float) windowWidth / (float)windowHeight;
         projMatrix = perspective(50.0f, aspect, 0.1f, 1000.0f);
         if (projMatrixLocation != -1) {
+            glUseProgram(program);
             glUniformMatrix4fv(projMatrixLocation, 1, GL_FALSE,
                                projMatrix.buf);
         }
-    }
-
-    MyQuaternion cubeRotStart;
-    MyQuaternion cubeRotEnd;
-    MyQuaternion cubeRot;
-
-    bool inFaceRot = false;
-    bool inViewRot = false;
-    double rotStartTime;
-    double rotLastFrame;
-    struct FaceRotationInfo {
-        int rotType = -1;
-        bool inverse = false;
-    };
-    array<FaceRotationInfo, 4> queueRotType;
-    FaceRotationInfo faceRotation;
-
-    void startRot(const FaceRotationInfo& r)
-    {
-        if (inFaceRot == true || inViewRot) {
-            for (int i = 0; i < 4; ++i) {
-                if (queueRotType[i].rotType == -1) {
-                    queueRotType[i] = r;
-                    return;
-                }
-            }
-            return;
+        if (postFrameBuf) {
+            deletePostTarget();
+            initPostTarget();
         }
-        faceRotation = r;
-        inFaceRot = true;
-        rotStartTime = glfwGetTime();
-        rotLastFrame = rotStartTime;
-        rubik.startRot(r.rotType, r.inverse);
-    }
-
-    int keyPress = -1;
-
-    void processMoveKey(int key)
-    {
-        if (key == GLFW_KEY_SPACE) {
-            resetState();
-            return ;
-        }
-
-        rotStartTime = glfwGetTime();
-        rotLastFrame = rotStartTime;
-        inViewRot = true;
-
-        MyQuaternion newRot;
-        constexpr float angle = (M_PI/8.0f); // 22.5deg
-        switch (key) {
-          case GLFW_KEY_UP: newRot.rotateX(-angle); break;
-          case GLFW_KEY_DOWN: newRot.rotateX(angle); break;
-          case GLFW_KEY_LEFT: newRot.rotateY(-angle); break;
-          case GLFW_KEY_RIGHT: newRot.rotateY(angle); break;
-        }
-
-        cubeRotStart = cubeRot;
-        cubeRotEnd = newRot * cubeRot;
-        cubeRotEnd.normalize();
     }
 
     void updateCamera()
     {
-        cameraTransform = lookAt(eye, eyeDir, MyPoint(0, 1, 0));
-    }
-
-    MyPoint eye;
-    MyPoint eyeDir;
-    void resetState()
-    {
-        cubeRot.rotateY(M_PI / 4.0f); // 45deg
-
-        eye.x = 0.0f;
-        eye.y = 0.0f;
-        eye.z = 5.0f;
-
-        eyeDir = MyPoint();
-        inCameraMove = false;
-
-        updateCamera();
+        cameraTransform = lookAt(shown.eye, shown.eyeDir, MyPoint(0, 1, 0));
     }
 
     double curX, curY;
@@ -635,24 +1942,15 @@ struct MyApp
         const float diffX = (x - curX) / 100.0f;
         const float diffY = (y - curY) / 100.0f;
 
-        eyeDir.x += diffX;
-        eyeDir.y -= diffY;
-        updateCamera();
+        sim.look(diffX, diffY);
 
         curX = x;
         curY = y;
     }
 
-    bool inCameraMove = false;
-    bool isXCameraMove = false;
-    float cameraAdjust = 0.0f;
-    int maxCameraMoveIncr = 0;
-    int numCameraMoveIncr = 0;
-    bool cameraKeyStillPressed = false;
-
-    int currentCameraMoveKey;
     void onKey(int key, int action)
     {
+        TRACE_SCOPE("MyApp::onKey");
         static bool shiftOn = false;
         if (key == GLFW_KEY_LEFT_SHIFT
          || key == GLFW_KEY_RIGHT_SHIFT) {
@@ -664,58 +1962,41 @@ struct MyApp
          || GLFW_KEY_LEFT == key
          || GLFW_KEY_RIGHT == key
          || GLFW_KEY_SPACE == key) {
-            if (inFaceRot) {
-                return;
-
-            }
             if (action == GLFW_RELEASE) {
-                keyPress = -1;
+                sim.heldViewRotation = -1;
                 return;
             }
-            if (key != GLFW_KEY_SPACE) {
-                keyPress = key;
+            if (sim.inFaceRotation()) {
+                return;
             }
-            else if (action != GLFW_PRESS) {
+            if (key == GLFW_KEY_SPACE) {
+                if (action == GLFW_PRESS) {
+                    sim.resetView();
+                }
                 return;
             }
-            processMoveKey(key);
+            MySimulation::ViewRotation r = MySimulation::VIEW_UP;
+            switch (key) {
+              case GLFW_KEY_DOWN: r = MySimulation::VIEW_DOWN; break;
+              case GLFW_KEY_LEFT: r = MySimulation::VIEW_LEFT; break;
+              case GLFW_KEY_RIGHT: r = MySimulation::VIEW_RIGHT; break;
+            }
+            sim.heldViewRotation = r;
+            sim.rotateView(r);
             return;
         }
 
-
         if (key == GLFW_KEY_S
          || key == GLFW_KEY_X
          || key == GLFW_KEY_Z
          || key == GLFW_KEY_C) {
-            if (inCameraMove) {
-                // If we're already moving, we're just updating if the
-                // current key is still pressed or not
-                if (key == currentCameraMoveKey) {
-                    cameraKeyStillPressed = (action != GLFW_RELEASE);
-                }
-                return;
-            }
-
-            if (action == GLFW_RELEASE) {
-                return;
-            }
-
-            float adjust = 0.1f / 10.0f;
-            maxCameraMoveIncr = 10;
+            MySimulation::CameraMove m = MySimulation::CAMERA_UP;
             switch (key) {
-              case GLFW_KEY_C: isXCameraMove = true;
-                               cameraAdjust = adjust; break;
-              case GLFW_KEY_Z: isXCameraMove = true;
-                               cameraAdjust = -adjust; break;
-              case GLFW_KEY_X: isXCameraMove = false;
-                               cameraAdjust = -adjust; break;
-              case GLFW_KEY_S: isXCameraMove = false;
-                               cameraAdjust = adjust; break;
-            }
-            numCameraMoveIncr = 0;
-            inCameraMove = true;
-            cameraKeyStillPressed = true;
-            currentCameraMoveKey = key;
+              case GLFW_KEY_C: m = MySimulation::CAMERA_RIGHT; break;
+              case GLFW_KEY_Z: m = MySimulation::CAMERA_LEFT; break;
+              case GLFW_KEY_X: m = MySimulation::CAMERA_DOWN; break;
+            }
+            sim.cameraKey(m, action != GLFW_RELEASE);
             return;
         }
 
@@ -723,155 +2004,252 @@ struct MyApp
             return;
         }
 
-        MyPoint direction;
-        switch (key) {
-          case 'U': direction.y = 1.0f; break;
-          case 'F': direction.z = 1.0f; break;
-          case 'R': direction.x = 1.0f; break;
-          case 'L': direction.x = -1.0f; break;
-          case 'D': direction.y = -1.0f; break;
-          case 'B': direction.z = -1.0f; break;
-          default: return;
+        if (key == GLFW_KEY_O) {
+            showOverlay = !showOverlay;
+            return;
         }
-
-        MyMatrix mv = cubeRot.toMatrix();
-        float max;
-        FaceRotationInfo r;
-        r.inverse = shiftOn;
-        for (int i = 0; i < 6; ++i) {
-            const MyPoint face = rubik.faceNormal[i].transform(mv);
-            const float d = face.dot(direction);
-            if (i == 0 || max < d) {
-                r.rotType = i;
-                max = d;
+        if (key == GLFW_KEY_P) {
+            profileDumpRequested = true;
+            return;
+        }
+        if (key == GLFW_KEY_T) {
+            if (TRACE_WRITE("trace.json")) {
+                puts("trace written to trace.json");
             }
+            return;
+        }
+        if (key == GLFW_KEY_ENTER) {
+            solveCube();
+            return;
+        }
+        if (key == GLFW_KEY_M) {
+            scrambleCube();
+            return;
         }
-        startRot(r);
-    }
 
-    static constexpr float totRotTime = 0.4f;
-    static constexpr float totRotTime2 = 0.3f;
+        sim.requestTurn(key < 128 ? char(key) : 0, shiftOn);
+    }
 
     int frames = 0;
     double start;
     MyMatrix cameraTransform;
     double prevFps = 1.0;
+    // Light used for the shadow map and for the shading, in world space
+    void lightSetup(MyPoint& lightPos, MyMatrix& l, MyMatrix& p) const
+    {
+#if 0
+        // XXX
+        lightPos = MyPoint(0.0f, 5.0f, 0.0f);
+        MyPoint lightInvDir(0.0f,1.0f,0.0f);
+        //MyPoint lightPos(2.0f, 1.0f, 0.0f);
+        //MyPoint lightInvDir(1.0f,3.0f,1.0f);
+        l = lookAt(lightInvDir,
+                   MyPoint(),
+                   MyPoint(1.0f,0.0f,0.0f));
+        p = ortho(-5, 5, -5, 5, 0, 10.0);
+#else
+        lightPos = MyPoint(0.0f,50.0f,5.0f);
+        MyPoint lightTarget(0.0f,
+                            1.5f*sim.rubik.radius(),
+                            1.5f*sim.rubik.radius());
+        l = lookAt(lightPos, lightTarget,
+                   MyPoint(0,-1.0f,10.0f));
+        //MyPoint lightPos = (lightTarget + lightInvDir);
+        p = ortho(-5, 5, -5, 5, 0.1, 100.0);
+#endif
+    }
+
+    // Renders the depth of the cube seen from the light into the shadow map,
+    // and with VSM that of the ground too
+    void renderShadowMap(const MyMatrix& lightMv, const MyMatrix& lightProj,
+                         const MyMatrix& groundMv)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, frameBuf);
+        glViewport(0, 0, shadowMapSize(), shadowMapSize());
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // The moments of the far plane, if VSM
+        constexpr GLfloat b[] = { 1.0f, 1.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, b);
+        glUseProgram(shadowProgram);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+
+        glUniformMatrix4fv(shadowPerspectiveLoc, 1, GL_FALSE, lightProj.buf);
+        glCall(glUniformMatrix4fv(shadowMvLoc, 1, GL_FALSE, lightMv.buf));
+        glDrawArrays(GL_TRIANGLES, 0, 36*27);
+        if (blurFrameBuf) {
+            // The blur mixes in what lies around the cube's edges, which
+            // must be the ground rather than the far plane, or the shadow
+            // shrinks
+            glUniformMatrix4fv(shadowMvLoc, 1, GL_FALSE, groundMv.buf);
+            glDrawArrays(GL_TRIANGLES, 36*27, 6);
+            blurMoments();
+        }
+    }
+
+    // Cube, view and camera animation. The simulation runs in fixed steps
+    // on the input thread, which hands the last two steps to the renderer
+    // through frameMailbox; what gets drawn is interpolated between them.
+    MySimulation sim;
+    // Input thread
+    MySimFrame simFrame;
+    bool clockStarted = false;
+    MyMailbox<MySimFrame> frameMailbox;
+    // Render thread
+    MySimState shown;
+    double lastFrameTime = -1.0;
+    // shown's cubie transforms, the 28th is for the ground
+    MyMatrix cubieTransforms[28];
+    // Measured by the renderer, for the turns shorter than a frame
+    atomic<double> frameInterval{1.0 / 60.0};
+    // Longest the simulation catches up in one go, after a stall
+    static constexpr double maxCatchUp = 0.25;
+
+    void initSimulation()
+    {
+        sim.turnTime = options.turnTime;
+        sim.minTurnTime = options.minTurnTime;
+        sim.initialize();
+        sim.snapshot(simFrame.cur);
+        simFrame.prev = simFrame.cur;
+        frameMailbox.write(simFrame);
+        shown = simFrame.cur;
+        updateCamera();
+    }
+
+    // Steps the simulation up to currentTime and publishes the result
+    void stepSimulation(double currentTime)
+    {
+        TRACE_SCOPE("simulationStep");
+        MyAllocScope allocScope(allocStats, MyAllocStats::MOVE);
+        const unsigned long long turnsBefore = sim.turnsDone;
+        // A replay's turns must not depend on --fps: which ones are too
+        // short to animate is decided on the step, not the frame
+        sim.frameInterval = replaying ? MySimulation::dt
+                          : frameInterval.load(memory_order_relaxed);
+        if (!clockStarted) {
+            simFrame.clockOffset = currentTime - sim.time();
+            clockStarted = true;
+        }
+
+        double target = currentTime - simFrame.clockOffset;
+        if (!simulatedClock && target - sim.time() > maxCatchUp) {
+            // Drop the time lost rather than run hundreds of steps
+            simFrame.clockOffset += target - sim.time() - maxCatchUp;
+            target = sim.time() + maxCatchUp;
+        }
+        bool stepped = false;
+        while (sim.time() + MySimulation::dt <= target) {
+            if (replaying) {
+                replay.apply(sim, sim.time());
+            }
+            simFrame.prev = simFrame.cur;
+            sim.step();
+            sim.snapshot(simFrame.cur);
+            stepped = true;
+        }
+        if (stepped) {
+            simFrame.time = sim.time();
+            simFrame.moving = memcmp(&simFrame.prev, &simFrame.cur,
+                                     sizeof(MySimState)) != 0;
+            frameMailbox.write(simFrame);
+        }
+        allocScope.events = sim.turnsDone - turnsBefore;
+    }
+
+    // Interpolates the latest published steps at currentTime into shown,
+    // the camera and the cubie transforms. Returns true when the
+    // transforms changed.
+    bool showSimulation(double currentTime)
+    {
+        profiler.beginCpu(MyProfiler::ANIMATION_UPDATE);
+        TRACE_BEGIN("animationUpdate");
+
+        if (lastFrameTime >= 0.0 && currentTime > lastFrameTime) {
+            frameInterval.store(currentTime - lastFrameTime,
+                                memory_order_relaxed);
+        }
+        lastFrameTime = currentTime;
+
+        frameMailbox.update();
+        const MySimFrame& f = frameMailbox.front();
+        // Holds the last step if the simulation is late, no extrapolation
+        const double alpha = (currentTime - f.clockOffset - f.time)
+                           / MySimulation::dt;
+        shown = MySimState::interpolate(f.prev, f.cur,
+                                        float(min(max(alpha, 0.0), 1.0)));
+        updateCamera();
+
+        MyMatrix transforms[27];
+        for (int i = 0; i < 27; ++i) {
+            transforms[i] = shown.cubies[i].toMatrix();
+        }
+        const bool transformsChanged = memcmp(transforms, cubieTransforms,
+                                              sizeof(transforms)) != 0;
+        if (transformsChanged) {
+            memcpy(cubieTransforms, transforms, sizeof(transforms));
+        }
+
+        TRACE_END("animationUpdate");
+        profiler.endCpu(MyProfiler::ANIMATION_UPDATE);
+        return transformsChanged;
+    }
+
     void render(double currentTime)
     {
+        TRACE_SCOPE("render");
+        countStartupAllocations();
+        MyAllocScope allocScope(allocStats, MyAllocStats::FRAME);
         if (frames == 0) {
             start = currentTime;
         }
         ++frames;
 
-        if (inFaceRot) {
-            const float t = float(currentTime - rotStartTime) / totRotTime;
-            if (t >= 1.0f) {
-                inFaceRot = false;
-                rubik.endRot((int) faceRotation.rotType,
-                             faceRotation.inverse);
-                if (queueRotType[0].rotType != -1) {
-                    FaceRotationInfo next = queueRotType[0];
-                    queueRotType[0] = queueRotType[1];
-                    queueRotType[1] = queueRotType[2];
-                    queueRotType[2] = queueRotType[3];
-                    queueRotType[3].rotType = -1;
-                    startRot(next);
-                }
-            }
-            else {
-                rubik.doIncRot(faceRotation.rotType, t);
-            }
+        profiler.beginFrame();
+        const bool transformsChanged = showSimulation(currentTime);
+        MyMatrix mCubeRot = shown.cubeRot.toMatrix();
+
+        if (transformsChanged) {
+            MyCpuSection upload(profiler, MyProfiler::UNIFORM_UPLOAD);
+            TRACE_SCOPE("uniformUpload");
             glUseProgram(program);
             glCall(glUniformMatrix4fv(vertexTransformLocation, 28, GL_FALSE,
-                               (const GLfloat *) rubik.mTransforms));
+                               (const GLfloat *) cubieTransforms));
             glUseProgram(shadowProgram);
             glCall(glUniformMatrix4fv(shadowVertexTransformLoc, 28, GL_FALSE,
-                               (const GLfloat *) rubik.mTransforms));
-        }
-        if (inViewRot) {
-            const float t = float(currentTime - rotStartTime) / totRotTime2;
-            if (t >= 1.0f) {
-                inViewRot = false;
-                cubeRot = cubeRotEnd;
-                if (queueRotType[0].rotType != -1) {
-                    FaceRotationInfo next = queueRotType[0];
-                    queueRotType[0] = queueRotType[1];
-                    queueRotType[1] = queueRotType[2];
-                    queueRotType[2] = queueRotType[3];
-                    queueRotType[3].rotType = -1;
-                    startRot(next);
-                }
-                else if (keyPress != -1) {
-                    processMoveKey(keyPress);
-                }
-            }
-            else {
-                cubeRot = MyQuaternion::slerp(cubeRotStart, cubeRotEnd, t);
-            }
-        }
-        MyMatrix mCubeRot = cubeRot.toMatrix();
-
-        if (inCameraMove) {
-            if (isXCameraMove) {
-                eye.x += cameraAdjust;
-                eyeDir.x += cameraAdjust;
-            }
-            else {
-                eye.y += cameraAdjust;
-                eyeDir.y += cameraAdjust;
-            }
-            ++numCameraMoveIncr;
-            if (numCameraMoveIncr == maxCameraMoveIncr) {
-                if (cameraKeyStillPressed) {
-                    numCameraMoveIncr = 0;
-                }
-                else {
-                    inCameraMove = false;
-                }
-            }
-            updateCamera();
+                               (const GLfloat *) cubieTransforms));
         }
 
         // Render shadow into shadow map
-        glBindFramebuffer(GL_FRAMEBUFFER, frameBuf);
-        glViewport(0,0,SHADOWMAP_SIZE,SHADOWMAP_SIZE);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        constexpr GLfloat b[] = { 0.0f,0.0f,0.0f };
-        glClearBufferfv(GL_COLOR, 0, b);
-        glUseProgram(shadowProgram);
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
-
-#if 0
-        // XXX
-        MyPoint lightPos(0.0f, 5.0f, 0.0f);
-        MyPoint lightInvDir(0.0f,1.0f,0.0f);
-        //MyPoint lightPos(2.0f, 1.0f, 0.0f);
-        //MyPoint lightInvDir(1.0f,3.0f,1.0f);
-        MyMatrix l = lookAt(lightInvDir,
-                            MyPoint(),
-                            MyPoint(1.0f,0.0f,0.0f));
-        MyMatrix p = ortho(-5, 5, -5, 5, 0, 10.0);
-#else
-        MyPoint lightPos(0.0f,50.0f,5.0f);
-        MyPoint lightTarget(0.0f,
-                            1.5f*rubik.radius(),
-                            1.5f*rubik.radius());
-        MyMatrix l = lookAt(lightPos, lightTarget,
-                            MyPoint(0,-1.0f,10.0f));
-        //MyPoint lightPos = (lightTarget + lightInvDir);
-        MyMatrix p = ortho(-5, 5, -5, 5, 0.1, 100.0);
-#endif
-
-        glUniformMatrix4fv(shadowPerspectiveLoc, 1, GL_FALSE, p.buf);
+        profiler.beginGpu(MyProfiler::SHADOW_PASS);
+        TRACE_BEGIN("shadowPass");
+        MyPoint lightPos;
+        MyMatrix l;
+        MyMatrix p;
+        lightSetup(lightPos, l, p);
         MyMatrix tmp = l * mCubeRot;
-        glCall(glUniformMatrix4fv(shadowMvLoc, 1, GL_FALSE, tmp.buf));
-        glDrawArrays(GL_TRIANGLES, 0, 36*27);
+        renderShadowMap(tmp, p, l);
+        TRACE_END("shadowPass");
+        profiler.endGpu(MyProfiler::SHADOW_PASS);
 
         // Switch back the program
         glUseProgram(program);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0,0, windowWidth, windowHeight);
+        int sceneWidth = windowWidth;
+        int sceneHeight = windowHeight;
+        if (postFrameBuf) {
+            const float scale = dynamicResolution() ? updateResolution()
+                                                    : 1.0f;
+            sceneWidth = max(1, int(windowWidth * scale + 0.5f));
+            sceneHeight = max(1, int(windowHeight * scale + 0.5f));
+            glBindFramebuffer(GL_FRAMEBUFFER, postFrameBuf);
+            // Only what gets drawn needs clearing
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(0, 0, sceneWidth, sceneHeight);
+        }
+        else {
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFrameBuf);
+        }
+        glViewport(0,0, sceneWidth, sceneHeight);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         glEnable(GL_CULL_FACE);
@@ -879,14 +2257,17 @@ struct MyApp
 
         // Bind shadowmap texture
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glBindTexture(GL_TEXTURE_2D, shadowTexture);
         glUniform1i(shadowMapID, 0);
 
         constexpr GLfloat background[] = { 210.0f/255.0f, 230.0f/255.0f,
                                            255.0f/255.0f, 1.0f };
         glClearBufferfv(GL_COLOR, 0, background);
+        glDisable(GL_SCISSOR_TEST);
 
         // Render the ground with shadow
+        profiler.beginGpu(MyProfiler::GROUND_DRAW);
+        TRACE_BEGIN("groundDraw");
         MyMatrix fullMv = cameraTransform;
         glUniform1i(passThroughShader, 1);
         glUniformMatrix4fv(mvMatrixLocation, 1, GL_FALSE, fullMv.buf);
@@ -894,8 +2275,12 @@ struct MyApp
         tmp = p * tmp;
         glCall(glUniformMatrix4fv(shadowMvpLoc, 1, GL_FALSE, tmp.buf));
         glDrawArrays(GL_TRIANGLES, 36*27, 6);
+        TRACE_END("groundDraw");
+        profiler.endGpu(MyProfiler::GROUND_DRAW);
 
         // Render the cube with shadow
+        profiler.beginGpu(MyProfiler::CUBE_DRAW);
+        TRACE_BEGIN("cubeDraw");
         glUniform1i(passThroughShader, 0);
         MyMatrix cubeMv = fullMv * mCubeRot;
         tmp = l * mCubeRot;
@@ -906,26 +2291,57 @@ struct MyApp
         glUniform3f(lightPosLoc, lightPos.x, lightPos.y, lightPos.z);
 
         glDrawArrays(GL_TRIANGLES, 0, 36*27);
+        TRACE_END("cubeDraw");
+        profiler.endGpu(MyProfiler::CUBE_DRAW);
 
-        // To debug the shadow
-#if 1
-        glUseProgram(debugProgram);
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
-        glDisableVertexAttribArray(2);
+        if (postFrameBuf) {
+            postProcess(sceneWidth, sceneHeight);
+        }
 
-        glViewport(0, 0, 256, 256);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthTexture);
-        glUniform1i(debugTexIDLoc, 0);
+        // To debug the shadow
+        if (options.showShadowMap) {
+            profiler.beginGpu(MyProfiler::DEBUG_QUAD_DRAW);
+            TRACE_BEGIN("debugQuadDraw");
+            glUseProgram(debugProgram);
+            glDisableVertexAttribArray(0);
+            glDisableVertexAttribArray(1);
+            glDisableVertexAttribArray(2);
+
+            glViewport(0, 0, 256, 256);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, shadowTexture);
+            glUniform1i(debugTexIDLoc, 0);
+
+            glEnableVertexAttribArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, quadVertexBuffer);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+
+            glDisableVertexAttribArray(0);
+
+            bindSceneAttribs();
+            TRACE_END("debugQuadDraw");
+            profiler.endGpu(MyProfiler::DEBUG_QUAD_DRAW);
+        }
 
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, quadVertexBuffer);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        if (showOverlay) {
+            drawOverlay();
+        }
 
-        glDisableVertexAttribArray(0);
+        if (frames == 100) {
+            frames = 0;
+            double fps = 100.0 / (currentTime - start);
+            double diff = fps / prevFps;
+            if (diff > 1.1 || diff < 0.9) {
+                printf("fps %.2lf\n", fps);
+            }
+            prevFps = fps;
+        }
+        profiler.endFrame();
+    }
 
+    void bindSceneAttribs()
+    {
         glBindBuffer(GL_ARRAY_BUFFER, buffer);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
         glEnableVertexAttribArray(0);
@@ -938,22 +2354,199 @@ struct MyApp
         glBindBuffer(GL_ARRAY_BUFFER, normals);
         glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
         glEnableVertexAttribArray(2);
-#endif
+    }
 
-        if (frames == 100) {
-            frames = 0;
-            double fps = 100.0 / (currentTime - start);
-            double diff = fps / prevFps;
-            if (diff > 1.1 || diff < 0.9) {
-                printf("fps %.2lf\n", fps);
-            }
-            prevFps = fps;
-        }
+    // Per-pass p50/p95/p99 bars in the top left corner, toggled with 'O'
+    void drawOverlay()
+    {
+        const int count = profiler.buildOverlay(overlayVertices,
+                                                overlayColors,
+                                                OVERLAY_MAX_VERTICES,
+                                                windowWidth, windowHeight);
+        glUseProgram(overlayProgram);
+        glViewport(0, 0, windowWidth, windowHeight);
+        glDisable(GL_DEPTH_TEST);
+        glDisableVertexAttribArray(2);
+
+        glBindBuffer(GL_ARRAY_BUFFER, overlayVertexBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(MyPoint),
+                        overlayVertices);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+        glBindBuffer(GL_ARRAY_BUFFER, overlayColorBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(MyPoint),
+                        overlayColors);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+        glDrawArrays(GL_TRIANGLES, 0, count);
+
+        bindSceneAttribs();
+        glEnable(GL_DEPTH_TEST);
+        glUseProgram(program);
     }
 };
 
-int main(void) {
+namespace {
+void usage(const char *prog)
+{
+    printf("usage: %s [options]\n"
+           "  --size WxH        framebuffer size (800x600)\n"
+           "  --samples N       MSAA samples (4)\n"
+           "  --aa MODE         msaa, or fxaa: no samples and a post pass\n"
+           "                    (msaa)\n"
+           "  --moves \"R U...\" turns to apply at startup\n"
+           "  --turn-time S     quarter turn animation time (0.4)\n"
+           "  --min-turn-time S shortest turn with turns queued, 0 lets a\n"
+           "                    backlog apply without animation (0.05)\n"
+           "  --headless        render offscreen without a window (EGL)\n"
+           "  --frames N        headless: frames to render, 0 until idle (0)\n"
+           "  --fps N           headless: simulated frame rate (60)\n"
+           "  --output FILE     headless: PPM output, %%d for every frame\n"
+           "  --software        headless on the CPU, without GL\n"
+           "  --replay FILE     headless benchmark: timed input events, see\n"
+           "                    replay.h; stops when done unless --frames\n"
+           "  --report FILE     replay: JSON results (stdout)\n"
+           "  --control PATH    Unix socket to stream moves in, see control.h\n"
+           "  --shadows MODE    pcf, or vsm: a small filtered variance map\n"
+           "                    (pcf)\n"
+           "  --frame-budget MS lower the resolution while a frame takes\n"
+           "                    over MS, 0 never does (0)\n"
+           "  --no-shadowmap    hide the shadow map debug quad\n"
+           "  --capture FILE    record frames, frame%%d.png or a raw I420 .yuv\n"
+           "  --capture-buffers N  PBOs in flight for capture (3)\n"
+           "  --capture-threads N  encoder threads (cores - 1)\n"
+           "  --batch FILE      render a thumbnail per line of moves to\n"
+           "                    --output state%%d.png, - reads stdin\n"
+           "  --tile N          batch: thumbnail size (128)\n"
+           "  --atlas N         batch: atlas size (2048)\n",
+           prog);
+}
+}
+
+int main(int argc, char **argv) {
     MyApp app;
+    MyOptions& opts = app.options;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasArg = i + 1 < argc;
+        if (!strcmp(argv[i], "--headless")) {
+            opts.headless = true;
+            // The debug quad is only useful interactively
+            opts.showShadowMap = false;
+        }
+        else if (!strcmp(argv[i], "--size") && hasArg) {
+            if (sscanf(argv[++i], "%dx%d", &opts.width, &opts.height) != 2
+             || opts.width <= 0 || opts.height <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--samples") && hasArg) {
+            opts.samples = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--aa") && hasArg) {
+            ++i;
+            if (!strcmp(argv[i], "msaa")) {
+                opts.antialiasing = MyOptions::MSAA;
+            }
+            else if (!strcmp(argv[i], "fxaa")) {
+                opts.antialiasing = MyOptions::FXAA;
+            }
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--shadows") && hasArg) {
+            ++i;
+            if (!strcmp(argv[i], "pcf")) {
+                opts.shadows = MyOptions::PCF;
+            }
+            else if (!strcmp(argv[i], "vsm")) {
+                opts.shadows = MyOptions::VSM;
+            }
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--frames") && hasArg) {
+            opts.frames = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--fps") && hasArg) {
+            opts.fps = atof(argv[++i]);
+            if (opts.fps <= 0.0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--output") && hasArg) {
+            opts.output = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--moves") && hasArg) {
+            opts.moves = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--capture") && hasArg) {
+            opts.capture = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--capture-buffers") && hasArg) {
+            opts.captureBuffers = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--capture-threads") && hasArg) {
+            opts.captureThreads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--batch") && hasArg) {
+            opts.batch = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--tile") && hasArg) {
+            opts.tileSize = atoi(argv[++i]);
+            if (opts.tileSize <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--atlas") && hasArg) {
+            opts.atlasSize = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--turn-time") && hasArg) {
+            opts.turnTime = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--min-turn-time") && hasArg) {
+            opts.minTurnTime = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--replay") && hasArg) {
+            opts.replay = argv[++i];
+            opts.headless = true;
+            opts.showShadowMap = false;
+        }
+        else if (!strcmp(argv[i], "--report") && hasArg) {
+            opts.report = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--control") && hasArg) {
+            opts.control = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--software")) {
+            opts.headless = true;
+            opts.software = true;
+            opts.showShadowMap = false;
+        }
+        else if (!strcmp(argv[i], "--frame-budget") && hasArg) {
+            opts.frameBudget = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--no-shadowmap")) {
+            opts.showShadowMap = false;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    // Handed to snprintf, see isNumberedPattern
+    if (opts.output && strchr(opts.output, '%')
+     && !isNumberedPattern(opts.output)) {
+        printf("--output %s: one %%d for the frame number, and no other "
+               "%% but %%%%\n", opts.output);
+        return 1;
+    }
     app.run();
 }
 
@@ -0,0 +1,341 @@
+#include "optimal.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+
+#include "prunetable.h"
+
+namespace {
+typedef MyPatternDb P;
+
+const char pdbMagic[8] = "CUBEPDB";
+// The version also tells the kind and packing apart
+constexpr uint32_t pdbVersion = 2;
+
+const int allMoves[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                         15, 16, 17 };
+
+// Pattern database sets, strongest first. The small tables are a little
+// faster as nibbles; PHASE1 is not, its mod 3 table's smaller footprint
+// pays for the carrying, so nibbles would only cost memory. Nothing
+// stronger than PHASE1 fits these coordinates in less than 10 GB.
+struct PdbConfig {
+    int count;
+    P::Kind kinds[MyPdbSet::maxPdbs];
+    P::Packing packings[MyPdbSet::maxPdbs];
+};
+const PdbConfig pdbConfigs[] = {
+    { 4, { P::PHASE1, P::CORNERS, P::FLIP_SLICE, P::TWIST_SLICE },
+         { P::MOD3, P::NIBBLE, P::NIBBLE, P::NIBBLE } },
+    { 3, { P::CORNERS, P::FLIP_SLICE, P::TWIST_SLICE },
+         { P::NIBBLE, P::NIBBLE, P::NIBBLE } },
+    { 3, { P::CORNERS, P::FLIP_SLICE, P::TWIST_SLICE },
+         { P::MOD3, P::MOD3, P::MOD3 } },
+    { 1, { P::CORNERS }, { P::MOD3 } },
+    { 0, {}, {} }
+};
+}
+
+size_t MyPatternDb::entries(Kind k)
+{
+    switch (k) {
+      case CORNERS: return size_t(C::numCornerPerms) * C::numTwists;
+      case FLIP_SLICE: return size_t(C::numSlicesSorted) * C::numFlips;
+      case TWIST_SLICE: return size_t(C::numSlicesSorted) * C::numTwists;
+      case PHASE1:
+        return size_t(C::numSlices) * C::numTwists * C::numFlips;
+      default: return 0;
+    }
+}
+
+size_t MyPatternDb::bytes(Kind k, Packing p)
+{
+    return p == NIBBLE ? MyNibbles::bytes(entries(k))
+                       : MyMod3Entries::bytes(entries(k));
+}
+
+const char *MyPatternDb::name(Kind k)
+{
+    switch (k) {
+      case CORNERS: return "corners";
+      case FLIP_SLICE: return "flipslice";
+      case TWIST_SLICE: return "twistslice";
+      case PHASE1: return "phase1";
+      default: return "?";
+    }
+}
+
+const char *MyPatternDb::packingName(Packing p)
+{
+    return p == NIBBLE ? "4-bit" : "mod-3";
+}
+
+bool MyPatternDb::load(const char *dir, Kind k, Packing p,
+                       const MyTwoPhaseTables& tables, int threads)
+{
+    kind = k;
+    packing = p;
+    t = tables.data;
+    const size_t size = bytes(k, p);
+    const uint32_t version = pdbVersion * 100 + k * 10 + p;
+    std::string path;
+    if (dir) {
+        path = std::string(dir) + "/" + name(k)
+             + (p == NIBBLE ? "-4bit.pdb" : "-mod3.pdb");
+        if (file.map(path.c_str(), pdbMagic, version, size)) {
+            data = (const uint8_t *) file.data();
+            return true;
+        }
+    }
+
+    owned = new uint8_t[size];
+    std::fill(owned, owned + size, uint8_t(0xff));
+    MyPruneProgress progress;
+    const std::atomic<bool> never{false};
+    auto next = [this](size_t i, int m) { return this->next(i, m); };
+    const bool built = p == NIBBLE
+        ? buildPackedPruneTable<MyNibbles>(owned, entries(k), allMoves,
+                                           C::numMoves, threads, progress,
+                                           never, next)
+        : buildPackedPruneTable<MyMod3Entries>(owned, entries(k), allMoves,
+                                               C::numMoves, threads,
+                                               progress, never, next);
+    if (!built) {
+        printf("%s does not fit %s entries\n", name(k), packingName(p));
+        return false;
+    }
+    data = owned;
+    if (dir && MyTableFile::write(path.c_str(), pdbMagic, version, owned,
+                                  size)
+     && file.map(path.c_str(), pdbMagic, version, size)) {
+        data = (const uint8_t *) file.data();
+        delete[] owned;
+        owned = nullptr;
+    }
+    return true;
+}
+
+size_t MyPatternDb::index(int corner, int twist, int flip,
+                          int sliceSorted) const
+{
+    switch (kind) {
+      case CORNERS: return size_t(corner) * C::numTwists + twist;
+      case FLIP_SLICE: return size_t(sliceSorted) * C::numFlips + flip;
+      case TWIST_SLICE: return size_t(sliceSorted) * C::numTwists + twist;
+      case PHASE1:
+        return (size_t(sliceSorted / 24) * C::numTwists + twist)
+             * C::numFlips + flip;
+      default: return 0;
+    }
+}
+
+size_t MyPatternDb::next(size_t i, int m) const
+{
+    switch (kind) {
+      case CORNERS:
+        return size_t(t->cornerMove[i / C::numTwists][m]) * C::numTwists
+             + t->twistMove[i % C::numTwists][m];
+      case FLIP_SLICE:
+        return size_t(t->sliceSortedMove[i / C::numFlips][m]) * C::numFlips
+             + t->flipMove[i % C::numFlips][m];
+      case TWIST_SLICE:
+        return size_t(t->sliceSortedMove[i / C::numTwists][m])
+             * C::numTwists + t->twistMove[i % C::numTwists][m];
+      case PHASE1: {
+        const size_t twistSlice = i / C::numFlips;
+        const int slice = twistSlice / C::numTwists;
+        const int twist = twistSlice % C::numTwists;
+        return (size_t(t->sliceSortedMove[slice * 24][m] / 24)
+                * C::numTwists + t->twistMove[twist][m]) * C::numFlips
+             + t->flipMove[i % C::numFlips][m];
+      }
+      default: return 0;
+    }
+}
+
+int MyPatternDb::distance(size_t i) const
+{
+    if (packing == NIBBLE) {
+        return MyNibbles::get(data, i);
+    }
+    // Some move always leads one closer, the one whose entry is one less
+    // mod 3
+    int d = 0;
+    while (i != 0) {
+        const int closer = (MyMod3Entries::get(data, i) + 2) % 3;
+        int m = 0;
+        while (m < C::numMoves
+            && MyMod3Entries::get(data, next(i, m)) != closer) {
+            ++m;
+        }
+        if (m == C::numMoves) {
+            break;
+        }
+        i = next(i, m);
+        ++d;
+    }
+    return d;
+}
+
+bool MyPdbSet::load(const char *dir, size_t budget,
+                    const MyTwoPhaseTables& t, int threads)
+{
+    for (const PdbConfig& c : pdbConfigs) {
+        size_t size = sizeof(MyTwoPhaseTables::Data);
+        for (int k = 0; k < c.count; ++k) {
+            size += MyPatternDb::bytes(c.kinds[k], c.packings[k]);
+        }
+        if (size > budget && c.count > 0) {
+            continue;
+        }
+        count = c.count;
+        for (int k = 0; k < count; ++k) {
+            if (!pdbs[k].load(dir, c.kinds[k], c.packings[k], t, threads)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return true;
+}
+
+size_t MyPdbSet::bytes() const
+{
+    size_t size = 0;
+    for (int k = 0; k < count; ++k) {
+        size += MyPatternDb::bytes(pdbs[k].kind, pdbs[k].packing);
+    }
+    return size;
+}
+
+std::string MyPdbSet::describe() const
+{
+    std::string s;
+    for (int k = 0; k < count; ++k) {
+        s += std::string(k ? ", " : "") + MyPatternDb::name(pdbs[k].kind)
+           + " " + MyPatternDb::packingName(pdbs[k].packing);
+    }
+    return count ? s : "none";
+}
+
+MyOptimalSearch::Coords MyOptimalSearch::coords(
+    const MyCubieCube& cube) const
+{
+    Coords c = { cube.cornerPerm(), cube.twist(), cube.flip(),
+                 cube.sliceSorted(), {} };
+    for (int k = 0; k < pdbs.count; ++k) {
+        const MyPatternDb& p = pdbs.pdbs[k];
+        c.distances[k] = p.distance(p.index(c.corner, c.twist, c.flip,
+                                            c.slice));
+    }
+    return c;
+}
+
+MyOptimalSearch::Coords MyOptimalSearch::move(const Coords& c, int m) const
+{
+    Coords n = { t.cornerMove[c.corner][m], t.twistMove[c.twist][m],
+                 t.flipMove[c.flip][m], t.sliceSortedMove[c.slice][m], {} };
+    for (int k = 0; k < pdbs.count; ++k) {
+        const MyPatternDb& p = pdbs.pdbs[k];
+        n.distances[k] = p.distance(p.index(n.corner, n.twist, n.flip,
+                                            n.slice), c.distances[k]);
+    }
+    return n;
+}
+
+int MyOptimalSearch::heuristic(const Coords& c) const
+{
+    int h = tables.phase1Distance(c.twist, c.flip, c.slice);
+    for (int k = 0; k < pdbs.count; ++k) {
+        h = std::max(h, int(c.distances[k]));
+    }
+    return h;
+}
+
+MyOptimalSearch::Result MyOptimalSearch::search(
+    const MyCubieCube& cube, const std::vector<int>& prefix, int bound,
+    const std::function<bool()>& stopFn, std::vector<int>& solution,
+    int& nextBound)
+{
+    stop = &stopFn;
+    stopped = false;
+    minOver = INT_MAX;
+    solution.clear();
+
+    const int n = int(prefix.size());
+    if (bound >= int(sizeof(moves) / sizeof(moves[0])) || n > bound) {
+        nextBound = INT_MAX;
+        return EXHAUSTED;
+    }
+    Coords c = coords(cube);
+    cubes[0] = cube;
+    cubesKnown = 0;
+    for (int i = 0; i < n; ++i) {
+        moves[i] = prefix[i];
+        c = move(c, prefix[i]);
+    }
+    const bool found = search(c, n, bound);
+    nextBound = minOver;
+    if (found) {
+        solution.assign(moves, moves + bound);
+        return FOUND;
+    }
+    return stopped ? CANCELLED : EXHAUSTED;
+}
+
+const MyCubieCube& MyOptimalSearch::cubeAt(int g)
+{
+    for (; cubesKnown < g; ++cubesKnown) {
+        cubes[cubesKnown + 1] = cubes[cubesKnown];
+        cubes[cubesKnown + 1].move(moves[cubesKnown]);
+    }
+    return cubes[g];
+}
+
+bool MyOptimalSearch::search(const Coords& c, int g, int bound)
+{
+    if ((++nodes & 4095) == 0 && (*stop)()) {
+        stopped = true;
+    }
+    if (stopped) {
+        return false;
+    }
+    const int f = g + heuristic(c);
+    if (f > bound) {
+        minOver = std::min(minOver, f);
+        return false;
+    }
+    if (g == bound) {
+        // Corners, orientations and slice are solved, check the rest
+        return cubeAt(g).isSolved();
+    }
+    if (endgame && bound - g <= endgame->depth()) {
+        const MyCubieCube& cube = cubeAt(g);
+        const int k = endgame->distance(cube);
+        if (k == bound - g && endgame->solve(cube, rest, k)) {
+            std::copy(rest.begin(), rest.end(), moves + g);
+            return true;
+        }
+        // Closer ones were ruled out by the smaller bounds
+        if (k < 0 || k > bound - g) {
+            minOver = std::min(minOver, g + (k < 0 ? endgame->depth() + 1
+                                                   : k));
+        }
+        return false;
+    }
+    for (int m = 0; m < C::numMoves; ++m) {
+        if (g > 0 && C::redundantAfter(m, moves[g - 1])) {
+            continue;
+        }
+        moves[g] = m;
+        cubesKnown = std::min(cubesKnown, g);
+        if (search(move(c, m), g + 1, bound)) {
+            return true;
+        }
+        if (stopped) {
+            return false;
+        }
+    }
+    return false;
+}
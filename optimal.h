@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cubiecube.h"
+#include "endgame.h"
+#include "solver.h"
+#include "tablefile.h"
+
+// A pattern database: the exact distance to solved of every state of a
+// few of the cube's coordinates, a lower bound for the whole cube. Stored
+// packed, 4 bits per entry or only the distance mod 3 in 2 bits, and
+// mapped from a file like the two-phase tables, so that all the search
+// processes share one copy.
+struct MyPatternDb {
+    typedef MyCubieCube C;
+
+    enum Kind {
+        // Corner permutation and twist, 88M entries
+        CORNERS,
+        // Edge flip and where the slice edges are, 24M
+        FLIP_SLICE,
+        // Twist and where the slice edges are, 26M
+        TWIST_SLICE,
+        // Twist, flip and the slice edges' positions: the two-phase
+        // solver's phase 1 as a whole, 2.2G
+        PHASE1,
+        NUM_KINDS
+    };
+    enum Packing {
+        NIBBLE,
+        // The distance follows from a neighbor's, so searches carry the
+        // exact distance down from the root
+        MOD3
+    };
+
+    static size_t entries(Kind k);
+    static size_t bytes(Kind k, Packing p);
+    static const char *name(Kind k);
+    static const char *packingName(Packing p);
+
+    MyPatternDb() = default;
+    MyPatternDb(MyPatternDb&) = delete;
+    ~MyPatternDb() { delete[] owned; }
+
+    // Maps dir/<name>-<packing>.pdb, or builds it with the move tables of
+    // t on threads threads and writes it there first; dir null only builds
+    bool load(const char *dir, Kind k, Packing p, const MyTwoPhaseTables& t,
+              int threads);
+
+    size_t index(int corner, int twist, int flip, int sliceSorted) const;
+    // Exact distance of entry i; with MOD3, found by walking down to
+    // solved
+    int distance(size_t i) const;
+    // Exact distance of entry i, one move from an entry at distance
+    // neighbor
+    int distance(size_t i, int neighbor) const
+    {
+        if (packing == NIBBLE) {
+            return MyNibbles::get(data, i);
+        }
+        const int v = MyMod3Entries::get(data, i);
+        return neighbor + (v - neighbor % 3 + 4) % 3 - 1;
+    }
+
+    Kind kind = CORNERS;
+    Packing packing = NIBBLE;
+
+  private:
+    size_t next(size_t i, int m) const;
+
+    const MyTwoPhaseTables::Data *t = nullptr;
+    MyTableFile file;
+    uint8_t *owned = nullptr;
+    const uint8_t *data = nullptr;
+};
+
+// The pattern databases a search uses: the strongest set whose tables,
+// the two-phase ones included, fit in a memory budget
+struct MyPdbSet {
+    static constexpr int maxPdbs = 4;
+
+    MyPdbSet() = default;
+    MyPdbSet(MyPdbSet&) = delete;
+
+    // Tables in dir as MyPatternDb::load
+    bool load(const char *dir, size_t budget, const MyTwoPhaseTables& t,
+              int threads);
+    // Of the pattern databases
+    size_t bytes() const;
+    // "corners 4-bit, ..."
+    std::string describe() const;
+
+    int count = 0;
+    MyPatternDb pdbs[maxPdbs];
+};
+
+// IDA* for shortest solutions. The heuristic is the largest of the
+// pattern database distances and the two-phase solver's phase 1
+// distances, all lower bounds of the distance to solved. One search covers
+// the subtree below a prefix of moves at one depth bound, the unit of work
+// the sharded search hands out. With an endgame table, the last moves are
+// looked up rather than searched.
+struct MyOptimalSearch {
+    typedef MyCubieCube C;
+
+    // What the move tables track of a cube, and its pattern database
+    // distances, enough for the heuristic
+    struct Coords {
+        int corner;
+        int twist;
+        int flip;
+        int slice;
+        uint8_t distances[MyPdbSet::maxPdbs];
+    };
+
+    enum Result {
+        FOUND,
+        // No solution of bound moves below the prefix
+        EXHAUSTED,
+        CANCELLED
+    };
+
+    MyOptimalSearch(const MyTwoPhaseTables& tables, const MyPdbSet& pdbs,
+                    const MyEndgameTable *endgame = nullptr)
+        : tables(tables), t(*tables.data), pdbs(pdbs), endgame(endgame) {}
+    MyOptimalSearch(MyOptimalSearch&) = delete;
+
+    Coords coords(const MyCubieCube& cube) const;
+    Coords move(const Coords& c, int m) const;
+    // Lower bound of the moves to solve
+    int heuristic(const Coords& c) const;
+
+    // Looks for solutions of exactly bound moves that start with prefix.
+    // stop is called every few thousand nodes, true cancels. nextBound
+    // gets the smallest estimate over bound met, where the next bound
+    // should start.
+    Result search(const MyCubieCube& cube, const std::vector<int>& prefix,
+                  int bound, const std::function<bool()>& stop,
+                  std::vector<int>& solution, int& nextBound);
+
+    unsigned long long nodes = 0;
+
+  private:
+    bool search(const Coords& c, int g, int bound);
+    // The cube after the first g moves, from the last one known on the
+    // way there
+    const MyCubieCube& cubeAt(int g);
+
+    const MyTwoPhaseTables& tables;
+    const MyTwoPhaseTables::Data& t;
+    const MyPdbSet& pdbs;
+    const MyEndgameTable *endgame;
+    int moves[32];
+    // The cubes along moves, up to cubesKnown: only the few nodes that
+    // need one pay for its moves
+    MyCubieCube cubes[33];
+    int cubesKnown = 0;
+    // An endgame solution, kept to reuse its memory
+    std::vector<int> rest;
+    int minOver = 0;
+    const std::function<bool()> *stop = nullptr;
+    bool stopped = false;
+};
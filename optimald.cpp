@@ -0,0 +1,798 @@
+// Optimal solver sharded over processes. The coordinator runs IDA* one
+// depth bound at a time; at each bound the search tree is cut into shards
+// by move prefix (every canonical sequence of --prefix moves) and the
+// shards are handed out to worker processes over a Unix socket. Workers
+// map the same table files, so N of them cost the tables' memory once.
+//
+// Bounds flow back with the results: a shard that comes back empty says
+// how far over the bound its subtree starts, and is skipped until the
+// bound gets there; the first shard to find a solution cancels the others
+// (a solution at the current bound is optimal, as all the shorter bounds
+// were exhausted). The workers are local processes here, standing in for
+// other machines: only the socket would change.
+//
+// Coordinator to worker, one line each:
+//   shard <job> <shard> <bound> <54 facelets> <prefix moves>
+//   cancel <job>
+//   quit
+// Worker to coordinator:
+//   ready <pid>
+//   result <job> <shard> found <nodes> <moves>
+//   result <job> <shard> none <nodes> <next bound>
+//   result <job> <shard> cancelled <nodes>
+//
+// --memory picks the pattern databases (see MyPdbSet), e.g. 64M, 1G or 8G;
+// --bench solves random cubes in this process with them, for the nodes
+// per second and memory of each budget. --endgame-depth D adds a table of
+// every cube within D moves of solved, so the searches stop D moves short.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cubiecube.h"
+#include "optimal.h"
+#include "scramble.h"
+#include "solver.h"
+
+using namespace std;
+
+namespace {
+typedef chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point t)
+{
+    return chrono::duration<double>(Clock::now() - t).count();
+}
+
+bool socketAddress(const char *path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    return true;
+}
+
+bool sendLine(int fd, const string& line)
+{
+    size_t sent = 0;
+    while (sent < line.size()) {
+        const ssize_t n = send(fd, line.data() + sent, line.size() - sent,
+                               0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// Blocking, false when the peer is gone
+bool readLine(int fd, string& buffer, string& line)
+{
+    size_t end;
+    while ((end = buffer.find('\n')) == string::npos) {
+        char buf[4096];
+        const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(buf, n);
+    }
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return true;
+}
+
+struct MyOptions {
+    const char *socketPath = "/tmp/cubeoptimal.sock";
+    const char *tables = "twophase.tables";
+    // Where the pattern databases are, and how much memory they and the
+    // two-phase tables may take
+    const char *pdbDir = ".";
+    size_t memory = size_t(1) << 30;
+    // Of the endgame table in pdbDir, 0 for none
+    int endgameDepth = 0;
+    int workers = 0;
+    // 5 moves already make 577368 shards, more do not fit in memory
+    static constexpr int maxPrefixLength = 5;
+    int prefixLength = 3;
+    // Cubes: scrambles given on the command line or one per line of file
+    vector<string> scrambles;
+    const char *file = nullptr;
+    bool worker = false;
+    // Random cubes of benchLength moves solved in this process
+    int bench = 0;
+    int benchLength = 14;
+    unsigned seed = 1;
+};
+
+// "64M", "1G", or bytes
+bool parseSize(const char *s, size_t& size)
+{
+    char *end;
+    const double v = strtod(s, &end);
+    double unit = 1.0;
+    switch (*end) {
+      case 'K': case 'k': unit = 1024.0; ++end; break;
+      case 'M': case 'm': unit = 1024.0 * 1024.0; ++end; break;
+      case 'G': case 'g': unit = 1024.0 * 1024.0 * 1024.0; ++end; break;
+    }
+    if (end == s || *end || v < 0.0) {
+        return false;
+    }
+    size = size_t(v * unit);
+    return true;
+}
+
+// Pattern databases as the options say, built if missing
+bool loadPdbs(const MyOptions& options, const MyTwoPhaseTables& tables,
+              MyPdbSet& pdbs)
+{
+    const Clock::time_point t = Clock::now();
+    if (!pdbs.load(options.pdbDir, options.memory, tables,
+                   max(1u, thread::hardware_concurrency()))) {
+        return false;
+    }
+    printf("pattern databases: %s, %.0f MB (%.0f MB with the two-phase "
+           "tables), ready in %.1fs\n", pdbs.describe().c_str(),
+           pdbs.bytes() / 1048576.0,
+           (pdbs.bytes() + sizeof(MyTwoPhaseTables::Data)) / 1048576.0,
+           secondsSince(t));
+    return true;
+}
+
+// The endgame table as the options say, built if missing
+bool loadEndgame(const MyOptions& options, int threads,
+                 MyEndgameTable& endgame)
+{
+    if (options.endgameDepth == 0) {
+        return true;
+    }
+    const Clock::time_point t = Clock::now();
+    const int depth = options.endgameDepth;
+    const string path = string(options.pdbDir) + "/endgame-"
+                      + to_string(depth) + ".table";
+    if (!endgame.load(path.c_str(), depth, threads)) {
+        return false;
+    }
+    printf("endgame table: depth %d, %.0f MB, ready in %.1fs\n", depth,
+           MyEndgameTable::bytes(depth) / 1048576.0, secondsSince(t));
+    return true;
+}
+
+// The endgame table for a search, if any
+const MyEndgameTable *endgameFor(const MyOptions& options,
+                                 const MyEndgameTable& endgame)
+{
+    return options.endgameDepth ? &endgame : nullptr;
+}
+
+// Every canonical sequence of n moves
+void prefixes(int n, vector<int>& current, vector<vector<int>>& out)
+{
+    if (int(current.size()) == n) {
+        out.push_back(current);
+        return;
+    }
+    for (int m = 0; m < MyCubieCube::numMoves; ++m) {
+        if (!current.empty()
+         && MyCubieCube::redundantAfter(m, current.back())) {
+            continue;
+        }
+        current.push_back(m);
+        prefixes(n, current, out);
+        current.pop_back();
+    }
+}
+
+struct MyCoordinator {
+    MyCoordinator(const MyOptions& o) : options(o) {}
+    MyCoordinator(MyCoordinator&) = delete;
+
+    bool start(const char *self);
+    bool solve(const MyCubieCube& cube, vector<int>& solution);
+    void stop();
+
+    // Totals over all the solves
+    unsigned long long totalNodes = 0;
+    unsigned long long shardsRun = 0;
+    unsigned long long shardsSkipped = 0;
+    unsigned long long shardsCancelled = 0;
+
+  private:
+    struct Worker {
+        pid_t pid = -1;
+        int fd = -1;
+        string in;
+        int shard = -1;
+    };
+    // Whether a worker process is gone, reaping it
+    bool workerExited();
+    // One bound over all the shards; false if a worker died
+    bool runBound(const MyCubieCube& cube, int bound,
+                  vector<int>& solution, int& nextBound);
+
+    const MyOptions& options;
+    MyTwoPhaseTables tables;
+    MyPdbSet pdbs;
+    MyEndgameTable endgame;
+    int listenFd = -1;
+    vector<Worker> workers;
+    vector<vector<int>> shards;
+    // Per shard: no solution below it under this many moves
+    vector<int> shardBound;
+    unsigned job = 0;
+};
+
+bool MyCoordinator::workerExited()
+{
+    for (Worker& w : workers) {
+        if (w.pid > 0 && waitpid(w.pid, nullptr, WNOHANG) == w.pid) {
+            w.pid = -1;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MyCoordinator::start(const char *argv0)
+{
+    // The workers run this same binary; argv[0] is no path to it when
+    // started from PATH, and execl() doesn't search PATH
+    char self[PATH_MAX];
+    if (!realpath("/proc/self/exe", self) && !realpath(argv0, self)) {
+        printf("Could not find %s: %s\n", argv0, strerror(errno));
+        return false;
+    }
+
+    // Built here once, the workers only map them
+    Clock::time_point t = Clock::now();
+    tables.load(options.tables, max(1u, thread::hardware_concurrency()));
+    printf("tables ready in %.1fs\n", secondsSince(t));
+    if (!loadPdbs(options, tables, pdbs)
+     || !loadEndgame(options, max(1u, thread::hardware_concurrency()),
+                     endgame)) {
+        return false;
+    }
+
+    vector<int> current;
+    prefixes(options.prefixLength, current, shards);
+
+    sockaddr_un addr;
+    if (!socketAddress(options.socketPath, addr)) {
+        return false;
+    }
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(options.socketPath);
+    if (listenFd < 0
+     || bind(listenFd, (const sockaddr *) &addr, sizeof(addr)) != 0
+     || listen(listenFd, 64) != 0) {
+        printf("%s: %s\n", options.socketPath, strerror(errno));
+        return false;
+    }
+    // Not for the workers to inherit
+    fcntl(listenFd, F_SETFD, FD_CLOEXEC);
+
+    int n = options.workers;
+    if (n <= 0) {
+        n = max(1u, thread::hardware_concurrency());
+    }
+    workers.resize(n);
+    const string memory = to_string(options.memory);
+    const string endgameDepth = to_string(options.endgameDepth);
+    for (Worker& w : workers) {
+        w.pid = fork();
+        if (w.pid == 0) {
+            execl(self, self, "--worker", "--socket", options.socketPath,
+                  "--tables", options.tables, "--pdb-dir", options.pdbDir,
+                  "--memory", memory.c_str(), "--endgame-depth",
+                  endgameDepth.c_str(), (char *) nullptr);
+            printf("Could not start %s: %s\n", self, strerror(errno));
+            _exit(1);
+        }
+    }
+    for (Worker& w : workers) {
+        // Not accept() right away: it would wait forever for a worker
+        // that died on the way
+        for (;;) {
+            pollfd pfd = { listenFd, POLLIN, 0 };
+            const int ready = ::poll(&pfd, 1, 100);
+            if (ready > 0) {
+                break;
+            }
+            if ((ready < 0 && errno != EINTR) || workerExited()) {
+                puts("worker failed to start");
+                return false;
+            }
+        }
+        string line;
+        w.fd = accept(listenFd, nullptr, nullptr);
+        if (w.fd < 0 || !readLine(w.fd, w.in, line)
+         || strncmp(line.c_str(), "ready", 5)) {
+            puts("worker failed to start");
+            return false;
+        }
+    }
+    printf("%d workers, %zu shards of %d moves\n", n, shards.size(),
+           options.prefixLength);
+    return true;
+}
+
+void MyCoordinator::stop()
+{
+    // All told to quit before any is waited for: the connections were
+    // accepted in whatever order the workers came up, not in that of pid
+    for (Worker& w : workers) {
+        if (w.fd >= 0) {
+            sendLine(w.fd, "quit\n");
+            close(w.fd);
+        }
+    }
+    for (Worker& w : workers) {
+        if (w.pid > 0) {
+            waitpid(w.pid, nullptr, 0);
+        }
+    }
+    workers.clear();
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(options.socketPath);
+        listenFd = -1;
+    }
+}
+
+bool MyCoordinator::solve(const MyCubieCube& cube, vector<int>& solution)
+{
+    ++job;
+    shardBound.assign(shards.size(), 0);
+    MyOptimalSearch local(tables, pdbs, endgameFor(options, endgame));
+    const function<bool()> never = [] { return false; };
+
+    int bound = local.heuristic(local.coords(cube));
+    while (bound < INT_MAX) {
+        int nextBound = INT_MAX;
+        // Shallower than the shards: not worth handing out
+        if (bound <= options.prefixLength) {
+            const MyOptimalSearch::Result r = local.search(
+                cube, vector<int>(), bound, never, solution, nextBound);
+            totalNodes += local.nodes;
+            local.nodes = 0;
+            if (r == MyOptimalSearch::FOUND) {
+                return true;
+            }
+        }
+        else if (!runBound(cube, bound, solution, nextBound)) {
+            return false;
+        }
+        else if (!solution.empty()) {
+            return true;
+        }
+        bound = max(bound + 1, nextBound);
+    }
+    return false;
+}
+
+bool MyCoordinator::runBound(const MyCubieCube& cube, int bound,
+                             vector<int>& solution, int& nextBound)
+{
+    char facelets[55];
+    cube.toFacelets(facelets);
+    MyOptimalSearch local(tables, pdbs, endgameFor(options, endgame));
+    const MyOptimalSearch::Coords start = local.coords(cube);
+
+    // The shards that may hold a solution at this bound
+    vector<int> todo;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        MyOptimalSearch::Coords c = start;
+        for (int m : shards[i]) {
+            c = local.move(c, m);
+        }
+        const int f = max(shardBound[i],
+                          int(shards[i].size()) + local.heuristic(c));
+        if (f > bound) {
+            shardBound[i] = f;
+            nextBound = min(nextBound, f);
+            ++shardsSkipped;
+        }
+        else {
+            todo.push_back(i);
+        }
+    }
+    // Deepest first would be better balanced, but the order is free
+    reverse(todo.begin(), todo.end());
+
+    bool cancelling = false;
+    int busy = 0;
+    auto dispatch = [&](Worker& w) {
+        if (cancelling || todo.empty()) {
+            return;
+        }
+        w.shard = todo.back();
+        todo.pop_back();
+        ++busy;
+        ++shardsRun;
+        char head[64];
+        snprintf(head, sizeof(head), "shard %u %d %d ", job, w.shard, bound);
+        sendLine(w.fd, head + string(facelets) + " "
+                 + MyCubieCube::formatMoves(shards[w.shard].data(),
+                                            shards[w.shard].size()) + "\n");
+    };
+    for (Worker& w : workers) {
+        dispatch(w);
+    }
+
+    vector<pollfd> fds(workers.size());
+    while (busy > 0) {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            fds[i] = { workers[i].fd, POLLIN, 0 };
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+            return false;
+        }
+        for (size_t i = 0; i < workers.size(); ++i) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            Worker& w = workers[i];
+            string line;
+            if (!readLine(w.fd, w.in, line)) {
+                printf("worker %d died\n", int(w.pid));
+                return false;
+            }
+            unsigned lineJob;
+            int shard;
+            char kind[16];
+            unsigned long long nodes;
+            int consumed = 0;
+            if (sscanf(line.c_str(), "result %u %d %15s %llu %n", &lineJob,
+                       &shard, kind, &nodes, &consumed) < 4
+             || lineJob != job || shard != w.shard) {
+                continue;
+            }
+            totalNodes += nodes;
+            w.shard = -1;
+            --busy;
+            if (!strcmp(kind, "found")) {
+                if (solution.empty()) {
+                    MyCubieCube::parseMoves(line.c_str() + consumed,
+                                            solution);
+                }
+                // Optimal: the rest can stop
+                if (!cancelling) {
+                    cancelling = true;
+                    for (Worker& other : workers) {
+                        if (other.shard >= 0) {
+                            sendLine(other.fd, "cancel " + to_string(job)
+                                     + "\n");
+                        }
+                    }
+                }
+            }
+            else if (!strcmp(kind, "none")) {
+                const int next = atoi(line.c_str() + consumed);
+                shardBound[shard] = next;
+                nextBound = min(nextBound, next);
+            }
+            else {
+                ++shardsCancelled;
+            }
+            dispatch(w);
+        }
+    }
+    return true;
+}
+
+int runWorker(const MyOptions& options)
+{
+    sockaddr_un addr;
+    if (!socketAddress(options.socketPath, addr)) {
+        return 1;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const sockaddr *) &addr, sizeof(addr)) != 0) {
+        printf("Could not connect to %s\n", options.socketPath);
+        return 1;
+    }
+    MyTwoPhaseTables tables;
+    MyPdbSet pdbs;
+    MyEndgameTable endgame;
+    tables.load(options.tables);
+    if (!pdbs.load(options.pdbDir, options.memory, tables, 1)
+     || !loadEndgame(options, 1, endgame)) {
+        close(fd);
+        return 1;
+    }
+    MyOptimalSearch search(tables, pdbs, endgameFor(options, endgame));
+    sendLine(fd, "ready " + to_string(getpid()) + "\n");
+
+    string in;
+    string line;
+    vector<int> prefix;
+    vector<int> solution;
+    for (;;) {
+        if (!readLine(fd, in, line) || line == "quit") {
+            break;
+        }
+        unsigned job;
+        int shard;
+        int bound;
+        char facelets[64];
+        int consumed = 0;
+        MyCubieCube cube;
+        prefix.clear();
+        if (sscanf(line.c_str(), "shard %u %d %d %63s %n", &job, &shard,
+                   &bound, facelets, &consumed) < 4
+         || !cube.fromFacelets(facelets)
+         || !MyCubieCube::parseMoves(line.c_str() + consumed, prefix)) {
+            continue;
+        }
+
+        // Polled from within the search: a cancel for this job stops it,
+        // anything else waits its turn
+        const string cancelLine = "cancel " + to_string(job);
+        const function<bool()> cancelled = [&] {
+            pollfd p = { fd, POLLIN, 0 };
+            while (::poll(&p, 1, 0) > 0) {
+                char buf[4096];
+                const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    return true;
+                }
+                in.append(buf, n);
+            }
+            return in.find(cancelLine + "\n") != string::npos;
+        };
+
+        int nextBound = INT_MAX;
+        search.nodes = 0;
+        const MyOptimalSearch::Result r = search.search(
+            cube, prefix, bound, cancelled, solution, nextBound);
+        string reply = "result " + to_string(job) + " " + to_string(shard);
+        switch (r) {
+          case MyOptimalSearch::FOUND:
+            reply += " found " + to_string(search.nodes) + " "
+                   + MyCubieCube::formatMoves(solution.data(),
+                                              solution.size());
+            break;
+          case MyOptimalSearch::EXHAUSTED:
+            reply += " none " + to_string(search.nodes) + " "
+                   + to_string(nextBound);
+            break;
+          case MyOptimalSearch::CANCELLED:
+            reply += " cancelled " + to_string(search.nodes);
+            break;
+        }
+        if (!sendLine(fd, reply + "\n")) {
+            break;
+        }
+        // A cancel that came too late is of no use any more
+        size_t pos;
+        while ((pos = in.find(cancelLine + "\n")) != string::npos) {
+            in.erase(pos, cancelLine.size() + 1);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+// IDA* in this process, one thread: the search itself, without the
+// sharding around it
+int runBench(const MyOptions& options)
+{
+    MyTwoPhaseTables tables;
+    MyPdbSet pdbs;
+    tables.load(options.tables, max(1u, thread::hardware_concurrency()));
+    MyEndgameTable endgame;
+    if (!loadPdbs(options, tables, pdbs)
+     || !loadEndgame(options, max(1u, thread::hardware_concurrency()),
+                     endgame)) {
+        return 1;
+    }
+    MyOptimalSearch search(tables, pdbs, endgameFor(options, endgame));
+    const function<bool()> never = [] { return false; };
+    MyRandom random(options.seed);
+    unsigned long long totalNodes = 0;
+    double totalSeconds = 0.0;
+    int totalMoves = 0;
+    for (int i = 0; i < options.bench; ++i) {
+        vector<int> scramble(options.benchLength);
+        MyScrambler::randomMoves(random, scramble.data(), scramble.size());
+        MyCubieCube cube;
+        cube.moves(scramble);
+
+        const Clock::time_point t = Clock::now();
+        search.nodes = 0;
+        vector<int> solution;
+        int bound = search.heuristic(search.coords(cube));
+        while (bound < INT_MAX) {
+            int nextBound = INT_MAX;
+            if (search.search(cube, vector<int>(), bound, never, solution,
+                              nextBound) == MyOptimalSearch::FOUND) {
+                break;
+            }
+            bound = max(bound + 1, nextBound);
+        }
+        const double seconds = secondsSince(t);
+        MyCubieCube check = cube;
+        check.moves(solution);
+        printf("%2zu moves%s, %.2fs, %llu nodes, %.1fM nodes/s\n",
+               solution.size(), check.isSolved() ? "" : " (WRONG)", seconds,
+               search.nodes, search.nodes / max(seconds, 1e-9) / 1e6);
+        totalNodes += search.nodes;
+        totalSeconds += seconds;
+        totalMoves += solution.size();
+    }
+    printf("bench: %d cubes of %d moves, %.2f moves avg, %.2fs, %llu nodes,"
+           " %.1fM nodes/s\n", options.bench, options.benchLength,
+           totalMoves / double(max(1, options.bench)), totalSeconds,
+           totalNodes, totalNodes / max(totalSeconds, 1e-9) / 1e6);
+    return 0;
+}
+
+void usage(const char *prog)
+{
+    printf("usage: %s [options] [\"scramble\"...]\n"
+           "  --file FILE       scrambles, one per line\n"
+           "  --workers N       worker processes (cores)\n"
+           "  --prefix N        moves per shard prefix, 1 to 5 (3)\n"
+           "  --socket PATH     coordinator socket (/tmp/cubeoptimal.sock)\n"
+           "  --tables FILE     two-phase tables (twophase.tables)\n"
+           "  --pdb-dir DIR     pattern database files (.)\n"
+           "  --memory SIZE     table memory budget, e.g. 64M, 1G, 8G (1G)\n"
+           "  --endgame-depth D table of the cubes within D moves (none)\n"
+           "  --bench N         solve N random cubes in this process\n"
+           "  --bench-length N  bench: random moves per cube (14)\n"
+           "  --seed N          bench: random cubes seed (1)\n",
+           prog);
+}
+}
+
+int main(int argc, char **argv)
+{
+    MyOptions opts;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasArg = i + 1 < argc;
+        if (!strcmp(argv[i], "--worker")) {
+            opts.worker = true;
+        }
+        else if (!strcmp(argv[i], "--file") && hasArg) {
+            opts.file = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--workers") && hasArg) {
+            opts.workers = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--prefix") && hasArg) {
+            opts.prefixLength = atoi(argv[++i]);
+            if (opts.prefixLength < 1
+             || opts.prefixLength > MyOptions::maxPrefixLength) {
+                printf("--prefix must be 1 to %d\n",
+                       MyOptions::maxPrefixLength);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--socket") && hasArg) {
+            opts.socketPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--tables") && hasArg) {
+            opts.tables = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--pdb-dir") && hasArg) {
+            opts.pdbDir = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--memory") && hasArg) {
+            if (!parseSize(argv[++i], opts.memory)) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--endgame-depth") && hasArg) {
+            opts.endgameDepth = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--bench") && hasArg) {
+            opts.bench = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--bench-length") && hasArg) {
+            opts.benchLength = max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--seed") && hasArg) {
+            opts.seed = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (argv[i][0] != '-') {
+            opts.scrambles.push_back(argv[i]);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opts.worker) {
+        return runWorker(opts);
+    }
+    if (opts.bench > 0) {
+        return runBench(opts);
+    }
+
+    if (opts.file) {
+        FILE *f = fopen(opts.file, "r");
+        if (!f) {
+            printf("Could not open %s\n", opts.file);
+            return 1;
+        }
+        char line[1024];
+        while (fgets(line, sizeof(line), f)) {
+            if (strspn(line, " \t\r\n") != strlen(line)) {
+                line[strcspn(line, "\r\n")] = '\0';
+                opts.scrambles.push_back(line);
+            }
+        }
+        fclose(f);
+    }
+    if (opts.scrambles.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    MyCoordinator coordinator(opts);
+    if (!coordinator.start(argv[0])) {
+        coordinator.stop();
+        return 1;
+    }
+    const Clock::time_point start = Clock::now();
+    int failures = 0;
+    for (const string& s : opts.scrambles) {
+        vector<int> moves;
+        if (!MyCubieCube::parseMoves(s.c_str(), moves)) {
+            printf("invalid scramble: %s\n", s.c_str());
+            ++failures;
+            continue;
+        }
+        MyCubieCube cube;
+        cube.moves(moves);
+        const Clock::time_point t = Clock::now();
+        const unsigned long long nodes = coordinator.totalNodes;
+        vector<int> solution;
+        if (!coordinator.solve(cube, solution)) {
+            ++failures;
+            break;
+        }
+        const double seconds = secondsSince(t);
+        printf("%zu moves: %s  (%.2fs, %.1fM nodes/s)\n", solution.size(),
+               MyCubieCube::formatMoves(solution.data(),
+                                        solution.size()).c_str(), seconds,
+               (coordinator.totalNodes - nodes) / max(seconds, 1e-9) / 1e6);
+    }
+    const double seconds = secondsSince(start);
+    printf("%.2fs, %llu nodes, %.1fM nodes/s; shards: %llu searched, "
+           "%llu skipped on bounds, %llu cancelled\n", seconds,
+           coordinator.totalNodes,
+           coordinator.totalNodes / max(seconds, 1e-9) / 1e6,
+           coordinator.shardsRun, coordinator.shardsSkipped,
+           coordinator.shardsCancelled);
+    coordinator.stop();
+    return failures ? 1 : 0;
+}
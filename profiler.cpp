@@ -0,0 +1,358 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+namespace {
+// 3x5 glyphs for the overlay numbers, one row of 3 bits per entry, top first
+constexpr unsigned char digitFont[11][5] = {
+    { 7, 5, 5, 5, 7 }, // 0
+    { 2, 6, 2, 2, 7 }, // 1
+    { 7, 1, 7, 4, 7 }, // 2
+    { 7, 1, 7, 1, 7 }, // 3
+    { 5, 5, 7, 1, 1 }, // 4
+    { 7, 4, 7, 1, 7 }, // 5
+    { 7, 4, 7, 5, 7 }, // 6
+    { 7, 1, 1, 1, 1 }, // 7
+    { 7, 5, 7, 5, 7 }, // 8
+    { 7, 5, 7, 1, 7 }, // 9
+    { 0, 0, 0, 0, 2 }  // .
+};
+
+constexpr MyPoint sectionColors[MyProfiler::NUM_SECTIONS] = {
+    { 0.10f, 0.10f, 0.10f }, // shadow
+    { 0.20f, 0.45f, 0.90f }, // ground
+    { 0.90f, 0.40f, 0.10f }, // cube
+    { 0.60f, 0.20f, 0.70f }, // debug quad
+    { 0.30f, 0.75f, 0.30f }, // post process
+    { 0.10f, 0.60f, 0.60f }, // animation
+    { 0.55f, 0.55f, 0.10f }, // uniforms
+    { 0.85f, 0.85f, 0.85f }  // frame
+};
+
+struct QuadWriter {
+    MyPoint *vertices;
+    MyPoint *colors;
+    int maxVertices;
+    int count;
+    float w;
+    float h;
+
+    // Pixel coordinates, origin at the top left of the viewport
+    void quad(float x, float y, float qw, float qh, const MyPoint& c)
+    {
+        if (count + 6 > maxVertices) {
+            return;
+        }
+        const float x0 = -1.0f + 2.0f * x / w;
+        const float x1 = -1.0f + 2.0f * (x + qw) / w;
+        const float y0 = 1.0f - 2.0f * y / h;
+        const float y1 = 1.0f - 2.0f * (y + qh) / h;
+        const MyPoint p[6] = {
+            { x0, y1, 0.0f }, { x1, y1, 0.0f }, { x0, y0, 0.0f },
+            { x0, y0, 0.0f }, { x1, y1, 0.0f }, { x1, y0, 0.0f }
+        };
+        for (int i = 0; i < 6; ++i) {
+            vertices[count] = p[i];
+            colors[count] = c;
+            ++count;
+        }
+    }
+
+    // Returns the x coordinate after the text
+    float text(float x, float y, const char *str, float px, const MyPoint& c)
+    {
+        for (; *str; ++str) {
+            int glyph = -1;
+            if (*str >= '0' && *str <= '9') {
+                glyph = *str - '0';
+            }
+            else if (*str == '.') {
+                glyph = 10;
+            }
+            if (glyph >= 0) {
+                for (int row = 0; row < 5; ++row) {
+                    for (int col = 0; col < 3; ++col) {
+                        if (digitFont[glyph][row] & (4 >> col)) {
+                            quad(x + col * px, y + row * px, px, px, c);
+                        }
+                    }
+                }
+            }
+            x += 4 * px;
+        }
+        return x;
+    }
+};
+}
+
+const char *MyProfiler::sectionName(int section)
+{
+    switch (section) {
+      case SHADOW_PASS: return "shadow_pass";
+      case GROUND_DRAW: return "ground_draw";
+      case CUBE_DRAW: return "cube_draw";
+      case DEBUG_QUAD_DRAW: return "debug_quad_draw";
+      case POST_PROCESS: return "post_process";
+      case ANIMATION_UPDATE: return "animation_update";
+      case UNIFORM_UPLOAD: return "uniform_upload";
+      case FRAME_CPU: return "frame_cpu";
+    }
+    return "unknown";
+}
+
+void MyProfiler::initialize()
+{
+    for (int i = 0; i < numQuerySets; ++i) {
+        glGenQueries(numGpuSections, queries[i]);
+        queryFrame[i] = 0;
+        for (int j = 0; j < numGpuSections; ++j) {
+            queryIssued[i][j] = false;
+        }
+    }
+    for (int i = 0; i < historySize; ++i) {
+        for (int j = 0; j < NUM_SECTIONS; ++j) {
+            history[i][j] = -1.0f;
+        }
+    }
+    frame = 0;
+    droppedQueries = 0;
+    initialized = true;
+}
+
+void MyProfiler::shutdown()
+{
+    if (!initialized) {
+        return;
+    }
+    for (int i = 0; i < numQuerySets; ++i) {
+        glDeleteQueries(numGpuSections, queries[i]);
+    }
+    initialized = false;
+}
+
+void MyProfiler::collect(int querySet)
+{
+    const unsigned long long issuedFrame = queryFrame[querySet];
+    const bool inHistory = frame - issuedFrame < historySize;
+    for (int s = 0; s < numGpuSections; ++s) {
+        if (!queryIssued[querySet][s]) {
+            continue;
+        }
+        queryIssued[querySet][s] = false;
+
+        GLint available = 0;
+        glGetQueryObjectiv(queries[querySet][s], GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+        if (!available) {
+            // Never wait for the GPU; the query object is simply reused
+            ++droppedQueries;
+            continue;
+        }
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(queries[querySet][s], GL_QUERY_RESULT, &ns);
+        if (inHistory) {
+            history[issuedFrame % historySize][s] = float(ns) / 1.0e6f;
+        }
+    }
+}
+
+void MyProfiler::beginFrame()
+{
+    if (!initialized) {
+        return;
+    }
+    const int set = frame % numQuerySets;
+    collect(set);
+    queryFrame[set] = frame;
+
+    for (int s = 0; s < NUM_SECTIONS; ++s) {
+        history[frame % historySize][s] = -1.0f;
+    }
+    beginCpu(FRAME_CPU);
+}
+
+void MyProfiler::endFrame()
+{
+    if (!initialized) {
+        return;
+    }
+    endCpu(FRAME_CPU);
+    ++frame;
+}
+
+void MyProfiler::beginGpu(Section s)
+{
+    if (!initialized || activeGpu != -1) {
+        return;
+    }
+    const int set = frame % numQuerySets;
+    glBeginQuery(GL_TIME_ELAPSED, queries[set][s]);
+    queryIssued[set][s] = true;
+    activeGpu = s;
+}
+
+void MyProfiler::endGpu(Section s)
+{
+    if (!initialized || activeGpu != s) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    activeGpu = -1;
+}
+
+void MyProfiler::beginCpu(Section s)
+{
+    cpuStart[s] = chrono::steady_clock::now();
+}
+
+void MyProfiler::endCpu(Section s)
+{
+    if (!initialized) {
+        return;
+    }
+    const chrono::duration<float, milli> d =
+                                chrono::steady_clock::now() - cpuStart[s];
+    float& slot = history[frame % historySize][s];
+    // A section may run several times per frame, accumulate
+    slot = (slot < 0.0f ? 0.0f : slot) + d.count();
+}
+
+float MyProfiler::sample(unsigned long long f, int section) const
+{
+    if (f >= frame || frame - f >= historySize) {
+        return -1.0f;
+    }
+    return history[f % historySize][section];
+}
+
+MyProfiler::Percentiles MyProfiler::percentiles(int section) const
+{
+    float samples[historySize];
+    int n = 0;
+    for (int i = 0; i < historySize; ++i) {
+        if (history[i][section] >= 0.0f) {
+            samples[n++] = history[i][section];
+        }
+    }
+
+    Percentiles ret;
+    ret.count = n;
+    if (n == 0) {
+        return ret;
+    }
+    sort(samples, samples + n);
+    auto rank = [&](float p) {
+        int idx = int(ceilf(p * n)) - 1;
+        return samples[max(0, min(n - 1, idx))];
+    };
+    ret.p50 = rank(0.50f);
+    ret.p95 = rank(0.95f);
+    ret.p99 = rank(0.99f);
+    return ret;
+}
+
+int MyProfiler::buildOverlay(MyPoint *vertices, MyPoint *colors,
+                             int maxVertices,
+                             int viewportWidth, int viewportHeight) const
+{
+    QuadWriter out{vertices, colors, maxVertices, 0,
+                   float(viewportWidth), float(viewportHeight)};
+
+    Percentiles p[NUM_SECTIONS];
+    // Bars are scaled to a 60Hz frame, or to the slowest p99 if larger
+    float scaleMs = 1000.0f / 60.0f;
+    for (int s = 0; s < NUM_SECTIONS; ++s) {
+        p[s] = percentiles(s);
+        scaleMs = max(scaleMs, p[s].p99);
+    }
+
+    constexpr float x0 = 10.0f;
+    constexpr float y0 = 10.0f;
+    constexpr float rowHeight = 16.0f;
+    constexpr float barWidth = 200.0f;
+    constexpr float px = 2.0f;
+    const MyPoint background(0.0f, 0.0f, 0.0f);
+    const MyPoint p50Color(0.2f, 0.8f, 0.2f);
+    const MyPoint p95Color(0.95f, 0.85f, 0.1f);
+    const MyPoint p99Color(0.95f, 0.15f, 0.15f);
+
+    for (int s = 0; s < NUM_SECTIONS; ++s) {
+        const float y = y0 + s * rowHeight;
+        out.quad(x0, y, 12.0f, 12.0f, sectionColors[s]);
+        out.quad(x0 + 16.0f, y, barWidth, 12.0f, background);
+        const float x = x0 + 16.0f;
+        out.quad(x, y + 2.0f, barWidth * p[s].p50 / scaleMs, 8.0f, p50Color);
+        out.quad(x + barWidth * p[s].p95 / scaleMs, y, 2.0f, 12.0f,
+                 p95Color);
+        out.quad(x + barWidth * p[s].p99 / scaleMs, y, 2.0f, 12.0f,
+                 p99Color);
+
+        char buf[16];
+        float tx = x + barWidth + 8.0f;
+        snprintf(buf, sizeof(buf), "%.2f", p[s].p50);
+        tx = out.text(tx, y + 1.0f, buf, px, p50Color) + 3 * px;
+        snprintf(buf, sizeof(buf), "%.2f", p[s].p95);
+        tx = out.text(tx, y + 1.0f, buf, px, p95Color) + 3 * px;
+        snprintf(buf, sizeof(buf), "%.2f", p[s].p99);
+        out.text(tx, y + 1.0f, buf, px, p99Color);
+    }
+    return out.count;
+}
+
+bool MyProfiler::dumpCsv(const char *filename) const
+{
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        printf("Could not open %s\n", filename);
+        return false;
+    }
+    fprintf(f, "frame");
+    for (int s = 0; s < NUM_SECTIONS; ++s) {
+        fprintf(f, ",%s_ms", sectionName(s));
+    }
+    fprintf(f, "\n");
+
+    const unsigned long long first = frame > historySize
+                                   ? frame - historySize : 0;
+    for (unsigned long long i = first; i < frame; ++i) {
+        fprintf(f, "%llu", i);
+        for (int s = 0; s < NUM_SECTIONS; ++s) {
+            const float v = history[i % historySize][s];
+            if (v >= 0.0f) {
+                fprintf(f, ",%.4f", v);
+            }
+            else {
+                fprintf(f, ",");
+            }
+        }
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    return true;
+}
+
+bool MyProfiler::dumpJson(const char *filename) const
+{
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        printf("Could not open %s\n", filename);
+        return false;
+    }
+    fprintf(f, "{\n  \"frames\": %llu,\n  \"dropped_queries\": %llu,\n"
+               "  \"sections\": {\n", frame, droppedQueries);
+    for (int s = 0; s < NUM_SECTIONS; ++s) {
+        const Percentiles p = percentiles(s);
+        fprintf(f, "    \"%s\": { \"gpu\": %s, \"samples\": %d, "
+                   "\"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f }%s\n",
+                sectionName(s), s < numGpuSections ? "true" : "false",
+                p.count, p.p50, p.p95, p.p99,
+                s + 1 < NUM_SECTIONS ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+    fclose(f);
+    return true;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+
+#include "glutil.h"
+#include "cube.h"
+
+// Per-pass frame profiler. GPU passes are timed with GL_TIME_ELAPSED
+// queries, CPU phases with a steady clock. Query sets are double-buffered:
+// results for frame k are only read back while frame k+2 is being issued
+// and only if available, so the profiler never stalls the pipeline.
+struct MyProfiler {
+    enum Section {
+        // GPU sections
+        SHADOW_PASS = 0,
+        GROUND_DRAW,
+        CUBE_DRAW,
+        DEBUG_QUAD_DRAW,
+        POST_PROCESS,
+        // CPU sections
+        ANIMATION_UPDATE,
+        UNIFORM_UPLOAD,
+        FRAME_CPU,
+        NUM_SECTIONS
+    };
+    constexpr static int numGpuSections = POST_PROCESS + 1;
+    constexpr static int numQuerySets = 2;
+    constexpr static int historySize = 256;
+
+    static const char *sectionName(int section);
+
+    struct Percentiles {
+        float p50 = 0.0f;
+        float p95 = 0.0f;
+        float p99 = 0.0f;
+        int count = 0;
+    };
+
+    // Must be called once a GL context is current
+    void initialize();
+    void shutdown();
+
+    void beginFrame();
+    void endFrame();
+
+    void beginGpu(Section s);
+    void endGpu(Section s);
+
+    void beginCpu(Section s);
+    void endCpu(Section s);
+
+    Percentiles percentiles(int section) const;
+    // Milliseconds section took in frame, negative if not recorded. GPU
+    // times come numQuerySets frames late.
+    float sample(unsigned long long frame, int section) const;
+
+    // Overlay geometry: two triangles per quad, in NDC. Returns the number
+    // of vertices written.
+    int buildOverlay(MyPoint *vertices, MyPoint *colors, int maxVertices,
+                     int viewportWidth, int viewportHeight) const;
+
+    bool dumpCsv(const char *filename) const;
+    bool dumpJson(const char *filename) const;
+
+    unsigned long long frameCount() const { return frame; }
+
+  private:
+    void collect(int querySet);
+
+    GLuint queries[numQuerySets][numGpuSections];
+    unsigned long long queryFrame[numQuerySets];
+    bool queryIssued[numQuerySets][numGpuSections];
+    int activeGpu = -1;
+
+    std::chrono::steady_clock::time_point cpuStart[NUM_SECTIONS];
+
+    // Milliseconds, negative when no sample was recorded for that frame
+    float history[historySize][NUM_SECTIONS];
+    unsigned long long frame = 0;
+    unsigned long long droppedQueries = 0;
+    bool initialized = false;
+};
+
+// RAII helpers for the CPU and GPU sections
+struct MyCpuSection {
+    MyProfiler& prof;
+    MyProfiler::Section section;
+    MyCpuSection(MyProfiler& p, MyProfiler::Section s) : prof(p), section(s)
+    {
+        prof.beginCpu(section);
+    }
+    ~MyCpuSection() { prof.endCpu(section); }
+};
+
+struct MyGpuSection {
+    MyProfiler& prof;
+    MyProfiler::Section section;
+    MyGpuSection(MyProfiler& p, MyProfiler::Section s) : prof(p), section(s)
+    {
+        prof.beginGpu(section);
+    }
+    ~MyGpuSection() { prof.endGpu(section); }
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Calls fn(begin, end) over [0, n) in chunks, from threads threads; the
+// calling thread is one of them
+template<typename Fn>
+void parallelFor(size_t n, size_t chunk, int threads, Fn fn)
+{
+    std::atomic<size_t> nextChunk{0};
+    auto work = [&]() {
+        for (;;) {
+            const size_t begin = nextChunk.fetch_add(chunk);
+            if (begin >= n) {
+                return;
+            }
+            fn(begin, std::min(n, begin + chunk));
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; ++i) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+}
+
+// Pruning tables of bits-bit entries packed in bytes, the first entry in
+// the low bits, unknown until found. Bytes are only read and written
+// atomically, so a table can be searched while it is being built. With
+// modulus set, entries hold the distance modulo modulus: a neighbor's
+// distance tells which of the distances one apart it is.
+template<int bits, int modulus>
+struct MyPackedEntries {
+    static constexpr int perByte = 8 / bits;
+    static constexpr int mask = (1 << bits) - 1;
+    static constexpr int unknown = mask;
+
+    static constexpr size_t bytes(size_t size)
+    {
+        return (size + perByte - 1) / perByte;
+    }
+    // What an entry at distance depth holds, false if it does not fit
+    static bool encode(int depth, int& value)
+    {
+        value = modulus ? depth % modulus : depth;
+        return value < unknown;
+    }
+
+    static int get(const uint8_t *table, size_t i)
+    {
+        const uint8_t b = __atomic_load_n(table + i / perByte,
+                                          __ATOMIC_RELAXED);
+        return (b >> (i % perByte) * bits) & mask;
+    }
+    // Sets entry i to v if it is still unknown, true if this call did
+    static bool set(uint8_t *table, size_t i, int v)
+    {
+        uint8_t *p = table + i / perByte;
+        const int shift = (i % perByte) * bits;
+        uint8_t b = __atomic_load_n(p, __ATOMIC_RELAXED);
+        for (;;) {
+            if (((b >> shift) & mask) != unknown) {
+                return false;
+            }
+            const uint8_t set = (b & ~(mask << shift)) | (v << shift);
+            if (__atomic_compare_exchange_n(p, &b, set, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                return true;
+            }
+        }
+    }
+};
+
+// The distance itself, up to 14
+typedef MyPackedEntries<4, 0> MyNibbles;
+// The distance mod 3, for tables too large for nibbles
+typedef MyPackedEntries<2, 3> MyMod3Entries;
+
+// How far buildPackedPruneTable is, for other threads to watch
+struct MyPruneProgress {
+    std::atomic<size_t> filled{0};
+    // Every entry closer than this is in the table: a lower bound of the
+    // entries still unknown. Stored with release once the level is done.
+    std::atomic<int> known{0};
+};
+
+// Breadth first search from the solved index 0, filling table with the
+// distances. next(i, m) is the index reached from i by move m, of the n
+// moves in moves. Once half the table is filled, each level is found
+// backwards instead, from the entries still unknown: far fewer lookups,
+// and the moves must be closed under inverse for that to hold. Each level
+// is split over threads threads. table must be all unknown. Stops early,
+// returning false, once stop is set.
+//
+// Distances mod 3 work the same: a level's entries also match the
+// levels 3, 6, ... before, whose neighbors are all known already, and an
+// unknown entry cannot neighbor them.
+template<typename Entries, typename Next>
+bool buildPackedPruneTable(uint8_t *table, size_t size, const int *moves,
+                           int n, int threads, MyPruneProgress& progress,
+                           const std::atomic<bool>& stop, Next next)
+{
+    constexpr size_t chunk = 1 << 14;
+    Entries::set(table, 0, 0);
+    progress.filled = 1;
+    progress.known.store(1, std::memory_order_release);
+    for (int depth = 0; progress.filled < size; ++depth) {
+        int current;
+        int found;
+        Entries::encode(depth, current);
+        if (!Entries::encode(depth + 1, found)) {
+            return false;
+        }
+        const bool backwards = progress.filled > size / 2;
+        parallelFor(size, chunk, threads, [&](size_t begin, size_t end) {
+            if (stop.load(std::memory_order_relaxed)) {
+                return;
+            }
+            size_t count = 0;
+            for (size_t i = begin; i < end; ++i) {
+                if (backwards) {
+                    if (Entries::get(table, i) != Entries::unknown) {
+                        continue;
+                    }
+                    for (int k = 0; k < n; ++k) {
+                        if (Entries::get(table, next(i, moves[k]))
+                         == current) {
+                            count += Entries::set(table, i, found);
+                            break;
+                        }
+                    }
+                    continue;
+                }
+                if (Entries::get(table, i) != current) {
+                    continue;
+                }
+                for (int k = 0; k < n; ++k) {
+                    count += Entries::set(table, next(i, moves[k]), found);
+                }
+            }
+            progress.filled += count;
+        });
+        if (stop) {
+            return false;
+        }
+        progress.known.store(depth + 2, std::memory_order_release);
+    }
+    return true;
+}
@@ -0,0 +1,190 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+int viewRotation(const char *s)
+{
+    if (!s) {
+        return -1;
+    }
+    if (!strcmp(s, "up")) {
+        return MySimulation::VIEW_UP;
+    }
+    if (!strcmp(s, "down")) {
+        return MySimulation::VIEW_DOWN;
+    }
+    if (!strcmp(s, "left")) {
+        return MySimulation::VIEW_LEFT;
+    }
+    if (!strcmp(s, "right")) {
+        return MySimulation::VIEW_RIGHT;
+    }
+    return -1;
+}
+
+int cameraMove(const char *s)
+{
+    if (!s) {
+        return -1;
+    }
+    if (!strcmp(s, "up")) {
+        return MySimulation::CAMERA_UP;
+    }
+    if (!strcmp(s, "down")) {
+        return MySimulation::CAMERA_DOWN;
+    }
+    if (!strcmp(s, "left")) {
+        return MySimulation::CAMERA_LEFT;
+    }
+    if (!strcmp(s, "right")) {
+        return MySimulation::CAMERA_RIGHT;
+    }
+    return -1;
+}
+}
+
+bool MyReplay::load(const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        printf("Could not open %s\n", filename);
+        return false;
+    }
+    events.clear();
+    next = 0;
+
+    char line[4096];
+    int lineNo = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), f)) {
+        ++lineNo;
+        if (char *comment = strchr(line, '#')) {
+            *comment = '\0';
+        }
+        if (strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+        Event e;
+        if (!parse(line, e)) {
+            printf("%s:%d: invalid event\n", filename, lineNo);
+            ok = false;
+            break;
+        }
+        events.push_back(e);
+    }
+    fclose(f);
+    if (!ok) {
+        events.clear();
+        return false;
+    }
+    std::stable_sort(events.begin(), events.end(),
+                     [](const Event& a, const Event& b) {
+                         return a.time < b.time;
+                     });
+    return true;
+}
+
+bool MyReplay::parse(char *line, Event& e) const
+{
+    constexpr const char *sep = " \t\r\n";
+    char *end;
+    e.time = strtod(line, &end);
+    if (end == line || e.time < 0.0) {
+        return false;
+    }
+    const char *type = strtok(end, sep);
+    if (!type) {
+        return false;
+    }
+    const char *arg = strtok(nullptr, sep);
+    e.direction = -1;
+    if (!strcmp(type, "turn")) {
+        e.type = TURN;
+        // The rest of the line
+        for (; arg; arg = strtok(nullptr, sep)) {
+            for (const char *c = arg; *c; ++c) {
+                if (!strchr("UFRLDB'2", *c)) {
+                    return false;
+                }
+            }
+            e.moves += arg;
+            e.moves += ' ';
+        }
+        return !e.moves.empty();
+    }
+    if (!strcmp(type, "view")) {
+        if (arg && !strcmp(arg, "release")) {
+            e.type = VIEW_RELEASE;
+            return true;
+        }
+        e.direction = viewRotation(arg);
+        const char *hold = strtok(nullptr, sep);
+        if (hold && strcmp(hold, "hold")) {
+            return false;
+        }
+        e.type = hold ? VIEW_HOLD : VIEW;
+        return e.direction >= 0;
+    }
+    if (!strcmp(type, "camera")) {
+        e.direction = cameraMove(arg);
+        const char *action = strtok(nullptr, sep);
+        if (!action) {
+            return false;
+        }
+        if (!strcmp(action, "press")) {
+            e.type = CAMERA_PRESS;
+        }
+        else if (!strcmp(action, "release")) {
+            e.type = CAMERA_RELEASE;
+        }
+        else {
+            return false;
+        }
+        return e.direction >= 0;
+    }
+    if (!strcmp(type, "reset")) {
+        e.type = RESET;
+        return true;
+    }
+    return false;
+}
+
+void MyReplay::apply(MySimulation& sim, double t)
+{
+    for (; next < events.size() && events[next].time <= t; ++next) {
+        const Event& e = events[next];
+        switch (e.type) {
+          case TURN:
+            sim.queueMoves(e.moves.c_str());
+            break;
+          case VIEW:
+            sim.rotateView(MySimulation::ViewRotation(e.direction));
+            break;
+          case VIEW_HOLD:
+            sim.heldViewRotation = e.direction;
+            sim.rotateView(MySimulation::ViewRotation(e.direction));
+            break;
+          case VIEW_RELEASE:
+            sim.heldViewRotation = -1;
+            break;
+          case CAMERA_PRESS:
+            sim.cameraKey(MySimulation::CameraMove(e.direction), true);
+            break;
+          case CAMERA_RELEASE:
+            sim.cameraKey(MySimulation::CameraMove(e.direction), false);
+            break;
+          case RESET:
+            sim.resetView();
+            break;
+        }
+    }
+}
+
+double MyReplay::duration() const
+{
+    return events.empty() ? 0.0 : events.back().time;
+}
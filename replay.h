@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "simulation.h"
+
+// Timestamped input for MySimulation, read from a text file, so that a
+// benchmark feeds every build the same workload. One event per line, the
+// time in simulated seconds first, '#' starts a comment:
+//
+//   0.0  turn R U R' U2       turns in the usual notation
+//   1.0  view left            one 22.5 degree view rotation (up, down,
+//                             left or right)
+//   1.5  view up hold         repeated until "view release"
+//   2.5  view release
+//   3.0  camera left press    camera move (up, down, left or right)
+//   3.5  camera left release
+//   4.0  reset                back to the initial view and camera
+struct MyReplay {
+    bool load(const char *filename);
+
+    // Applies the events up to time t, in file order for equal times
+    void apply(MySimulation& sim, double t);
+    bool done() const { return next == events.size(); }
+    size_t size() const { return events.size(); }
+    // Time of the last event
+    double duration() const;
+
+  private:
+    enum Type {
+        TURN,
+        VIEW,
+        VIEW_HOLD,
+        VIEW_RELEASE,
+        CAMERA_PRESS,
+        CAMERA_RELEASE,
+        RESET
+    };
+    struct Event {
+        double time;
+        Type type;
+        // The ViewRotation or CameraMove
+        int direction;
+        std::string moves;
+    };
+    bool parse(char *line, Event& e) const;
+
+    std::vector<Event> events;
+    size_t next = 0;
+};
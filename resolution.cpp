@@ -0,0 +1,41 @@
+#include "resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+// Weight of a new measurement in the smoothed costs
+constexpr float smoothing = 0.2f;
+// Measurements ignored at first, slowed down by shader compiles and the
+// like
+constexpr int warmupFrames = 3;
+// Share of the budget aimed for, the rest absorbs the noise
+constexpr float headroom = 0.9f;
+// Largest increase of the scale per frame: drops follow the smoothed cost
+// at once, but growing back is slow so that the scale doesn't oscillate
+constexpr float maxGrowth = 0.01f;
+}
+
+void MyResolutionScaler::update(float frameMs, float frameScale)
+{
+    if (budgetMs <= 0.0f || frameScale <= 0.0f) {
+        return;
+    }
+    if (measured++ < warmupFrames) {
+        return;
+    }
+    const float full = frameMs / (frameScale * frameScale);
+    if (fullCostMs < 0.0f) {
+        fullCostMs = full;
+    }
+    fullCostMs += smoothing * (full - fullCostMs);
+
+    // Settles where the measured frames take the aimed for time: below
+    // it the estimate of fullCostMs drops and the scale grows, above it
+    // the scale drops
+    float wanted = sqrt(budgetMs * headroom / fullCostMs);
+    wanted = min(wanted, current + maxGrowth);
+    current = max(minScale, min(1.0f, wanted));
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// Picks the scale of the scene's render target from the measured time of
+// whole frames, to hold a frame time budget. Only the scene passes shrink
+// with the scale, so each step is corrected from the next measurement
+// rather than taken from a model of which passes cost what. No GL: the
+// renderer hands it the times.
+struct MyResolutionScaler {
+    // Lowest scale of each axis, a quarter of the pixels
+    static constexpr float minScale = 0.5f;
+
+    // Milliseconds a frame may take, 0 keeps full resolution
+    float budgetMs = 0.0f;
+
+    float scale() const { return current; }
+    // The time from the start of a frame drawn at frameScale to the start
+    // of the next, GPU work, swap and all
+    void update(float frameMs, float frameScale);
+    // Back to full resolution, e.g. while nothing moves
+    void reset() { current = 1.0f; }
+
+  private:
+    float current = 1.0f;
+    int measured = 0;
+    // Smoothed time of a frame over the share of the pixels it drew,
+    // negative until measured. The passes that don't shrink make it
+    // grow as the scale drops, which the next steps correct for.
+    float fullCostMs = -1.0f;
+};
@@ -0,0 +1,101 @@
+#include "scramble.h"
+
+#include <utility>
+
+#include "prunetable.h"
+
+namespace {
+typedef MyCubieCube C;
+
+// Cubes or scrambles per task and generator
+constexpr size_t blockSize = 4096;
+
+uint64_t splitmix64(uint64_t& x)
+{
+    uint64_t z = x += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+MyRandom blockRandom(uint64_t seed, size_t block)
+{
+    return MyRandom(splitmix64(seed) + block);
+}
+
+// Fisher-Yates, true if the permutation is odd
+template<int n>
+bool shuffle(MyRandom& random, uint8_t *p)
+{
+    bool odd = false;
+    for (int i = n - 1; i > 0; --i) {
+        const int j = random.below(i + 1);
+        if (j != i) {
+            std::swap(p[i], p[j]);
+            odd = !odd;
+        }
+    }
+    return odd;
+}
+
+template<typename T>
+void randomSequence(MyRandom& random, T *moves, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        int m;
+        do {
+            m = random.below(C::numMoves);
+        } while (i > 0 && C::redundantAfter(m, moves[i - 1]));
+        moves[i] = m;
+    }
+}
+}
+
+MyRandom::MyRandom(uint64_t seed)
+{
+    for (uint64_t& x : s) {
+        x = splitmix64(seed);
+    }
+}
+
+MyCubieCube MyScrambler::randomCube(MyRandom& random)
+{
+    MyCubieCube cube;
+    const bool cornersOdd = shuffle<8>(random, cube.cp);
+    const bool edgesOdd = shuffle<12>(random, cube.ep);
+    // Swapping two edges pairs the odd permutations with the even ones,
+    // so the result stays uniform
+    if (cornersOdd != edgesOdd) {
+        std::swap(cube.ep[C::BL], cube.ep[C::BR]);
+    }
+    cube.setTwist(random.below(C::numTwists));
+    cube.setFlip(random.below(C::numFlips));
+    return cube;
+}
+
+void MyScrambler::randomMoves(MyRandom& random, int *moves, int n)
+{
+    randomSequence(random, moves, n);
+}
+
+void MyScrambler::randomCubes(uint64_t seed, MyCubieCube *cubes, size_t n,
+                              int threads)
+{
+    parallelFor(n, blockSize, threads, [=](size_t begin, size_t end) {
+        MyRandom random = blockRandom(seed, begin / blockSize);
+        for (size_t i = begin; i < end; ++i) {
+            cubes[i] = randomCube(random);
+        }
+    });
+}
+
+void MyScrambler::randomMoves(uint64_t seed, int length, uint8_t *moves,
+                              size_t n, int threads)
+{
+    parallelFor(n, blockSize, threads, [=](size_t begin, size_t end) {
+        MyRandom random = blockRandom(seed, begin / blockSize);
+        for (size_t i = begin; i < end; ++i) {
+            randomSequence(random, moves + i * length, length);
+        }
+    });
+}
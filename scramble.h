@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cubiecube.h"
+
+// xoshiro256**: small state, a few cycles per number, good enough for
+// anything but cryptography. Seeded through splitmix64, so nearby seeds
+// give unrelated streams.
+struct MyRandom {
+    explicit MyRandom(uint64_t seed = 1);
+
+    uint64_t next()
+    {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+    // Uniform in [0, n), n > 0: the high bits of a 64 by 32 bit product,
+    // with the few values that would favor some results redrawn
+    uint32_t below(uint32_t n)
+    {
+        uint64_t m = (next() >> 32) * n;
+        if (uint32_t(m) < n) {
+            const uint32_t threshold = -n % n;
+            while (uint32_t(m) < threshold) {
+                m = (next() >> 32) * n;
+            }
+        }
+        return uint32_t(m >> 32);
+    }
+
+  private:
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return x << k | x >> (64 - k);
+    }
+
+    uint64_t s[4];
+};
+
+// Scrambles for the benchmarks, the batch tools and the viewer: uniformly
+// random reachable cubes, or random move sequences. The bulk versions
+// split the work in blocks, each with its own generator seeded from seed
+// and the block, so the output only depends on seed, not on threads.
+struct MyScrambler {
+    // Every reachable cube equally likely: random corner and edge
+    // permutations of the same parity, random twist and flip, 7 corners
+    // and 11 edges free and the last set by the others
+    static MyCubieCube randomCube(MyRandom& random);
+    // n moves with no two in a row on one face, nor opposite faces in the
+    // order a search skips (see MyCubieCube::redundantAfter)
+    static void randomMoves(MyRandom& random, int *moves, int n);
+
+    static void randomCubes(uint64_t seed, MyCubieCube *cubes, size_t n,
+                            int threads);
+    // n scrambles of length moves each, one after the other in moves
+    static void randomMoves(uint64_t seed, int length, uint8_t *moves,
+                            size_t n, int threads);
+};
@@ -0,0 +1,330 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "trace.h"
+
+namespace {
+// Held camera keys move the camera by cameraMoveDistance every
+// cameraMoveTime
+constexpr double cameraMoveTime = 1.0 / 6.0;
+constexpr float cameraMoveDistance = 0.1f;
+constexpr int cameraMoveSteps = int(cameraMoveTime / MySimulation::dt
+                                    + 0.5);
+}
+
+MySimState MySimState::interpolate(const MySimState& a, const MySimState& b,
+                                   float alpha)
+{
+    if (a.cut != b.cut) {
+        return b;
+    }
+    MySimState ret = b;
+    for (int i = 0; i < 27; ++i) {
+        if (memcmp(&a.cubies[i], &b.cubies[i], sizeof(MyQuaternion))) {
+            ret.cubies[i] = MyQuaternion::slerp(a.cubies[i], b.cubies[i],
+                                                alpha);
+        }
+    }
+    if (memcmp(&a.cubeRot, &b.cubeRot, sizeof(MyQuaternion))) {
+        ret.cubeRot = MyQuaternion::slerp(a.cubeRot, b.cubeRot, alpha);
+    }
+    ret.eye = a.eye + (b.eye - a.eye) * alpha;
+    ret.eyeDir = a.eyeDir + (b.eyeDir - a.eyeDir) * alpha;
+    return ret;
+}
+
+void MySimulation::initialize()
+{
+    rubik.initialize();
+    resetView();
+}
+
+void MySimulation::step()
+{
+    TRACE_SCOPE("MySimulation::step");
+    ++tick;
+    const double now = time();
+
+    if (!inFaceRot && !inViewRot) {
+        startNextTurn();
+    }
+    if (inFaceRot) {
+        const float t = float((now - faceRotationStartTime)
+                              / faceRotationTime);
+        if (t >= 1.0f) {
+            inFaceRot = false;
+            rubik.endRot(faceRotation.rotType, faceRotation.inverse,
+                         faceRotation.turns);
+            TRACE_ASYNC_END("turn", faceRotation.traceId);
+            ++turnsDone;
+            startNextTurn();
+        }
+        else {
+            // snapshot() rotates the face
+            faceRotationT = t;
+        }
+    }
+    if (inViewRot) {
+        const float t = float((now - viewRotationStartTime)
+                              / viewRotationTime);
+        if (t >= 1.0f) {
+            inViewRot = false;
+            cubeRot = cubeRotEnd;
+            if (!startNextTurn() && heldViewRotation != -1) {
+                rotateView(ViewRotation(heldViewRotation));
+            }
+        }
+        else {
+            cubeRot = MyQuaternion::slerp(cubeRotStart, cubeRotEnd, t);
+        }
+    }
+    if (inCameraMove) {
+        constexpr float adjust = cameraMoveDistance / cameraMoveSteps;
+        switch (cameraMove) {
+          case CAMERA_LEFT: eye.x -= adjust; eyeDir.x -= adjust; break;
+          case CAMERA_RIGHT: eye.x += adjust; eyeDir.x += adjust; break;
+          case CAMERA_UP: eye.y += adjust; eyeDir.y += adjust; break;
+          case CAMERA_DOWN: eye.y -= adjust; eyeDir.y -= adjust; break;
+        }
+        if (++cameraMoveStep == cameraMoveSteps) {
+            if (cameraKeyStillPressed) {
+                cameraMoveStep = 0;
+            }
+            else {
+                inCameraMove = false;
+            }
+        }
+    }
+}
+
+unsigned MySimulation::requestTurn(char face, bool inverse)
+{
+    return pushTurn(face, inverse, false);
+}
+
+unsigned MySimulation::queueMoves(const char *moves)
+{
+    return pushMoves(moves, false);
+}
+
+unsigned MySimulation::queueCubeMoves(const char *moves)
+{
+    return pushMoves(moves, true);
+}
+
+unsigned MySimulation::pushTurn(char face, bool inverse, bool cubeFrame)
+{
+    if (!face || !strchr("UFRLDB", face)) {
+        return 0;
+    }
+    TurnRequest req;
+    req.key = face;
+    req.inverse = inverse;
+    req.cubeFrame = cubeFrame;
+    req.traceId = ++numTurnsRequested;
+    TRACE_ASYNC_BEGIN("turn", req.traceId);
+    turnQueue.push(req);
+    return req.traceId;
+}
+
+unsigned MySimulation::pushMoves(const char *moves, bool cubeFrame)
+{
+    unsigned last = 0;
+    for (const char *c = moves; *c; ++c) {
+        if (!strchr("UFRLDB", *c)) {
+            continue;
+        }
+        const bool inverse = c[1] == '\'';
+        const bool twice = c[1] == '2';
+        last = pushTurn(*c, inverse, cubeFrame);
+        if (twice) {
+            last = pushTurn(*c, false, cubeFrame);
+        }
+    }
+    return last;
+}
+
+void MySimulation::rotateView(ViewRotation r)
+{
+    if (inFaceRot) {
+        return;
+    }
+    MyQuaternion newRot;
+    constexpr float angle = (M_PI/8.0f); // 22.5deg
+    switch (r) {
+      case VIEW_UP: newRot.rotateX(-angle); break;
+      case VIEW_DOWN: newRot.rotateX(angle); break;
+      case VIEW_LEFT: newRot.rotateY(-angle); break;
+      case VIEW_RIGHT: newRot.rotateY(angle); break;
+    }
+
+    inViewRot = true;
+    viewRotationStartTime = time();
+    viewRotationTime = adaptedDuration(0.3);
+    cubeRotStart = cubeRot;
+    cubeRotEnd = newRot * cubeRot;
+    cubeRotEnd.normalize();
+}
+
+void MySimulation::resetView()
+{
+    cubeRot = MyQuaternion();
+    cubeRot.rotateY(M_PI / 4.0f); // 45deg
+    inViewRot = false;
+
+    eye = MyPoint(0.0f, 0.0f, 5.0f);
+    eyeDir = MyPoint();
+    inCameraMove = false;
+    ++cut;
+}
+
+void MySimulation::cameraKey(CameraMove m, bool pressed)
+{
+    if (inCameraMove) {
+        // Already moving, only the current key matters
+        if (m == cameraMove) {
+            cameraKeyStillPressed = pressed;
+        }
+        return;
+    }
+    if (!pressed) {
+        return;
+    }
+    cameraMove = m;
+    cameraMoveStep = 0;
+    inCameraMove = true;
+    cameraKeyStillPressed = true;
+}
+
+void MySimulation::look(float dx, float dy)
+{
+    eyeDir.x += dx;
+    eyeDir.y -= dy;
+}
+
+bool MySimulation::isIdle() const
+{
+    return !inFaceRot && !inViewRot && !inCameraMove && turnQueue.empty();
+}
+
+void MySimulation::snapshot(MySimState& s) const
+{
+    memcpy(s.cubies, rubik.qTransforms, sizeof(s.cubies));
+    if (inFaceRot) {
+        // Same rotation as MyRubik::doIncRot
+        MyQuaternion q;
+        q.setRotation(rubik.faceRotationAngle * faceRotationT,
+                      rubik.faceRotationAxis);
+        for (int i = 0; i < 9; ++i) {
+            const int cubie = rubik.pos[MyRubik::srcIndices
+                                                [faceRotation.rotType][i]];
+            s.cubies[cubie] = q * rubik.faceRotationStart[i];
+        }
+    }
+    s.cubeRot = cubeRot;
+    s.eye = eye;
+    s.eyeDir = eyeDir;
+    s.cut = cut;
+}
+
+// Returns false when the turn was applied at once instead of animated
+bool MySimulation::startRot(const FaceRotationInfo& r)
+{
+    TRACE_SCOPE("MySimulation::startRot");
+    const double base = r.turns == 2 ? 1.5 * turnTime : turnTime;
+    faceRotationTime = adaptedDuration(base);
+    rubik.startRot(r.rotType, r.inverse, r.turns);
+    if (faceRotationTime <= std::max(frameInterval, dt)) {
+        // Would not even last a frame
+        rubik.endRot(r.rotType, r.inverse, r.turns);
+        TRACE_INSTANT("turnApplied");
+        TRACE_ASYNC_END("turn", r.traceId);
+        ++turnsDone;
+        ++instantTurns;
+        ++cut;
+        return false;
+    }
+    faceRotation = r;
+    faceRotationT = 0.0f;
+    inFaceRot = true;
+    faceRotationStartTime = time();
+    return true;
+}
+
+// Pops the next turn, merged with the turns of the same face queued right
+// behind it (U U is U2, U U' nothing), and starts it. Returns false when
+// there is nothing left to animate.
+bool MySimulation::startNextTurn()
+{
+    TurnRequest req;
+    while (turnQueue.pop(req)) {
+        startedTurn = req.traceId;
+        int quarters = req.inverse ? 3 : 1;
+        while (const TurnRequest *next = turnQueue.front()) {
+            if (next->key != req.key || next->cubeFrame != req.cubeFrame) {
+                break;
+            }
+            quarters += next->inverse ? 3 : 1;
+            startedTurn = next->traceId;
+            TRACE_INSTANT("turnCoalesced");
+            TRACE_ASYNC_END("turn", next->traceId);
+            ++turnsDone;
+            turnQueue.pop();
+        }
+        quarters %= 4;
+        if (quarters == 0) {
+            TRACE_ASYNC_END("turn", req.traceId);
+            ++turnsDone;
+            continue;
+        }
+        FaceRotationInfo r;
+        r.rotType = req.cubeFrame ? MyRubik::faceFromLetter(req.key)
+                                  : faceForKey(req.key);
+        r.inverse = quarters == 3;
+        r.turns = quarters == 2 ? 2 : 1;
+        r.traceId = req.traceId;
+        if (startRot(r)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The cube face currently facing the key's direction
+int MySimulation::faceForKey(char key) const
+{
+    MyPoint direction;
+    switch (key) {
+      case 'U': direction.y = 1.0f; break;
+      case 'F': direction.z = 1.0f; break;
+      case 'R': direction.x = 1.0f; break;
+      case 'L': direction.x = -1.0f; break;
+      case 'D': direction.y = -1.0f; break;
+      case 'B': direction.z = -1.0f; break;
+    }
+
+    MyMatrix mv = cubeRot.toMatrix();
+    float max;
+    int rotType = 0;
+    for (int i = 0; i < 6; ++i) {
+        const MyPoint face = rubik.faceNormal[i].transform(mv);
+        const float d = face.dot(direction);
+        if (i == 0 || max < d) {
+            rotType = i;
+            max = d;
+        }
+    }
+    return rotType;
+}
+
+// Animation time for base seconds with the queue as it is: divided by the
+// number of turns waiting, plus one, and no less than minTurnTime. With a
+// floor under a frame, a deep enough backlog is applied without animation,
+// so the display keeps up with any input rate.
+double MySimulation::adaptedDuration(double base) const
+{
+    const double d = base / (1.0 + turnQueue.size());
+    return std::max(d, minTurnTime);
+}
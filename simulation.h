@@ -0,0 +1,162 @@
+#pragma once
+
+#include "cube.h"
+#include "spscqueue.h"
+
+// What the renderer needs from the simulation at one step
+struct MySimState {
+    // Orientation of every cubie, including the turn in progress
+    MyQuaternion cubies[27];
+    MyQuaternion cubeRot;
+    MyPoint eye;
+    MyPoint eyeDir;
+    // Changes on jumps that must not be interpolated across, e.g. turns
+    // applied without animation or a view reset
+    unsigned cut = 0;
+
+    // The state alpha of the way from a to b
+    static MySimState interpolate(const MySimState& a, const MySimState& b,
+                                  float alpha);
+};
+
+// The last two steps, what the renderer interpolates between
+struct MySimFrame {
+    MySimState prev;
+    MySimState cur;
+    // Simulation time of cur
+    double time = 0.0;
+    // Frame clock minus simulation time
+    double clockOffset = 0.0;
+    // Whether the last step changed anything
+    bool moving = false;
+};
+
+// Cube, view and camera animation advanced in fixed steps of dt, so that
+// the result only depends on the inputs and the number of steps, not on
+// the frame rate. No GL nor GLFW: it runs the same in the window, headless
+// and without a GPU. The renderer interpolates between the states of the
+// last two steps.
+struct MySimulation {
+    static constexpr double dt = 1.0 / 120.0;
+
+    enum ViewRotation {
+        VIEW_UP,
+        VIEW_DOWN,
+        VIEW_LEFT,
+        VIEW_RIGHT
+    };
+    enum CameraMove {
+        CAMERA_LEFT,
+        CAMERA_RIGHT,
+        CAMERA_UP,
+        CAMERA_DOWN
+    };
+
+    MySimulation() = default;
+    MySimulation(MySimulation&) = delete;
+
+    void initialize();
+
+    void step();
+    double time() const { return tick * dt; }
+
+    // Turns the face looking towards face's direction ('U', 'F', 'R', 'L',
+    // 'D' or 'B') as seen by the viewer. Safe from another thread than the
+    // one stepping, the turn is queued. Returns the turn's id, increasing
+    // with every request, or 0 if face is not a face.
+    unsigned requestTurn(char face, bool inverse);
+    // Turns written in the usual notation, e.g. "R U R' U2". Returns the
+    // id of the last one, 0 if there was none.
+    unsigned queueMoves(const char *moves);
+    // Same, with faces named in the cube's own frame whatever the view,
+    // as MyRubik::applyMoves reads them: for solutions
+    unsigned queueCubeMoves(const char *moves);
+    // Id of the last turn taken off the queue: started, applied at once,
+    // merged into another or cancelled out
+    unsigned lastStartedTurn() const { return startedTurn; }
+    // Id of the last turn requested
+    unsigned lastRequestedTurn() const { return numTurnsRequested; }
+    size_t queuedTurns() const { return turnQueue.size(); }
+
+    // 22.5 degree rotation of the whole cube, from where it is now
+    void rotateView(ViewRotation r);
+    // Repeated when the current view rotation ends, -1 for none
+    int heldViewRotation = -1;
+    // Back to the initial view and camera
+    void resetView();
+
+    // Moves the camera while the key is held
+    void cameraKey(CameraMove m, bool pressed);
+    // Turns the camera, for mouse moves
+    void look(float dx, float dy);
+
+    bool isIdle() const;
+    bool inFaceRotation() const { return inFaceRot; }
+    void snapshot(MySimState& s) const;
+
+    MyRubik rubik;
+    MyQuaternion cubeRot;
+    MyPoint eye;
+    MyPoint eyeDir;
+
+    // Quarter turn animation time, shortened while turns are queued down
+    // to minTurnTime; turns shorter than frameInterval, the display's,
+    // are applied at once
+    double turnTime = 0.4;
+    double minTurnTime = 0.05;
+    double frameInterval = 1.0 / 60.0;
+    unsigned long long instantTurns = 0;
+    // Requested turns done, merged and cancelled out ones included
+    unsigned long long turnsDone = 0;
+
+  private:
+    struct FaceRotationInfo {
+        int rotType = -1;
+        bool inverse = false;
+        // 2 for half turns
+        int turns = 1;
+        // Ties the key press to the end of the turn in traces
+        unsigned traceId = 0;
+    };
+    // A turn as typed, the face is only picked when the turn starts so
+    // that it follows the view rotations done in between
+    struct TurnRequest {
+        char key;
+        bool inverse;
+        // key names a face of the cube, not a direction of the view
+        bool cubeFrame;
+        unsigned traceId;
+    };
+
+    bool startRot(const FaceRotationInfo& r);
+    unsigned pushTurn(char face, bool inverse, bool cubeFrame);
+    unsigned pushMoves(const char *moves, bool cubeFrame);
+    bool startNextTurn();
+    int faceForKey(char key) const;
+    double adaptedDuration(double base) const;
+
+    unsigned long long tick = 0;
+    unsigned cut = 0;
+
+    // Input (producer) to animation (consumer), never drops a turn
+    MySpscQueue<TurnRequest> turnQueue;
+    unsigned numTurnsRequested = 0;
+    unsigned startedTurn = 0;
+    FaceRotationInfo faceRotation;
+    bool inFaceRot = false;
+    double faceRotationStartTime = 0.0;
+    double faceRotationTime = 0.0;
+    // Progress of the turn, from 0 to 1
+    float faceRotationT = 0.0f;
+
+    bool inViewRot = false;
+    MyQuaternion cubeRotStart;
+    MyQuaternion cubeRotEnd;
+    double viewRotationStartTime = 0.0;
+    double viewRotationTime = 0.0;
+
+    bool inCameraMove = false;
+    CameraMove cameraMove = CAMERA_LEFT;
+    bool cameraKeyStillPressed = false;
+    int cameraMoveStep = 0;
+};
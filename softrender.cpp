@@ -0,0 +1,720 @@
+#include "softrender.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SOFT_HAVE_AVX2
+#endif
+
+using namespace std;
+
+namespace {
+constexpr int tileSize = 64;
+
+// Same constants as fragment.glsl
+constexpr float background[3] = { 210.0f/255.0f, 230.0f/255.0f, 1.0f };
+constexpr float diffuseColor = 0.2f;
+constexpr float shininess = 20.0f;
+constexpr float shadowBias = 0.005f;
+constexpr float poissonDisk[4][2] = {
+    { -0.94201624f, -0.39906216f },
+    { 0.94558609f, -0.76890725f },
+    { -0.094184101f, -0.92938870f },
+    { 0.34495938f, 0.29387760f }
+};
+
+void transform(const MyMatrix& m, const float in[4], float out[4])
+{
+    for (int r = 0; r < 4; ++r) {
+        out[r] = m.buf[r] * in[0] + m.buf[4 + r] * in[1]
+               + m.buf[8 + r] * in[2] + m.buf[12 + r] * in[3];
+    }
+}
+
+float dot3(const float *a, const float *b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+void normalize3(float *v)
+{
+    const float len = sqrtf(dot3(v, v));
+    if (len > 0.0f) {
+        v[0] /= len;
+        v[1] /= len;
+        v[2] /= len;
+    }
+}
+
+typedef MySoftRenderer::Triangle Triangle;
+
+// Depth (and triangle id) test of one triangle over the pixels
+// [x0,x1) x [y0,y1). depth and ids point at pixel (ox, oy); ids may be
+// null for depth only passes.
+typedef void (*RasterFn)(const Triangle& tri, int id, int x0, int y0,
+                         int x1, int y1, float *depth, int *ids,
+                         int stride, int ox, int oy);
+
+void rasterScalar(const Triangle& tri, int id, int x0, int y0, int x1,
+                  int y1, float *depth, int *ids, int stride, int ox, int oy)
+{
+    const int xs = max(x0, tri.minX);
+    const int xe = min(x1 - 1, tri.maxX);
+    const int ys = max(y0, tri.minY);
+    const int ye = min(y1 - 1, tri.maxY);
+    for (int y = ys; y <= ye; ++y) {
+        const float py = y + 0.5f;
+        const size_t row = size_t(y - oy) * stride - ox;
+        for (int x = xs; x <= xe; ++x) {
+            const float px = x + 0.5f;
+            if (tri.a[0] * px + tri.b[0] * py + tri.c[0] < 0.0f
+             || tri.a[1] * px + tri.b[1] * py + tri.c[1] < 0.0f
+             || tri.a[2] * px + tri.b[2] * py + tri.c[2] < 0.0f) {
+                continue;
+            }
+            const float z = tri.za * px + tri.zb * py + tri.zc;
+            if (z < depth[row + x]) {
+                depth[row + x] = z;
+                if (ids) {
+                    ids[row + x] = id;
+                }
+            }
+        }
+    }
+}
+
+#ifdef SOFT_HAVE_AVX2
+// 8 pixels per step; masked loads and stores keep the partial blocks at the
+// right of the span inside the buffers
+__attribute__((target("avx2,fma")))
+void rasterAvx2(const Triangle& tri, int id, int x0, int y0, int x1, int y1,
+                float *depth, int *ids, int stride, int ox, int oy)
+{
+    const int xs = max(x0, tri.minX);
+    const int xe = min(x1 - 1, tri.maxX);
+    const int ys = max(y0, tri.minY);
+    const int ye = min(y1 - 1, tri.maxY);
+    if (xs > xe) {
+        return;
+    }
+    const __m256 offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f,
+                                          4.5f, 5.5f, 6.5f, 7.5f);
+    const __m256 a0 = _mm256_set1_ps(tri.a[0]);
+    const __m256 a1 = _mm256_set1_ps(tri.a[1]);
+    const __m256 a2 = _mm256_set1_ps(tri.a[2]);
+    const __m256 za = _mm256_set1_ps(tri.za);
+    const __m256 end = _mm256_set1_ps(float(xe + 1));
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i idv = _mm256_set1_epi32(id);
+    for (int y = ys; y <= ye; ++y) {
+        const float py = y + 0.5f;
+        const __m256 r0 = _mm256_set1_ps(tri.b[0] * py + tri.c[0]);
+        const __m256 r1 = _mm256_set1_ps(tri.b[1] * py + tri.c[1]);
+        const __m256 r2 = _mm256_set1_ps(tri.b[2] * py + tri.c[2]);
+        const __m256 rz = _mm256_set1_ps(tri.zb * py + tri.zc);
+        const size_t row = size_t(y - oy) * stride - ox;
+        for (int x = xs; x <= xe; x += 8) {
+            const __m256 px = _mm256_add_ps(_mm256_set1_ps(float(x)),
+                                            offsets);
+            const __m256 e0 = _mm256_fmadd_ps(a0, px, r0);
+            const __m256 e1 = _mm256_fmadd_ps(a1, px, r1);
+            const __m256 e2 = _mm256_fmadd_ps(a2, px, r2);
+            __m256 mask = _mm256_cmp_ps(px, end, _CMP_LT_OQ);
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(e0, zero, _CMP_GE_OQ));
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(e1, zero, _CMP_GE_OQ));
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+            if (!_mm256_movemask_ps(mask)) {
+                continue;
+            }
+            float *dp = depth + row + x;
+            const __m256 d = _mm256_maskload_ps(dp,
+                                                _mm256_castps_si256(mask));
+            const __m256 z = _mm256_fmadd_ps(za, px, rz);
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, d, _CMP_LT_OQ));
+            if (!_mm256_movemask_ps(mask)) {
+                continue;
+            }
+            const __m256i m = _mm256_castps_si256(mask);
+            _mm256_maskstore_ps(dp, m, z);
+            if (ids) {
+                _mm256_maskstore_epi32(ids + row + x, m, idv);
+            }
+        }
+    }
+}
+#endif
+
+RasterFn raster = rasterScalar;
+
+MySoftRenderer::Varying lerp(const MySoftRenderer::Varying& a,
+                             const MySoftRenderer::Varying& b, float t)
+{
+    MySoftRenderer::Varying r = a;
+    for (int i = 0; i < 3; ++i) {
+        r.color[i] = a.color[i] + (b.color[i] - a.color[i]) * t;
+        r.viewPos[i] = a.viewPos[i] + (b.viewPos[i] - a.viewPos[i]) * t;
+        r.normal[i] = a.normal[i] + (b.normal[i] - a.normal[i]) * t;
+    }
+    for (int i = 0; i < 4; ++i) {
+        r.shadow[i] = a.shadow[i] + (b.shadow[i] - a.shadow[i]) * t;
+    }
+    return r;
+}
+}
+
+bool MySoftRenderer::initialize(int w, int h, int samples, int numThreads,
+                                int shadowMapSize)
+{
+    width = w;
+    height = h;
+    // Ordered grid: 4 samples is 2x2, 16 is 4x4
+    scale = 1;
+    while (scale < 4 && (scale + 1) * (scale + 1) <= samples) {
+        ++scale;
+    }
+    if (tileSize % scale) {
+        scale = 2;
+    }
+    shadowSize = shadowMapSize;
+    numThreads = max(1, numThreads);
+
+    useAvx2 = false;
+    raster = rasterScalar;
+#ifdef SOFT_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        useAvx2 = true;
+        raster = rasterAvx2;
+    }
+#endif
+
+    shadowMap.assign(size_t(shadowSize) * shadowSize, 1.0f);
+    const int shadowTiles = (shadowSize + tileSize - 1) / tileSize;
+    shadowTileMin.assign(shadowTiles * shadowTiles, 1.0f);
+    rgb.assign(size_t(width) * height * 3, 0);
+    tileDepth.resize(numThreads);
+    tileIds.resize(numThreads);
+    for (int i = 0; i < numThreads; ++i) {
+        tileDepth[i].resize(tileSize * tileSize);
+        tileIds[i].resize(tileSize * tileSize);
+    }
+
+    stopping = false;
+    for (int i = 1; i < numThreads; ++i) {
+        workers.emplace_back(&MySoftRenderer::workerLoop, this, i);
+    }
+    initialized = true;
+    printf("software renderer %dx%d, %dx%d supersampling, %d threads, %s\n",
+           width, height, scale, scale, numThreads,
+           useAvx2 ? "AVX2" : "scalar");
+    return true;
+}
+
+void MySoftRenderer::shutdown()
+{
+    if (!initialized) {
+        return;
+    }
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        cond.notify_all();
+    }
+    for (thread& t : workers) {
+        t.join();
+    }
+    workers.clear();
+    initialized = false;
+}
+
+void MySoftRenderer::parallelFor(int count,
+                                 const function<void(int, int)>& fn)
+{
+    if (workers.empty()) {
+        for (int i = 0; i < count; ++i) {
+            fn(i, 0);
+        }
+        return;
+    }
+    {
+        lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobCount = count;
+        nextJob = 0;
+        busyWorkers = workers.size();
+        ++generation;
+        cond.notify_all();
+    }
+    // The calling thread is worker 0
+    for (int i; (i = nextJob++) < count;) {
+        fn(i, 0);
+    }
+    unique_lock<std::mutex> lock(mutex);
+    doneCond.wait(lock, [this] { return busyWorkers == 0; });
+}
+
+void MySoftRenderer::workerLoop(int worker)
+{
+    unsigned seen = 0;
+    for (;;) {
+        {
+            unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        for (int i; (i = nextJob++) < jobCount;) {
+            (*job)(i, worker);
+        }
+        lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0) {
+            doneCond.notify_one();
+        }
+    }
+}
+
+void MySoftRenderer::transformVertices(const MySoftScene& scene)
+{
+    const MyRubik& rubik = *scene.rubik;
+    const MyMatrix cubeMv = scene.cameraTransform * scene.cubeRot;
+    const MyMatrix lightMvp = scene.lightProj * scene.lightView;
+    const MyMatrix cubeLight = lightMvp * scene.cubeRot;
+
+    shadowVerts.resize(27 * 36);
+    sceneVerts.resize(27 * 36 + 6);
+    for (int i = 0; i < 27; ++i) {
+        const MyMatrix mv = cubeMv * scene.transforms[i];
+        const MyMatrix mvp = scene.projMatrix * mv;
+        const MyMatrix light = cubeLight * scene.transforms[i];
+        for (int j = 0; j < 36; ++j) {
+            const MyPoint& p = rubik.cubes[i].vertices[j];
+            const MyPoint& n = rubik.normals[i].vertices[j];
+            const MyPoint& c = rubik.colors[i].vertices[j];
+            const float pos[4] = { p.x, p.y, p.z, 1.0f };
+            const float normal[4] = { n.x, n.y, n.z, 0.0f };
+            Vertex& v = sceneVerts[i * 36 + j];
+            transform(mvp, pos, v.clip);
+            float view[4];
+            transform(mv, pos, view);
+            float nv[4];
+            // Only rotations and a translation, mv is its own normal matrix
+            transform(mv, normal, nv);
+            float s[4];
+            transform(light, pos, s);
+            for (int k = 0; k < 3; ++k) {
+                v.v.viewPos[k] = view[k];
+                v.v.normal[k] = nv[k];
+                // depthBias in vertex.glsl
+                v.v.shadow[k] = 0.5f * s[k] + 0.5f * s[3];
+            }
+            v.v.shadow[3] = s[3];
+            v.v.color[0] = c.x;
+            v.v.color[1] = c.y;
+            v.v.color[2] = c.z;
+            v.v.passThrough = false;
+
+            copy(s, s + 4, shadowVerts[i * 36 + j].clip);
+        }
+    }
+
+    const MyMatrix groundMvp = scene.projMatrix * scene.cameraTransform;
+    for (int j = 0; j < 6; ++j) {
+        const MyPoint& p = scene.groundVertices[j];
+        const MyPoint& c = scene.groundColors[j];
+        const float pos[4] = { p.x, p.y, p.z, 1.0f };
+        Vertex& v = sceneVerts[27 * 36 + j];
+        v = Vertex();
+        transform(groundMvp, pos, v.clip);
+        float s[4];
+        transform(lightMvp, pos, s);
+        for (int k = 0; k < 3; ++k) {
+            v.v.shadow[k] = 0.5f * s[k] + 0.5f * s[3];
+        }
+        v.v.shadow[3] = s[3];
+        v.v.color[0] = c.x;
+        v.v.color[1] = c.y;
+        v.v.color[2] = c.z;
+        v.v.passThrough = true;
+    }
+}
+
+void MySoftRenderer::setupTriangles(vector<Triangle>& tris,
+                                    vector<Varying> *out, const Vertex *verts,
+                                    int numVerts, int w, int h)
+{
+    // Clipping against the near plane makes at most two triangles of one;
+    // reserving that keeps later frames from allocating
+    tris.clear();
+    tris.reserve(numVerts / 3 * 2);
+    if (out) {
+        out->clear();
+        out->reserve(numVerts / 3 * 6);
+    }
+    for (int t = 0; t + 2 < numVerts; t += 3) {
+        // Clip against the near plane (z >= -w), the rest is left to the
+        // tile bounds
+        Vertex poly[4];
+        int n = 0;
+        for (int i = 0; i < 3; ++i) {
+            const Vertex& a = verts[t + i];
+            const Vertex& b = verts[t + (i + 1) % 3];
+            const float da = a.clip[2] + a.clip[3];
+            const float db = b.clip[2] + b.clip[3];
+            if (da >= 0.0f) {
+                poly[n++] = a;
+            }
+            if ((da >= 0.0f) != (db >= 0.0f)) {
+                const float f = da / (da - db);
+                Vertex& v = poly[n++];
+                for (int k = 0; k < 4; ++k) {
+                    v.clip[k] = a.clip[k] + (b.clip[k] - a.clip[k]) * f;
+                }
+                v.v = lerp(a.v, b.v, f);
+            }
+        }
+
+        for (int k = 1; k + 1 < n; ++k) {
+            const Vertex *tv[3] = { &poly[0], &poly[k], &poly[k + 1] };
+            float x[3], y[3], z[3];
+            for (int i = 0; i < 3; ++i) {
+                const float iw = 1.0f / tv[i]->clip[3];
+                x[i] = (tv[i]->clip[0] * iw * 0.5f + 0.5f) * w;
+                y[i] = (tv[i]->clip[1] * iw * 0.5f + 0.5f) * h;
+                z[i] = tv[i]->clip[2] * iw * 0.5f + 0.5f;
+            }
+            // Counter clockwise is front facing, back faces are culled
+            const float area = (x[1] - x[0]) * (y[2] - y[0])
+                             - (x[2] - x[0]) * (y[1] - y[0]);
+            if (!(area > 0.0f)) {
+                continue;
+            }
+            Triangle tri;
+            const float inv = 1.0f / area;
+            for (int i = 0; i < 3; ++i) {
+                const int j = (i + 1) % 3;
+                const int l = (i + 2) % 3;
+                tri.a[i] = (y[j] - y[l]) * inv;
+                tri.b[i] = (x[l] - x[j]) * inv;
+                tri.c[i] = (x[j] * y[l] - x[l] * y[j]) * inv;
+            }
+            tri.za = tri.a[0] * z[0] + tri.a[1] * z[1] + tri.a[2] * z[2];
+            tri.zb = tri.b[0] * z[0] + tri.b[1] * z[1] + tri.b[2] * z[2];
+            tri.zc = tri.c[0] * z[0] + tri.c[1] * z[1] + tri.c[2] * z[2];
+
+            const float minX = min(x[0], min(x[1], x[2]));
+            const float maxX = max(x[0], max(x[1], x[2]));
+            const float minY = min(y[0], min(y[1], y[2]));
+            const float maxY = max(y[0], max(y[1], y[2]));
+            if (maxX < 0.0f || maxY < 0.0f || minX >= w || minY >= h) {
+                continue;
+            }
+            tri.minX = max(0, int(floorf(minX)));
+            tri.minY = max(0, int(floorf(minY)));
+            tri.maxX = min(w - 1, int(ceilf(maxX)));
+            tri.maxY = min(h - 1, int(ceilf(maxY)));
+
+            if (out) {
+                for (int i = 0; i < 3; ++i) {
+                    tri.vertex[i] = out->size();
+                    Varying v = tv[i]->v;
+                    const float iw = 1.0f / tv[i]->clip[3];
+                    v.invW = iw;
+                    for (int c = 0; c < 3; ++c) {
+                        v.color[c] *= iw;
+                        v.viewPos[c] *= iw;
+                        v.normal[c] *= iw;
+                    }
+                    for (int c = 0; c < 4; ++c) {
+                        v.shadow[c] *= iw;
+                    }
+                    out->push_back(v);
+                }
+            }
+            tris.push_back(tri);
+        }
+    }
+}
+
+void MySoftRenderer::bin(const vector<Triangle>& tris, int w, int h,
+                         Bins& bins)
+{
+    const int tilesX = (w + tileSize - 1) / tileSize;
+    const int tilesY = (h + tileSize - 1) / tileSize;
+    // Count, then place every triangle after the ones of the tiles before
+    vector<int>& first = bins.first;
+    first.assign(tilesX * tilesY + 1, 0);
+    for (const Triangle& tri : tris) {
+        for (int ty = tri.minY / tileSize; ty <= tri.maxY / tileSize; ++ty) {
+            for (int tx = tri.minX / tileSize; tx <= tri.maxX / tileSize;
+                 ++tx) {
+                ++first[ty * tilesX + tx + 1];
+            }
+        }
+    }
+    for (size_t t = 1; t < first.size(); ++t) {
+        first[t] += first[t - 1];
+    }
+    bins.tris.resize(max(first.back(), 1));
+    for (size_t i = 0; i < tris.size(); ++i) {
+        const Triangle& tri = tris[i];
+        for (int ty = tri.minY / tileSize; ty <= tri.maxY / tileSize; ++ty) {
+            for (int tx = tri.minX / tileSize; tx <= tri.maxX / tileSize;
+                 ++tx) {
+                bins.tris[first[ty * tilesX + tx]++] = i;
+            }
+        }
+    }
+    // Each first[t] now stands where tile t + 1 starts
+    for (size_t t = first.size() - 1; t > 0; --t) {
+        first[t] = first[t - 1];
+    }
+    first[0] = 0;
+}
+
+void MySoftRenderer::shadowTile(int tile)
+{
+    const int tilesX = (shadowSize + tileSize - 1) / tileSize;
+    const int x0 = (tile % tilesX) * tileSize;
+    const int y0 = (tile / tilesX) * tileSize;
+    const int x1 = min(shadowSize, x0 + tileSize);
+    const int y1 = min(shadowSize, y0 + tileSize);
+    // Most of the map stays empty, only clear what was drawn into
+    if (shadowTileMin[tile] < 1.0f) {
+        for (int y = y0; y < y1; ++y) {
+            float *row = &shadowMap[size_t(y) * shadowSize];
+            fill(row + x0, row + x1, 1.0f);
+        }
+    }
+    float minDepth = 1.0f;
+    if (shadowBins.begin(tile) != shadowBins.end(tile)) {
+        for (const int *i = shadowBins.begin(tile);
+             i != shadowBins.end(tile); ++i) {
+            raster(shadowTris[*i], *i, x0, y0, x1, y1, shadowMap.data(),
+                   nullptr, shadowSize, 0, 0);
+        }
+        for (int y = y0; y < y1; ++y) {
+            const float *row = &shadowMap[size_t(y) * shadowSize];
+            minDepth = min(minDepth, *min_element(row + x0, row + x1));
+        }
+    }
+    shadowTileMin[tile] = minDepth;
+}
+
+// True when ref passes the depth test against every texel the PCF taps
+// around (s, t) can reach, which is the case for most of the ground
+bool MySoftRenderer::fullyLit(float s, float t, float ref) const
+{
+    const float reach = 1.0f / 700.0f;
+    const int tilesX = (shadowSize + tileSize - 1) / tileSize;
+    const int last = tilesX - 1;
+    const int tx0 = min(max(int((s - reach) * shadowSize - 1.0f) / tileSize,
+                            0), last);
+    const int tx1 = min(max(int((s + reach) * shadowSize + 1.0f) / tileSize,
+                            0), last);
+    const int ty0 = min(max(int((t - reach) * shadowSize - 1.0f) / tileSize,
+                            0), last);
+    const int ty1 = min(max(int((t + reach) * shadowSize + 1.0f) / tileSize,
+                            0), last);
+    ref = min(max(ref, 0.0f), 1.0f);
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            if (ref > shadowTileMin[ty * tilesX + tx]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// sampler2DShadow with GL_LINEAR and GL_LEQUAL: the four nearest texels
+// are compared, then the results are filtered
+float MySoftRenderer::shadowLookup(float s, float t, float ref) const
+{
+    ref = min(max(ref, 0.0f), 1.0f);
+    const float u = s * shadowSize - 0.5f;
+    const float v = t * shadowSize - 0.5f;
+    const float fu = floorf(u);
+    const float fv = floorf(v);
+    const float wu = u - fu;
+    const float wv = v - fv;
+    const int last = shadowSize - 1;
+    const int u0 = min(max(int(fu), 0), last);
+    const int u1 = min(max(int(fu) + 1, 0), last);
+    const int v0 = min(max(int(fv), 0), last);
+    const int v1 = min(max(int(fv) + 1, 0), last);
+    const float *r0 = &shadowMap[size_t(v0) * shadowSize];
+    const float *r1 = &shadowMap[size_t(v1) * shadowSize];
+    const float t00 = ref <= r0[u0] ? 1.0f : 0.0f;
+    const float t10 = ref <= r0[u1] ? 1.0f : 0.0f;
+    const float t01 = ref <= r1[u0] ? 1.0f : 0.0f;
+    const float t11 = ref <= r1[u1] ? 1.0f : 0.0f;
+    return (t00 * (1.0f - wu) + t10 * wu) * (1.0f - wv)
+         + (t01 * (1.0f - wu) + t11 * wu) * wv;
+}
+
+// fragment.glsl
+void MySoftRenderer::shade(const Triangle& tri, float x, float y,
+                           float *out) const
+{
+    const Varying *v[3] = { &varyings[tri.vertex[0]],
+                            &varyings[tri.vertex[1]],
+                            &varyings[tri.vertex[2]] };
+    float b[3];
+    for (int i = 0; i < 3; ++i) {
+        b[i] = tri.a[i] * x + tri.b[i] * y + tri.c[i];
+    }
+    const float w = 1.0f / (b[0] * v[0]->invW + b[1] * v[1]->invW
+                          + b[2] * v[2]->invW);
+    for (int i = 0; i < 3; ++i) {
+        b[i] *= w;
+    }
+    float color[3], pos[3], normal[3], shadow[4];
+    for (int c = 0; c < 3; ++c) {
+        color[c] = b[0] * v[0]->color[c] + b[1] * v[1]->color[c]
+                 + b[2] * v[2]->color[c];
+        pos[c] = b[0] * v[0]->viewPos[c] + b[1] * v[1]->viewPos[c]
+               + b[2] * v[2]->viewPos[c];
+        normal[c] = b[0] * v[0]->normal[c] + b[1] * v[1]->normal[c]
+                  + b[2] * v[2]->normal[c];
+    }
+    for (int c = 0; c < 4; ++c) {
+        shadow[c] = b[0] * v[0]->shadow[c] + b[1] * v[1]->shadow[c]
+                  + b[2] * v[2]->shadow[c];
+    }
+
+    float visibility = 1.0f;
+    const float ref = (shadow[2] - shadowBias) / shadow[3];
+    if (!fullyLit(shadow[0], shadow[1], ref)) {
+        for (int i = 0; i < 4; ++i) {
+            visibility -= 0.2f * (1.0f - shadowLookup(
+                                shadow[0] + poissonDisk[i][0] / 700.0f,
+                                shadow[1] + poissonDisk[i][1] / 700.0f, ref));
+        }
+    }
+
+    if (v[0]->passThrough) {
+        for (int c = 0; c < 3; ++c) {
+            out[c] = color[c] * visibility;
+        }
+        return;
+    }
+    normalize3(normal);
+    float l[3] = { lightView.x - pos[0], lightView.y - pos[1],
+                   lightView.z - pos[2] };
+    normalize3(l);
+    const float ln = max(dot3(l, normal), 0.0f);
+    float specular = 0.0f;
+    if (ln > 0.0f) {
+        float h[3] = { -pos[0], -pos[1], -pos[2] };
+        normalize3(h);
+        for (int c = 0; c < 3; ++c) {
+            h[c] += l[c];
+        }
+        normalize3(h);
+        specular = powf(max(dot3(h, normal), 0.0f), shininess);
+    }
+    for (int c = 0; c < 3; ++c) {
+        out[c] = color[c] + ln * diffuseColor * visibility
+               + visibility * specular / 2.0f;
+    }
+}
+
+void MySoftRenderer::sceneTile(int tile, int worker)
+{
+    const int w = width * scale;
+    const int h = height * scale;
+    const int tilesX = (w + tileSize - 1) / tileSize;
+    const int x0 = (tile % tilesX) * tileSize;
+    const int y0 = (tile / tilesX) * tileSize;
+    const int x1 = min(w, x0 + tileSize);
+    const int y1 = min(h, y0 + tileSize);
+    float *depth = tileDepth[worker].data();
+    int *ids = tileIds[worker].data();
+    fill(depth, depth + tileSize * tileSize, 1.0f);
+    fill(ids, ids + tileSize * tileSize, -1);
+    for (const int *i = sceneBins.begin(tile); i != sceneBins.end(tile);
+         ++i) {
+        raster(sceneTris[*i], *i, x0, y0, x1, y1, depth, ids, tileSize, x0,
+               y0);
+    }
+
+    // Like multisampling, a pixel covered by a single triangle is shaded
+    // once at its center, edge pixels once per sample
+    const int samples = scale * scale;
+    const float norm = 1.0f / samples;
+    for (int y = y0; y < y1; y += scale) {
+        for (int x = x0; x < x1; x += scale) {
+            const int *first = ids + (y - y0) * tileSize + (x - x0);
+            bool uniform = true;
+            for (int sy = 0; sy < scale && uniform; ++sy) {
+                for (int sx = 0; sx < scale; ++sx) {
+                    if (first[sy * tileSize + sx] != first[0]) {
+                        uniform = false;
+                        break;
+                    }
+                }
+            }
+            float sum[3] = { 0.0f, 0.0f, 0.0f };
+            if (uniform) {
+                if (first[0] < 0) {
+                    copy(background, background + 3, sum);
+                }
+                else {
+                    shade(sceneTris[first[0]], x + 0.5f * scale,
+                          y + 0.5f * scale, sum);
+                }
+            }
+            else {
+                for (int sy = 0; sy < scale; ++sy) {
+                    for (int sx = 0; sx < scale; ++sx) {
+                        const int id = first[sy * tileSize + sx];
+                        float c[3];
+                        if (id < 0) {
+                            copy(background, background + 3, c);
+                        }
+                        else {
+                            shade(sceneTris[id], x + sx + 0.5f,
+                                  y + sy + 0.5f, c);
+                        }
+                        for (int k = 0; k < 3; ++k) {
+                            sum[k] += min(max(c[k], 0.0f), 1.0f) * norm;
+                        }
+                    }
+                }
+            }
+            unsigned char *dst = &rgb[(size_t(y / scale) * width + x / scale)
+                                      * 3];
+            for (int k = 0; k < 3; ++k) {
+                dst[k] = (unsigned char)
+                         (min(max(sum[k], 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    }
+}
+
+void MySoftRenderer::render(const MySoftScene& scene)
+{
+    if (!initialized) {
+        return;
+    }
+    transformVertices(scene);
+    lightView = scene.lightPos.transform(scene.cameraTransform);
+
+    setupTriangles(shadowTris, nullptr, shadowVerts.data(),
+                   shadowVerts.size(), shadowSize, shadowSize);
+    bin(shadowTris, shadowSize, shadowSize, shadowBins);
+    parallelFor(shadowBins.numTiles(), [this](int tile, int) {
+        shadowTile(tile);
+    });
+
+    setupTriangles(sceneTris, &varyings, sceneVerts.data(),
+                   sceneVerts.size(), width * scale, height * scale);
+    bin(sceneTris, width * scale, height * scale, sceneBins);
+    parallelFor(sceneBins.numTiles(), [this](int tile, int worker) {
+        sceneTile(tile, worker);
+    });
+}
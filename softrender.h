@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cube.h"
+
+// What MyApp::render draws, for MySoftRenderer
+struct MySoftScene {
+    const MyRubik *rubik = nullptr;
+    const MyMatrix *transforms = nullptr;  // 27, one per cubie
+    const MyPoint *groundVertices = nullptr;  // 6, world space
+    const MyPoint *groundColors = nullptr;
+    MyMatrix projMatrix;
+    MyMatrix cameraTransform;
+    MyMatrix cubeRot;
+    // Light view and projection, as given by MyApp::lightSetup
+    MyMatrix lightView;
+    MyMatrix lightProj;
+    MyPoint lightPos;  // world space
+};
+
+// CPU rendering backend for machines without a GPU. Draws the same scene
+// as the GL path: a depth-only shadow pass from the light, then the ground
+// and the cubies shaded like fragment.glsl (Blinn-Phong, 4 tap PCF).
+// The screen is split into tiles, triangles are binned per tile and the
+// tiles are rasterized in parallel into a tile-local depth and triangle id
+// buffer; only the visible sample of every pixel gets shaded. Edge and
+// depth tests run 8 pixels at a time with AVX2 when the CPU has it.
+// Antialiasing is ordered grid supersampling, samples 4 is 2x2.
+struct MySoftRenderer {
+    MySoftRenderer() = default;
+    MySoftRenderer(MySoftRenderer&) = delete;
+    ~MySoftRenderer() { shutdown(); }
+
+    // numThreads counts the calling thread
+    bool initialize(int width, int height, int samples, int numThreads,
+                    int shadowMapSize);
+    void shutdown();
+
+    void render(const MySoftScene& scene);
+
+    // RGB, rows bottom up like glReadPixels
+    const unsigned char *pixels() const { return rgb.data(); }
+    bool simd() const { return useAvx2; }
+
+    struct Triangle {
+        // Edge functions a*x + b*y + c, scaled so that they sum to 1
+        float a[3];
+        float b[3];
+        float c[3];
+        // Depth plane
+        float za, zb, zc;
+        int minX, minY, maxX, maxY;
+        int vertex[3];
+    };
+
+    // Per vertex attributes, already divided by w
+    struct Varying {
+        float invW;
+        float color[3];
+        float viewPos[3];
+        float normal[3];
+        float shadow[4];
+        bool passThrough;
+    };
+
+  private:
+    struct Vertex {
+        float clip[4];
+        Varying v;
+    };
+
+    // Triangles per tile, in one array so that binning a frame only
+    // allocates when it needs more room than any frame before
+    struct Bins {
+        // Tile t holds tris[first[t]] up to tris[first[t + 1]]
+        std::vector<int> first;
+        std::vector<int> tris;
+
+        int numTiles() const { return int(first.size()) - 1; }
+        const int *begin(int tile) const { return &tris[0] + first[tile]; }
+        const int *end(int tile) const { return &tris[0] + first[tile + 1]; }
+    };
+
+    void transformVertices(const MySoftScene& scene);
+    void setupTriangles(std::vector<Triangle>& tris,
+                        std::vector<Varying> *varyings, const Vertex *verts,
+                        int numVerts, int w, int h);
+    void bin(const std::vector<Triangle>& tris, int w, int h, Bins& bins);
+    void shadowTile(int tile);
+    void sceneTile(int tile, int worker);
+    bool fullyLit(float s, float t, float ref) const;
+    float shadowLookup(float s, float t, float ref) const;
+    void shade(const Triangle& tri, float x, float y, float *out) const;
+
+    // Runs fn(job, worker) for jobs [0, count) on the pool, and waits
+    void parallelFor(int count, const std::function<void(int, int)>& fn);
+    void workerLoop(int worker);
+
+    bool initialized = false;
+    bool useAvx2 = false;
+    int width = 0;
+    int height = 0;
+    int scale = 1;
+    int shadowSize = 0;
+    MyPoint lightView;  // light position in view space
+
+    std::vector<Vertex> shadowVerts;
+    std::vector<Vertex> sceneVerts;
+    std::vector<Triangle> shadowTris;
+    std::vector<Triangle> sceneTris;
+    std::vector<Varying> varyings;
+    Bins shadowBins;
+    Bins sceneBins;
+    std::vector<float> shadowMap;
+    // Nearest depth drawn in every shadow map tile, 1 when empty
+    std::vector<float> shadowTileMin;
+
+    // Per worker tile buffers
+    std::vector<std::vector<float>> tileDepth;
+    std::vector<std::vector<int>> tileIds;
+
+    std::vector<unsigned char> rgb;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::condition_variable doneCond;
+    const std::function<void(int, int)> *job = nullptr;
+    int jobCount = 0;
+    std::atomic<int> nextJob{0};
+    int busyWorkers = 0;
+    unsigned generation = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,368 @@
+#include "solver.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "prunetable.h"
+
+namespace {
+typedef MyCubieCube C;
+
+const char tableMagic[8] = "CUBE2PH";
+// 2: nibble pruning tables
+constexpr uint32_t tableVersion = 2;
+
+// U, U2, U', R2, F2, D, D2, D', L2, B2: the moves that keep the cube in
+// the phase 2 subgroup
+const int phase2Moves[] = { 0, 1, 2, 4, 7, 9, 10, 11, 13, 16 };
+constexpr int numPhase2Moves = sizeof(phase2Moves) / sizeof(phase2Moves[0]);
+
+const int allMoves[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                         15, 16, 17 };
+
+bool isPhase2Move(int m)
+{
+    return std::find(phase2Moves, phase2Moves + numPhase2Moves, m)
+        != phase2Moves + numPhase2Moves;
+}
+}
+
+MyTwoPhaseTables::~MyTwoPhaseTables()
+{
+    stop = true;
+    if (builder.joinable()) {
+        builder.join();
+    }
+    delete owned;
+}
+
+bool MyTwoPhaseTables::load(const char *path, int threads)
+{
+    if (path && file.map(path, tableMagic, tableVersion, sizeof(Data))) {
+        setData((const Data *) file.data());
+        return true;
+    }
+
+    build(threads);
+    // Use the file like the other processes do, and drop the copy
+    if (path && MyTableFile::write(path, tableMagic, tableVersion, owned,
+                                   sizeof(Data))
+     && file.map(path, tableMagic, tableVersion, sizeof(Data))) {
+        setData((const Data *) file.data());
+        delete owned;
+        owned = nullptr;
+    }
+    return true;
+}
+
+void MyTwoPhaseTables::loadInBackground(const char *path, int threads)
+{
+    if (path && file.map(path, tableMagic, tableVersion, sizeof(Data))) {
+        setData((const Data *) file.data());
+        return;
+    }
+
+    // Solvers may hold on to data, so the built copy stays in use even
+    // once written
+    const std::string saveTo = path ? path : "";
+    builder = std::thread([this, threads, saveTo]() {
+        build(threads);
+        if (complete() && !saveTo.empty()) {
+            MyTableFile::write(saveTo.c_str(), tableMagic, tableVersion,
+                               owned, sizeof(Data));
+        }
+    });
+}
+
+MyTwoPhaseTables::Progress MyTwoPhaseTables::progress() const
+{
+    const size_t sizes[NUM_PRUNE_TABLES] = {
+        size_t(C::numSlices) * C::numTwists,
+        size_t(C::numSlices) * C::numFlips,
+        size_t(numSlicePerms) * C::numCornerPerms,
+        size_t(numSlicePerms) * C::numUdEdgePerms
+    };
+    Progress p;
+    for (int k = 0; k < NUM_PRUNE_TABLES; ++k) {
+        p.entries += pruneProgress[k].filled;
+        p.total += sizes[k];
+    }
+    if (complete()) {
+        // Mapped tables were never counted
+        p.entries = p.total;
+        p.seconds = buildSeconds;
+    }
+    else if (ready()) {
+        p.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - buildStart).count();
+    }
+    return p;
+}
+
+void MyTwoPhaseTables::setData(const Data *d)
+{
+    data = d;
+    pruneTables[SLICE_TWIST] = d->sliceTwistPrune;
+    pruneTables[SLICE_FLIP] = d->sliceFlipPrune;
+    pruneTables[SLICE_CORNER] = d->sliceCornerPrune;
+    pruneTables[SLICE_EDGE] = d->sliceEdgePrune;
+    if (d != owned) {
+        // Mapped, complete
+        for (MyPruneProgress& p : pruneProgress) {
+            p.known = MyNibbles::unknown;
+        }
+        movesReady.store(true, std::memory_order_release);
+        done.store(true, std::memory_order_release);
+    }
+}
+
+void MyTwoPhaseTables::build(int threads)
+{
+    buildStart = std::chrono::steady_clock::now();
+    owned = new Data;
+    Data& d = *owned;
+    std::fill(d.sliceTwistPrune, std::end(d.sliceTwistPrune), 0xff);
+    std::fill(d.sliceFlipPrune, std::end(d.sliceFlipPrune), 0xff);
+    std::fill(d.sliceCornerPrune, std::end(d.sliceCornerPrune), 0xff);
+    std::fill(d.sliceEdgePrune, std::end(d.sliceEdgePrune), 0xff);
+    setData(owned);
+
+    generateMoves(d, threads);
+    movesReady.store(true, std::memory_order_release);
+    if (generatePrune(d, threads)) {
+        buildSeconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - buildStart).count();
+        done.store(true, std::memory_order_release);
+    }
+}
+
+// An entry not in the table yet is at least as far as the levels done.
+// The level is read first: entries of the levels it covers are then
+// visible, and if i is still unknown it is not one of them.
+int MyTwoPhaseTables::unknownEntry(PruneTable k, size_t i) const
+{
+    const int known = pruneProgress[k].known.load(std::memory_order_acquire);
+    const int v = MyNibbles::get(pruneTables[k], i);
+    return v != MyNibbles::unknown ? v : known;
+}
+
+void MyTwoPhaseTables::generateMoves(Data& d, int threads)
+{
+    constexpr size_t chunk = 1024;
+    parallelFor(C::numTwists, chunk, threads, [&d](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            for (int m = 0; m < C::numMoves; ++m) {
+                C c;
+                c.setTwist(i);
+                c.move(m);
+                d.twistMove[i][m] = c.twist();
+            }
+        }
+    });
+    parallelFor(C::numFlips, chunk, threads, [&d](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            for (int m = 0; m < C::numMoves; ++m) {
+                C c;
+                c.setFlip(i);
+                c.move(m);
+                d.flipMove[i][m] = c.flip();
+            }
+        }
+    });
+    parallelFor(C::numSlicesSorted, chunk, threads,
+                [&d](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            for (int m = 0; m < C::numMoves; ++m) {
+                C c;
+                c.setSliceSorted(i);
+                c.move(m);
+                d.sliceSortedMove[i][m] = c.sliceSorted();
+            }
+        }
+    });
+    parallelFor(C::numCornerPerms, chunk, threads,
+                [&d](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            for (int m = 0; m < C::numMoves; ++m) {
+                C c;
+                c.setCornerPerm(i);
+                c.move(m);
+                d.cornerMove[i][m] = c.cornerPerm();
+            }
+        }
+    });
+    parallelFor(C::numUdEdgePerms, chunk, threads,
+                [&d](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            for (int m = 0; m < C::numMoves; ++m) {
+                d.udEdgeMove[i][m] = 0;
+            }
+            for (int m : phase2Moves) {
+                C c;
+                c.setUdEdgePerm(i);
+                c.move(m);
+                d.udEdgeMove[i][m] = c.udEdgePerm();
+            }
+        }
+    });
+}
+
+// Phase 1 first, the tables every search starts with
+bool MyTwoPhaseTables::generatePrune(Data& d, int threads)
+{
+    return buildPackedPruneTable<MyNibbles>(
+        d.sliceTwistPrune, size_t(C::numSlices) * C::numTwists, allMoves,
+        C::numMoves, threads, pruneProgress[SLICE_TWIST], stop,
+        [&d](size_t i, int m) {
+        const int slice = d.sliceSortedMove[i / C::numTwists * 24][m] / 24;
+        return size_t(slice) * C::numTwists
+             + d.twistMove[i % C::numTwists][m];
+    }) && buildPackedPruneTable<MyNibbles>(
+        d.sliceFlipPrune, size_t(C::numSlices) * C::numFlips, allMoves,
+        C::numMoves, threads, pruneProgress[SLICE_FLIP], stop,
+        [&d](size_t i, int m) {
+        const int slice = d.sliceSortedMove[i / C::numFlips * 24][m] / 24;
+        return size_t(slice) * C::numFlips
+             + d.flipMove[i % C::numFlips][m];
+    }) && buildPackedPruneTable<MyNibbles>(
+        d.sliceCornerPrune, size_t(numSlicePerms) * C::numCornerPerms,
+        phase2Moves, numPhase2Moves, threads, pruneProgress[SLICE_CORNER],
+        stop, [&d](size_t i, int m) {
+        const int slice = d.sliceSortedMove[i / C::numCornerPerms][m];
+        return size_t(slice) * C::numCornerPerms
+             + d.cornerMove[i % C::numCornerPerms][m];
+    }) && buildPackedPruneTable<MyNibbles>(
+        d.sliceEdgePrune, size_t(numSlicePerms) * C::numUdEdgePerms,
+        phase2Moves, numPhase2Moves, threads, pruneProgress[SLICE_EDGE],
+        stop, [&d](size_t i, int m) {
+        const int slice = d.sliceSortedMove[i / C::numUdEdgePerms][m];
+        return size_t(slice) * C::numUdEdgePerms
+             + d.udEdgeMove[i % C::numUdEdgePerms][m];
+    });
+}
+
+MyTwoPhaseSolver::Result MyTwoPhaseSolver::solve(
+    const MyCubieCube& cube, int maxLen, Clock::time_point end,
+    const std::atomic<bool> *cancelFlag, std::string& solution)
+{
+    nodes = 0;
+    solution.clear();
+    if (!cube.isValid()) {
+        return UNSOLVABLE;
+    }
+    start = cube;
+    maxLength = std::min(maxLen, int(sizeof(moves) / sizeof(moves[0])));
+    deadline = end;
+    cancel = cancelFlag;
+    stopped = false;
+
+    const int twist = cube.twist();
+    const int flip = cube.flip();
+    const int slice = cube.sliceSorted();
+    const int bound = tables.phase1Distance(twist, flip, slice);
+    for (int depth = bound; depth <= maxLength; ++depth) {
+        if (search1(twist, flip, slice, depth, 0)) {
+            solution = MyCubieCube::formatMoves(moves, length);
+            return SOLVED;
+        }
+        if (stopped) {
+            return stopReason;
+        }
+    }
+    return UNSOLVABLE;
+}
+
+bool MyTwoPhaseSolver::checkStop()
+{
+    if (cancel && cancel->load(std::memory_order_relaxed)) {
+        stopReason = CANCELLED;
+        stopped = true;
+    }
+    else if (Clock::now() >= deadline) {
+        stopReason = TIMEOUT;
+        stopped = true;
+    }
+    return stopped;
+}
+
+bool MyTwoPhaseSolver::search1(int twist, int flip, int slice, int depth,
+                               int n)
+{
+    if ((++nodes & 4095) == 0 && checkStop()) {
+        return false;
+    }
+    if (depth == 0) {
+        // In the subgroup: the phase 1 moves must end with a quarter turn
+        // of R, F, L or B, otherwise a shorter phase 1 got here already
+        if (twist != 0 || flip != 0 || slice >= 24
+         || (n > 0 && isPhase2Move(moves[n - 1]))) {
+            return false;
+        }
+
+        MyCubieCube c = start;
+        for (int i = 0; i < n; ++i) {
+            c.move(moves[i]);
+        }
+        const int corner = c.cornerPerm();
+        const int edge = c.udEdgePerm();
+        const int bound = tables.phase2Distance(corner, edge, slice);
+        // Long phase 2 searches cost more than a longer phase 1
+        const int maxDepth2 = std::min(10, maxLength - n);
+        for (int depth2 = bound; depth2 <= maxDepth2; ++depth2) {
+            const int found = search2(corner, edge, slice, depth2, n);
+            if (found >= 0) {
+                length = found;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    for (int m = 0; m < C::numMoves; ++m) {
+        if (n > 0 && C::redundantAfter(m, moves[n - 1])) {
+            continue;
+        }
+        const int twist2 = t.twistMove[twist][m];
+        const int flip2 = t.flipMove[flip][m];
+        const int slice2 = t.sliceSortedMove[slice][m];
+        const int dist = tables.phase1Distance(twist2, flip2, slice2);
+        if (dist >= depth) {
+            continue;
+        }
+        moves[n] = m;
+        if (search1(twist2, flip2, slice2, depth - 1, n + 1)) {
+            return true;
+        }
+        if (stopped) {
+            return false;
+        }
+    }
+    return false;
+}
+
+int MyTwoPhaseSolver::search2(int corner, int edge, int slice, int depth,
+                              int n)
+{
+    ++nodes;
+    if (depth == 0) {
+        return corner == 0 && edge == 0 && slice == 0 ? n : -1;
+    }
+    for (int m : phase2Moves) {
+        if (n > 0 && C::redundantAfter(m, moves[n - 1])) {
+            continue;
+        }
+        const int corner2 = t.cornerMove[corner][m];
+        const int edge2 = t.udEdgeMove[edge][m];
+        const int slice2 = t.sliceSortedMove[slice][m];
+        const int dist = tables.phase2Distance(corner2, edge2, slice2);
+        if (dist >= depth) {
+            continue;
+        }
+        moves[n] = m;
+        const int found = search2(corner2, edge2, slice2, depth - 1, n + 1);
+        if (found >= 0) {
+            return found;
+        }
+    }
+    return -1;
+}
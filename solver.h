@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "cubesolver.h"
+#include "cubiecube.h"
+#include "prunetable.h"
+#include "tablefile.h"
+
+// Move and pruning tables of the two-phase solver, about 5.5 MB. Built on
+// first use and saved to a file that later runs, and every other process
+// using the same file, map read-only: the pages are shared through the
+// page cache instead of each solver process holding its own copy.
+//
+// The viewer builds them in the background instead: the move tables
+// first, then the pruning tables level by level. Solving can start as
+// soon as the move tables are ready; entries not found yet read as the
+// last level completed, a weaker but still admissible bound.
+struct MyTwoPhaseTables {
+    typedef MyCubieCube C;
+    static constexpr int numSlicePerms = 24;
+
+    enum PruneTable {
+        SLICE_TWIST,
+        SLICE_FLIP,
+        SLICE_CORNER,
+        SLICE_EDGE,
+        NUM_PRUNE_TABLES
+    };
+
+    struct Data {
+        // Coordinate after each of the 18 moves; the phase 2 coordinates
+        // only for the phase 2 moves
+        uint16_t twistMove[C::numTwists][C::numMoves];
+        uint16_t flipMove[C::numFlips][C::numMoves];
+        uint16_t sliceSortedMove[C::numSlicesSorted][C::numMoves];
+        uint16_t cornerMove[C::numCornerPerms][C::numMoves];
+        uint16_t udEdgeMove[C::numUdEdgePerms][C::numMoves];
+
+        // Moves to solve, a lower bound of the distance: phase 1 slice
+        // with twist and with flip, phase 2 slice order with corners and
+        // with edges. Nibbles, see prunetable.h.
+        uint8_t sliceTwistPrune[
+            MyNibbles::bytes(C::numSlices * C::numTwists)];
+        uint8_t sliceFlipPrune[
+            MyNibbles::bytes(C::numSlices * C::numFlips)];
+        uint8_t sliceCornerPrune[
+            MyNibbles::bytes(numSlicePerms * C::numCornerPerms)];
+        uint8_t sliceEdgePrune[
+            MyNibbles::bytes(numSlicePerms * C::numUdEdgePerms)];
+    };
+
+    struct Progress {
+        // Pruning table entries found, of total
+        size_t entries = 0;
+        size_t total = 0;
+        // Since the build started, until it ended
+        double seconds = 0.0;
+    };
+
+    MyTwoPhaseTables() = default;
+    MyTwoPhaseTables(MyTwoPhaseTables&) = delete;
+    // Stops a background build
+    ~MyTwoPhaseTables();
+
+    // Maps path, or builds the tables on threads threads and writes them
+    // there first. Null only builds them, in memory.
+    bool load(const char *path, int threads = 1);
+    // Maps path, or starts building the tables on threads threads and
+    // returns at once; they are written to path once complete
+    void loadInBackground(const char *path, int threads);
+    // Whether the move tables are built, what solving needs
+    bool ready() const { return movesReady.load(std::memory_order_acquire); }
+    bool complete() const { return done.load(std::memory_order_acquire); }
+    Progress progress() const;
+
+    // Entry i of a pruning table
+    int prune(PruneTable k, size_t i) const
+    {
+        const int v = MyNibbles::get(pruneTables[k], i);
+        return v != MyNibbles::unknown ? v : unknownEntry(k, i);
+    }
+    // Lower bounds of the moves to the phase 2 subgroup, and in it of the
+    // moves to solved
+    int phase1Distance(int twist, int flip, int sliceSorted) const
+    {
+        const int s = sliceSorted / numSlicePerms;
+        return std::max(prune(SLICE_TWIST, s * C::numTwists + twist),
+                        prune(SLICE_FLIP, s * C::numFlips + flip));
+    }
+    int phase2Distance(int corner, int edge, int sliceSorted) const
+    {
+        return std::max(
+            prune(SLICE_CORNER, sliceSorted * C::numCornerPerms + corner),
+            prune(SLICE_EDGE, sliceSorted * C::numUdEdgePerms + edge));
+    }
+
+    const Data *data = nullptr;
+
+  private:
+    void setData(const Data *d);
+    void build(int threads);
+    void generateMoves(Data& d, int threads);
+    bool generatePrune(Data& d, int threads);
+    int unknownEntry(PruneTable k, size_t i) const;
+
+    MyTableFile file;
+    Data *owned = nullptr;
+    const uint8_t *pruneTables[NUM_PRUNE_TABLES] = {};
+
+    std::thread builder;
+    std::atomic<bool> stop{false};
+    std::atomic<bool> movesReady{false};
+    std::atomic<bool> done{false};
+    MyPruneProgress pruneProgress[NUM_PRUNE_TABLES];
+    std::chrono::steady_clock::time_point buildStart;
+    std::atomic<double> buildSeconds{0.0};
+};
+
+// Kociemba's two-phase algorithm: IDA* down to the subgroup
+// <U, D, R2, F2, L2, B2> (corners and edges oriented, slice edges in the
+// slice), then IDA* within it. Returns the first solution of at most
+// maxLength moves. With 21, solverd --bench 500 --clients 1 measured a
+// median of 8.5 ms, 306 ms at the 99th percentile and 700 ms at worst,
+// and the median was 26 ms on a slower machine.
+// Thread-safe, any number of solvers share one set of tables, from the
+// time they are ready().
+struct MyTwoPhaseSolver : MySolver {
+    explicit MyTwoPhaseSolver(const MyTwoPhaseTables& tables)
+        : tables(tables), t(*tables.data) {}
+    MyTwoPhaseSolver(MyTwoPhaseSolver&) = delete;
+
+    Result solve(const MyCubieCube& cube, int maxLength,
+                 Clock::time_point deadline, const std::atomic<bool> *cancel,
+                 std::string& solution) override;
+
+  private:
+    bool search1(int twist, int flip, int slice, int depth, int n);
+    int search2(int corner, int edge, int slice, int depth, int n);
+    bool checkStop();
+
+    const MyTwoPhaseTables& tables;
+    const MyTwoPhaseTables::Data& t;
+    MyCubieCube start;
+    int moves[32];
+    int maxLength = 0;
+    int length = 0;
+    Clock::time_point deadline;
+    const std::atomic<bool> *cancel = nullptr;
+    Result stopReason = SOLVED;
+    bool stopped = false;
+};
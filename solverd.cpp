@@ -0,0 +1,1242 @@
+// Solver service: loads the two-phase tables once (mapped, shared with the
+// other solver processes) and answers solve requests from any number of
+// clients over a Unix domain socket, on a pool of worker threads. Text
+// protocol, one command per line:
+//
+//   solve <id> <54 facelets> [max <moves>] [deadline <ms>]
+//                   facelets as written by MyRubik::facelets, the viewer's
+//                   control socket "state" answer works as is; id is any
+//                   word, unique among the client's pending requests;
+//                   max is 1 to 45, deadline up to an hour
+//   cancel <id>
+//   stats           "stats received <n> solved <n> timeouts <n> cancelled
+//                   <n> rejected <n> queued <n> p50_ms <x> p99_ms <x>",
+//                   percentiles over the last 4096 solutions
+//   ping            "pong"
+//
+// Every solve gets exactly one answer, in completion order:
+//
+//   solution <id> <ms> <moves>   ms from receive to answer, moves in the
+//                                cube's own frame, MyRubik::applyMoves
+//                                plays them back
+//   timeout <id>                 deadline passed, queued or searching
+//   cancelled <id>
+//   busy <id>                    queue full, try again later
+//   error <id> <reason>
+//
+// --solver thistlethwaite answers from the Thistlethwaite solver's 240 KB
+// of tables instead of the two-phase solver's 5.5 MB file: ready at once,
+// solutions of about 31 moves.
+//
+// With --endgame-depth D, cubes up to D + 2 moves from solved are answered
+// with a shortest solution from an endgame table (endgame-<D>.table, built
+// if missing) instead of the two-phase search.
+//
+// With --bench the same binary is a load generator instead: concurrent
+// clients solving random cubes against a running service, with the
+// request rate and latency percentiles printed at the end. With
+// --scramble N it writes N uniformly random cubes (or with
+// --scramble-moves, random move sequences) to stdout, one per line, for
+// other tools to read, or with --output to a binary state file, which
+// --dump writes back out as text.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cubiecube.h"
+#include "endgame.h"
+#include "scramble.h"
+#include "solver.h"
+#include "statefile.h"
+#include "thistlethwaite.h"
+
+using namespace std;
+
+namespace {
+typedef chrono::steady_clock Clock;
+
+#ifdef MSG_NOSIGNAL
+constexpr int sendFlags = MSG_NOSIGNAL;
+#else
+constexpr int sendFlags = 0;
+#endif
+
+volatile sig_atomic_t quitRequested = 0;
+
+void onSignal(int)
+{
+    quitRequested = 1;
+}
+
+double msSince(Clock::time_point t)
+{
+    return chrono::duration<double, milli>(Clock::now() - t).count();
+}
+
+bool setNonBlocking(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+bool socketAddress(const char *path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    return true;
+}
+
+// p in [0, 1] of sorted values
+double percentile(const vector<double>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    return sorted[min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+// A request's max: 1 to 45 moves, the most any of the solvers needs
+bool parseLength(const char *s, int& length)
+{
+    char *end;
+    errno = 0;
+    const long v = strtol(s, &end, 10);
+    if (end == s || *end || errno || v < 1 || v > 45) {
+        return false;
+    }
+    length = int(v);
+    return true;
+}
+
+// A request's deadline: more than 0 and up to an hour, in ms
+bool parseDeadline(const char *s, double& ms)
+{
+    char *end;
+    const double v = strtod(s, &end);
+    if (end == s || *end || !(v > 0.0) || v > 3600.0 * 1000.0) {
+        return false;
+    }
+    ms = v;
+    return true;
+}
+
+struct MyOptions {
+    const char *socketPath = "/tmp/cubesolver.sock";
+    const char *tables = "twophase.tables";
+    int threads = 0;
+    // Thistlethwaite's instead of the two-phase solver
+    bool thistlethwaite = false;
+    // Queued requests before answering busy
+    int maxQueue = 256;
+    // 0 for the solver's own: 21, or 45 for Thistlethwaite's
+    int maxLength = 0;
+    double deadlineMs = 5000.0;
+    // Of the endgame table, 0 for none
+    int endgameDepth = 0;
+
+    // Load generator
+    int benchRequests = 0;
+    int benchClients = 8;
+    // Requests in flight per client
+    int benchPipeline = 1;
+    unsigned seed = 1;
+    // Coordinate kernels, in this process
+    int benchCoords = 0;
+    // Scrambles written to stdout: random cubes as facelets, or random
+    // move sequences of scrambleMoves moves
+    int scrambles = 0;
+    int scrambleMoves = 0;
+    // Scrambles to this state file (see statefile.h) instead
+    const char *output = nullptr;
+    // State file written out as text, facelets and moves
+    const char *dump = nullptr;
+};
+
+struct MySolverDaemon {
+    MySolverDaemon(const MyOptions& o) : options(o) {}
+    MySolverDaemon(MySolverDaemon&) = delete;
+
+    bool start();
+    void run();
+    void stop();
+
+  private:
+    struct Job {
+        unsigned long long client;
+        string id;
+        MyCubieCube cube;
+        int maxLength;
+        Clock::time_point received;
+        Clock::time_point deadline;
+        atomic<bool> cancelled{false};
+    };
+    struct Answer {
+        unsigned long long client;
+        string id;
+        string line;
+        MySolver::Result result;
+        double ms;
+    };
+    struct Client {
+        int fd;
+        unsigned long long serial;
+        string in;
+        string out;
+    };
+
+    void workerLoop();
+    void finish(const Job& job, MySolver::Result r,
+                const string& solution);
+    bool receive(Client& c, vector<shared_ptr<Job>>& batch);
+    void runCommand(Client& c, char *line, vector<shared_ptr<Job>>& batch);
+    void enqueue(vector<shared_ptr<Job>>& batch);
+    void deliverAnswers();
+    bool flush(Client& c);
+    Client *findClient(unsigned long long serial);
+    void dropClient(Client& c);
+    void addLatency(double ms);
+
+    const MyOptions& options;
+    MyTwoPhaseTables tables;
+    MyThistlethwaiteTables smallTables;
+    MyEndgameTable endgame;
+    int listenFd = -1;
+    // Workers wake the poll loop through it when answers are ready
+    int wakePipe[2] = { -1, -1 };
+    vector<Client> clients;
+    unsigned long long nextSerial = 1;
+
+    // Requests not answered yet, by client and id, for cancel
+    map<pair<unsigned long long, string>, shared_ptr<Job>> pending;
+
+    mutex queueMutex;
+    condition_variable queueCond;
+    deque<shared_ptr<Job>> queue;
+    bool stopping = false;
+    vector<thread> workers;
+
+    mutex answerMutex;
+    vector<Answer> answers;
+
+    // Statistics, poll loop only
+    unsigned long long received = 0;
+    unsigned long long solved = 0;
+    unsigned long long timeouts = 0;
+    unsigned long long cancelled = 0;
+    unsigned long long rejected = 0;
+    unsigned long long errors = 0;
+    // Of the last latencyWindow solutions, a ring once full, and the
+    // sorted copy stats makes of it, both reserved up front
+    static constexpr size_t latencyWindow = 4096;
+    vector<double> latencies;
+    vector<double> sortedLatencies;
+    size_t nextLatency = 0;
+    double maxLatencyMs = 0.0;
+    Clock::time_point startTime;
+};
+
+bool MySolverDaemon::start()
+{
+    const Clock::time_point t = Clock::now();
+    const int buildThreads = max(1u, thread::hardware_concurrency());
+    if (options.thistlethwaite) {
+        smallTables.build();
+        printf("solver tables ready in %.0fms (Thistlethwaite, %.0f KB)\n",
+               msSince(t), sizeof(MyThistlethwaiteTables::Data) / 1024.0);
+    }
+    else if (!tables.load(options.tables, buildThreads)) {
+        return false;
+    }
+    else {
+        printf("solver tables ready in %.0fms (%s)\n", msSince(t),
+               options.tables ? options.tables : "memory");
+    }
+    if (options.endgameDepth) {
+        const Clock::time_point e = Clock::now();
+        const string path = "endgame-" + to_string(options.endgameDepth)
+                          + ".table";
+        if (!endgame.load(path.c_str(), options.endgameDepth,
+                          buildThreads)) {
+            return false;
+        }
+        printf("endgame table ready in %.0fms (%s)\n", msSince(e),
+               path.c_str());
+    }
+
+    sockaddr_un addr;
+    if (!socketAddress(options.socketPath, addr)) {
+        return false;
+    }
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        printf("socket failed: %s\n", strerror(errno));
+        return false;
+    }
+    unlink(options.socketPath);
+    if (bind(listenFd, (const sockaddr *) &addr, sizeof(addr)) != 0
+     || listen(listenFd, 64) != 0 || !setNonBlocking(listenFd)
+     || pipe(wakePipe) != 0 || !setNonBlocking(wakePipe[0])
+     || !setNonBlocking(wakePipe[1])) {
+        printf("%s: %s\n", options.socketPath, strerror(errno));
+        return false;
+    }
+
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = max(1u, thread::hardware_concurrency());
+    }
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back(&MySolverDaemon::workerLoop, this);
+    }
+    printf("%d solver threads, listening on %s\n", threads,
+           options.socketPath);
+    latencies.reserve(latencyWindow);
+    sortedLatencies.reserve(latencyWindow);
+    startTime = Clock::now();
+    return true;
+}
+
+void MySolverDaemon::run()
+{
+    vector<pollfd> fds;
+    vector<shared_ptr<Job>> batch;
+    while (!quitRequested) {
+        fds.resize(clients.size() + 2);
+        fds[0] = { listenFd, POLLIN, 0 };
+        fds[1] = { wakePipe[0], POLLIN, 0 };
+        for (size_t i = 0; i < clients.size(); ++i) {
+            // Back-pressure: a client not reading its answers is not read
+            // either until they are out
+            short events = clients[i].out.size() < 65536 ? POLLIN : 0;
+            if (!clients[i].out.empty()) {
+                events |= POLLOUT;
+            }
+            fds[i + 2] = { clients[i].fd, events, 0 };
+        }
+        if (::poll(fds.data(), fds.size(), 200) <= 0) {
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char buf[256];
+            while (read(wakePipe[0], buf, sizeof(buf)) > 0) {
+            }
+            deliverAnswers();
+        }
+
+        // Everything read in this round goes to the workers in one go
+        batch.clear();
+        vector<Client> kept;
+        kept.reserve(clients.size() + 1);
+        for (size_t i = 0; i < clients.size(); ++i) {
+            Client& c = clients[i];
+            bool ok = true;
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ok = receive(c, batch);
+            }
+            if (ok) {
+                ok = flush(c);
+            }
+            if (ok) {
+                kept.push_back(move(c));
+            }
+            else {
+                dropClient(c);
+            }
+        }
+        clients.swap(kept);
+        enqueue(batch);
+
+        if (fds[0].revents & POLLIN) {
+            for (;;) {
+                const int fd = accept(listenFd, nullptr, nullptr);
+                if (fd < 0) {
+                    break;
+                }
+                if (!setNonBlocking(fd)) {
+                    close(fd);
+                    continue;
+                }
+                Client c;
+                c.fd = fd;
+                c.serial = nextSerial++;
+                clients.push_back(move(c));
+            }
+        }
+    }
+}
+
+void MySolverDaemon::stop()
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+        queue.clear();
+    }
+    queueCond.notify_all();
+    for (auto& p : pending) {
+        p.second->cancelled = true;
+    }
+    for (thread& w : workers) {
+        w.join();
+    }
+    workers.clear();
+    for (Client& c : clients) {
+        close(c.fd);
+    }
+    clients.clear();
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(options.socketPath);
+        listenFd = -1;
+    }
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+
+    const double seconds = msSince(startTime) / 1000.0;
+    sort(latencies.begin(), latencies.end());
+    // Of the last latencyWindow solutions, but the max of all
+    printf("solverd: %llu requests in %.1fs: %llu solved, %llu timeouts, "
+           "%llu cancelled, %llu busy, %llu errors\n", received, seconds,
+           solved, timeouts, cancelled, rejected, errors);
+    printf("solverd: latency p50 %.2fms p99 %.2fms max %.2fms\n",
+           percentile(latencies, 0.5), percentile(latencies, 0.99),
+           maxLatencyMs);
+}
+
+void MySolverDaemon::addLatency(double ms)
+{
+    maxLatencyMs = max(maxLatencyMs, ms);
+    if (latencies.size() < latencyWindow) {
+        latencies.push_back(ms);
+    }
+    else {
+        latencies[nextLatency] = ms;
+        nextLatency = (nextLatency + 1) % latencyWindow;
+    }
+}
+
+void MySolverDaemon::workerLoop()
+{
+    unique_ptr<MySolver> solver;
+    if (options.thistlethwaite) {
+        solver.reset(new MyThistlethwaiteSolver(smallTables));
+    }
+    else {
+        solver.reset(new MyTwoPhaseSolver(tables));
+    }
+    string solution;
+    vector<int> moves;
+    for (;;) {
+        shared_ptr<Job> job;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueCond.wait(lock, [this] {
+                return stopping || !queue.empty();
+            });
+            if (stopping) {
+                return;
+            }
+            job = move(queue.front());
+            queue.pop_front();
+        }
+
+        MySolver::Result r = MySolver::TIMEOUT;
+        solution.clear();
+        if (job->cancelled) {
+            r = MySolver::CANCELLED;
+        }
+        // A few moves past the table: a search of a few hundred cubes
+        else if (endgame.depth()
+              && endgame.solve(job->cube, moves,
+                               min(job->maxLength, endgame.depth() + 2))) {
+            solution = MyCubieCube::formatMoves(moves.data(), moves.size());
+            r = MySolver::SOLVED;
+        }
+        else if (Clock::now() < job->deadline) {
+            r = solver->solve(job->cube, job->maxLength, job->deadline,
+                             &job->cancelled, solution);
+        }
+        finish(*job, r, solution);
+    }
+}
+
+void MySolverDaemon::finish(const Job& job, MySolver::Result r,
+                            const string& solution)
+{
+    Answer a;
+    a.client = job.client;
+    a.id = job.id;
+    a.result = r;
+    a.ms = msSince(job.received);
+    char ms[32];
+    switch (r) {
+      case MySolver::SOLVED:
+        snprintf(ms, sizeof(ms), "%.3f", a.ms);
+        a.line = "solution " + job.id + " " + ms;
+        // A solved cube has no moves, and gets no separator for them
+        if (!solution.empty()) {
+            a.line += " " + solution;
+        }
+        a.line += "\n";
+        break;
+      case MySolver::TIMEOUT:
+        a.line = "timeout " + job.id + "\n";
+        break;
+      case MySolver::CANCELLED:
+        a.line = "cancelled " + job.id + "\n";
+        break;
+      case MySolver::UNSOLVABLE:
+        a.line = "error " + job.id + " no solution within "
+               + to_string(job.maxLength) + " moves\n";
+        break;
+    }
+
+    bool wake;
+    {
+        lock_guard<mutex> lock(answerMutex);
+        wake = answers.empty();
+        answers.push_back(move(a));
+    }
+    if (wake) {
+        const char c = 0;
+        if (write(wakePipe[1], &c, 1) < 0) {
+            // Full: the poll loop is already woken up
+        }
+    }
+}
+
+void MySolverDaemon::deliverAnswers()
+{
+    vector<Answer> ready;
+    {
+        lock_guard<mutex> lock(answerMutex);
+        ready.swap(answers);
+    }
+    for (Answer& a : ready) {
+        pending.erase(make_pair(a.client, a.id));
+        switch (a.result) {
+          case MySolver::SOLVED:
+            ++solved;
+            addLatency(a.ms);
+            break;
+          case MySolver::TIMEOUT:
+            ++timeouts;
+            break;
+          case MySolver::CANCELLED:
+            ++cancelled;
+            break;
+          case MySolver::UNSOLVABLE:
+            ++errors;
+            break;
+        }
+        // Gone clients just lose their answers
+        if (Client *c = findClient(a.client)) {
+            c->out += a.line;
+        }
+    }
+}
+
+bool MySolverDaemon::receive(Client& c, vector<shared_ptr<Job>>& batch)
+{
+    char buf[16384];
+    bool open = true;
+    for (;;) {
+        const ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c.in.append(buf, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            open = false;
+        }
+        break;
+    }
+
+    size_t start = 0;
+    for (;;) {
+        const size_t end = c.in.find('\n', start);
+        if (end == string::npos) {
+            break;
+        }
+        c.in[end] = '\0';
+        runCommand(c, &c.in[start], batch);
+        start = end + 1;
+    }
+    c.in.erase(0, start);
+    return open && c.in.size() <= 4096;
+}
+
+void MySolverDaemon::runCommand(Client& c, char *line,
+                                vector<shared_ptr<Job>>& batch)
+{
+    constexpr const char *sep = " \t\r";
+    const char *command = strtok(line, sep);
+    if (!command) {
+        return;
+    }
+    if (!strcmp(command, "ping")) {
+        c.out += "pong\n";
+        return;
+    }
+    if (!strcmp(command, "stats")) {
+        sortedLatencies.assign(latencies.begin(), latencies.end());
+        sort(sortedLatencies.begin(), sortedLatencies.end());
+        size_t queued;
+        {
+            lock_guard<mutex> lock(queueMutex);
+            queued = queue.size();
+        }
+        char reply[256];
+        snprintf(reply, sizeof(reply), "stats received %llu solved %llu "
+                 "timeouts %llu cancelled %llu rejected %llu queued %zu "
+                 "p50_ms %.3f p99_ms %.3f\n", received, solved, timeouts,
+                 cancelled, rejected, queued,
+                 percentile(sortedLatencies, 0.5),
+                 percentile(sortedLatencies, 0.99));
+        c.out += reply;
+        return;
+    }
+
+    const char *id = strtok(nullptr, sep);
+    if (!id) {
+        c.out += "error - invalid command\n";
+        return;
+    }
+    const auto key = make_pair(c.serial, string(id));
+    if (!strcmp(command, "cancel")) {
+        auto it = pending.find(key);
+        if (it != pending.end()) {
+            it->second->cancelled = true;
+        }
+        return;
+    }
+    if (strcmp(command, "solve")) {
+        c.out += "error - invalid command\n";
+        return;
+    }
+
+    ++received;
+    auto job = make_shared<Job>();
+    job->client = c.serial;
+    job->id = id;
+    job->maxLength = options.maxLength;
+    job->received = Clock::now();
+    double deadlineMs = options.deadlineMs;
+    const char *facelets = strtok(nullptr, sep);
+    const bool valid = facelets && job->cube.fromFacelets(facelets);
+    bool validOptions = true;
+    while (const char *option = strtok(nullptr, sep)) {
+        const char *value = strtok(nullptr, sep);
+        if (!value) {
+            validOptions = false;
+        }
+        else if (!strcmp(option, "max")) {
+            validOptions &= parseLength(value, job->maxLength);
+        }
+        else if (!strcmp(option, "deadline")) {
+            validOptions &= parseDeadline(value, deadlineMs);
+        }
+        else {
+            validOptions = false;
+        }
+    }
+    if (!valid || !validOptions) {
+        ++errors;
+        c.out += "error " + job->id
+               + (valid ? " invalid option\n" : " invalid cube\n");
+        return;
+    }
+    if (pending.count(key)) {
+        ++errors;
+        c.out += "error " + job->id + " duplicate id\n";
+        return;
+    }
+    job->deadline = job->received
+                  + chrono::microseconds(int64_t(deadlineMs * 1000.0));
+    pending[key] = job;
+    batch.push_back(move(job));
+}
+
+void MySolverDaemon::enqueue(vector<shared_ptr<Job>>& batch)
+{
+    if (batch.empty()) {
+        return;
+    }
+    vector<shared_ptr<Job>> refused;
+    {
+        lock_guard<mutex> lock(queueMutex);
+        for (shared_ptr<Job>& job : batch) {
+            if (queue.size() < size_t(options.maxQueue)) {
+                queue.push_back(job);
+            }
+            else {
+                refused.push_back(job);
+            }
+        }
+    }
+    if (batch.size() - refused.size() > 1) {
+        queueCond.notify_all();
+    }
+    else if (refused.size() < batch.size()) {
+        queueCond.notify_one();
+    }
+
+    for (shared_ptr<Job>& job : refused) {
+        ++rejected;
+        pending.erase(make_pair(job->client, job->id));
+        if (Client *c = findClient(job->client)) {
+            c->out += "busy " + job->id + "\n";
+            flush(*c);
+        }
+    }
+}
+
+bool MySolverDaemon::flush(Client& c)
+{
+    while (!c.out.empty()) {
+        const ssize_t n = send(c.fd, c.out.data(), c.out.size(), sendFlags);
+        if (n > 0) {
+            c.out.erase(0, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+MySolverDaemon::Client *MySolverDaemon::findClient(unsigned long long serial)
+{
+    for (Client& c : clients) {
+        if (c.serial == serial) {
+            return &c;
+        }
+    }
+    return nullptr;
+}
+
+void MySolverDaemon::dropClient(Client& c)
+{
+    close(c.fd);
+    // Nobody to answer to any more
+    for (auto& p : pending) {
+        if (p.first.first == c.serial) {
+            p.second->cancelled = true;
+        }
+    }
+}
+
+// Load generator: clients solving random cubes as fast as answers come
+int runBench(const MyOptions& options)
+{
+    sockaddr_un addr;
+    if (!socketAddress(options.socketPath, addr)) {
+        return 1;
+    }
+    const int numClients = max(1, options.benchClients);
+    const int pipeline = max(1, options.benchPipeline);
+    atomic<int> nextRequest{0};
+    mutex resultMutex;
+    vector<double> latencies;
+    unsigned long long counts[5] = {};  // solution timeout busy other wrong
+    unsigned long long totalMoves = 0;
+
+    auto client = [&](int index) {
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (const sockaddr *) &addr,
+                              sizeof(addr)) != 0) {
+            printf("Could not connect to %s\n", options.socketPath);
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+        MyRandom random(options.seed * 7919ull + index);
+        map<int, pair<Clock::time_point, MyCubieCube>> inFlight;
+        vector<double> myLatencies;
+        unsigned long long myCounts[5] = {};
+        unsigned long long myMoves = 0;
+        string in;
+        bool done = false;
+        while (!done || !inFlight.empty()) {
+            while (!done && int(inFlight.size()) < pipeline) {
+                const int k = nextRequest++;
+                if (k >= options.benchRequests) {
+                    done = true;
+                    break;
+                }
+                const MyCubieCube cube = MyScrambler::randomCube(random);
+                char facelets[55];
+                cube.toFacelets(facelets);
+                const string line = "solve " + to_string(k) + " "
+                                  + facelets + "\n";
+                inFlight[k] = make_pair(Clock::now(), cube);
+                if (send(fd, line.data(), line.size(), sendFlags)
+                    != ssize_t(line.size())) {
+                    done = true;
+                    inFlight.clear();
+                }
+            }
+            if (inFlight.empty()) {
+                break;
+            }
+
+            // One answer
+            size_t end;
+            while ((end = in.find('\n')) == string::npos) {
+                char buf[4096];
+                const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    printf("bench: connection lost\n");
+                    close(fd);
+                    return;
+                }
+                in.append(buf, n);
+            }
+            string line = in.substr(0, end);
+            in.erase(0, end + 1);
+
+            char kind[16];
+            int k;
+            if (sscanf(line.c_str(), "%15s %d", kind, &k) != 2
+             || !inFlight.count(k)) {
+                ++myCounts[3];
+                continue;
+            }
+            const auto sent = inFlight[k];
+            inFlight.erase(k);
+            if (!strcmp(kind, "solution")) {
+                myLatencies.push_back(msSince(sent.first));
+                // Check it: the moves after the ms
+                const char *moves = line.c_str();
+                for (int field = 0; field < 3 && moves; ++field) {
+                    moves = strchr(moves, ' ');
+                    moves = moves ? moves + 1 : nullptr;
+                }
+                vector<int> ms;
+                MyCubieCube cube = sent.second;
+                if (MyCubieCube::parseMoves(moves ? moves : "", ms)) {
+                    cube.moves(ms);
+                }
+                ++myCounts[cube.isSolved() ? 0 : 4];
+                myMoves += ms.size();
+            }
+            else if (!strcmp(kind, "timeout")) {
+                ++myCounts[1];
+            }
+            else if (!strcmp(kind, "busy")) {
+                ++myCounts[2];
+            }
+            else {
+                ++myCounts[3];
+            }
+        }
+        close(fd);
+
+        lock_guard<mutex> lock(resultMutex);
+        latencies.insert(latencies.end(), myLatencies.begin(),
+                         myLatencies.end());
+        for (int i = 0; i < 5; ++i) {
+            counts[i] += myCounts[i];
+        }
+        totalMoves += myMoves;
+    };
+
+    const Clock::time_point start = Clock::now();
+    vector<thread> threads;
+    for (int i = 0; i < numClients; ++i) {
+        threads.emplace_back(client, i);
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+    const double seconds = msSince(start) / 1000.0;
+
+    sort(latencies.begin(), latencies.end());
+    printf("bench: %d requests, %d clients x %d in flight, %.1fs, "
+           "%.1f solves/s\n", options.benchRequests, numClients, pipeline,
+           seconds, counts[0] / max(seconds, 1e-9));
+    printf("bench: %llu solved (%.2f moves avg), %llu timeouts, %llu busy, "
+           "%llu errors, %llu wrong\n", counts[0],
+           counts[0] ? double(totalMoves) / counts[0] : 0.0, counts[1],
+           counts[2], counts[3], counts[4]);
+    printf("bench: latency p50 %.2fms p90 %.2fms p99 %.2fms max %.2fms\n",
+           percentile(latencies, 0.5), percentile(latencies, 0.9),
+           percentile(latencies, 0.99),
+           latencies.empty() ? 0.0 : latencies.back());
+    return counts[3] + counts[4] == 0 ? 0 : 1;
+}
+
+// FNV-1a over the pieces of the cube each coordinate value sets, from
+// solved: with the round trips, it pins down the numbering
+uint64_t numberingHash(void (MyCubieCube::*set)(int), int size)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int v = 0; v < size; ++v) {
+        MyCubieCube c;
+        (c.*set)(v);
+        const uint8_t *parts[] = { c.cp, c.co, c.ep, c.eo };
+        const int sizes[] = { 8, 8, 12, 12 };
+        for (int p = 0; p < 4; ++p) {
+            for (int i = 0; i < sizes[p]; ++i) {
+                h = (h ^ parts[p][i]) * 0x100000001b3ull;
+            }
+        }
+    }
+    return h;
+}
+
+// Throughput of each coordinate's get and set over random values, which
+// the table builds spend most of their time in, then a table build.
+// Checks first that the coordinates are still numbered as the table
+// files (of the same version) were built with.
+int runCoordBench(const MyOptions& options)
+{
+    typedef MyCubieCube C;
+    struct Coordinate {
+        const char *name;
+        int size;
+        int (C::*get)() const;
+        void (C::*set)(int);
+        uint64_t numbering;
+    };
+    static const Coordinate coordinates[] = {
+        { "twist", C::numTwists, &C::twist, &C::setTwist,
+          0x0804e6fc025cc5d9ull },
+        { "flip", C::numFlips, &C::flip, &C::setFlip,
+          0xa7b589e053f6c325ull },
+        { "sliceSorted", C::numSlicesSorted, &C::sliceSorted,
+          &C::setSliceSorted, 0x41864589384d8885ull },
+        { "cornerPerm", C::numCornerPerms, &C::cornerPerm,
+          &C::setCornerPerm, 0xb1b60a026420eb65ull },
+        { "udEdgePerm", C::numUdEdgePerms, &C::udEdgePerm,
+          &C::setUdEdgePerm, 0xa875f432ba9014e5ull },
+    };
+    int renumbered = 0;
+    for (const Coordinate& k : coordinates) {
+        if (numberingHash(k.set, k.size) != k.numbering) {
+            printf("%s: numbered differently, the table files need a new "
+                   "version\n", k.name);
+            ++renumbered;
+        }
+    }
+    if (renumbered) {
+        return 1;
+    }
+
+    const int n = options.benchCoords;
+    MyRandom random(options.seed);
+    vector<int> values(n);
+    vector<C> cubes(n);
+    int failed = 0;
+    for (const Coordinate& k : coordinates) {
+        for (int& v : values) {
+            v = random.below(k.size);
+        }
+        Clock::time_point t = Clock::now();
+        for (int i = 0; i < n; ++i) {
+            (cubes[i].*k.set)(values[i]);
+        }
+        const double setMs = msSince(t);
+        t = Clock::now();
+        int wrong = 0;
+        for (int i = 0; i < n; ++i) {
+            wrong += (cubes[i].*k.get)() != values[i];
+        }
+        const double getMs = msSince(t);
+        printf("%-12s set %6.1fM/s  get %6.1fM/s%s\n", k.name,
+               n / max(setMs, 1e-6) / 1000.0, n / max(getMs, 1e-6) / 1000.0,
+               wrong ? "  (WRONG)" : "");
+        failed += wrong > 0;
+    }
+
+    const Clock::time_point t = Clock::now();
+    MyTwoPhaseTables tables;
+    tables.load(nullptr, 1);
+    printf("two-phase tables built in %.0fms on one thread\n", msSince(t));
+    return failed ? 1 : 0;
+}
+
+// Generated in bulk on every thread first, timed, then written out
+int runScramble(const MyOptions& options)
+{
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = max(1u, thread::hardware_concurrency());
+    }
+    const size_t n = options.scrambles;
+    const int length = options.scrambleMoves;
+    vector<MyCubieCube> cubes;
+    vector<uint8_t> moves;
+    const Clock::time_point t = Clock::now();
+    if (length > 0) {
+        moves.resize(n * length);
+        MyScrambler::randomMoves(options.seed, length, moves.data(), n,
+                                 threads);
+    }
+    else {
+        cubes.resize(n);
+        MyScrambler::randomCubes(options.seed, cubes.data(), n, threads);
+    }
+    const double ms = msSince(t);
+    fprintf(stderr, "%zu %s in %.1fms, %.2fM/s, %d threads\n", n,
+            length > 0 ? "scrambles" : "cubes", ms,
+            n / max(ms, 1e-6) / 1000.0, threads);
+
+    if (options.output) {
+        if (length > MyStateRecord::maxMoves) {
+            printf("At most %d moves a record\n", MyStateRecord::maxMoves);
+            return 1;
+        }
+        MyStateWriter writer;
+        if (!writer.open(options.output, length > 0 ? MyStateFormat::MOVES
+                                                    : MyStateFormat::STATES)) {
+            return 1;
+        }
+        MyStateRecord record;
+        record.numMoves = length;
+        for (size_t i = 0; i < n; ++i) {
+            if (length > 0) {
+                copy(&moves[i * length], &moves[(i + 1) * length],
+                     record.moves);
+            }
+            else {
+                record.state.cube = cubes[i];
+            }
+            writer.write(record);
+        }
+        return writer.close() ? 0 : 1;
+    }
+
+    string line;
+    for (size_t i = 0; i < n; ++i) {
+        if (length > 0) {
+            line.clear();
+            for (int k = 0; k < length; ++k) {
+                if (k > 0) {
+                    line += ' ';
+                }
+                line += MyCubieCube::moveName(moves[i * length + k]);
+            }
+        }
+        else {
+            char facelets[55];
+            cubes[i].toFacelets(facelets);
+            line = facelets;
+        }
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), stdout);
+    }
+    return 0;
+}
+
+int runDump(const MyOptions& options)
+{
+    MyStateReader reader;
+    if (!reader.open(options.dump)) {
+        return 1;
+    }
+    const Clock::time_point t = Clock::now();
+    MyStateRecord record;
+    size_t n = 0;
+    string line;
+    while (reader.next(record)) {
+        line.clear();
+        if (reader.contents() & MyStateFormat::STATES) {
+            char facelets[55];
+            record.state.cube.toFacelets(facelets);
+            line = facelets;
+        }
+        for (int k = 0; k < record.numMoves; ++k) {
+            if (!line.empty()) {
+                line += ' ';
+            }
+            line += MyCubieCube::moveName(record.moves[k]);
+        }
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), stdout);
+        ++n;
+    }
+    fprintf(stderr, "%zu records in %.1fms\n", n, msSince(t));
+    if (reader.damaged()) {
+        fprintf(stderr, "%s is damaged after record %zu\n", options.dump,
+                n);
+        return 1;
+    }
+    return 0;
+}
+
+void usage(const char *prog)
+{
+    printf("usage: %s [options]\n"
+           "  --socket PATH     Unix socket (/tmp/cubesolver.sock)\n"
+           "  --tables FILE     solver tables, built if missing "
+           "(twophase.tables)\n"
+           "  --threads N       worker threads (cores)\n"
+           "  --solver NAME     two-phase, or thistlethwaite for small "
+           "tables\n"
+           "  --queue N         queued requests before answering busy, at\n"
+           "                    least 1 (256)\n"
+           "  --max-length N    default longest solution, 1 to 45 (21, 45\n"
+           "                    for thistlethwaite)\n"
+           "  --deadline MS     default deadline, up to an hour (5000)\n"
+           "  --endgame-depth D shortest solutions within D + 2 moves from\n"
+           "                    endgame-<D>.table (none)\n"
+           "  --bench N         load generator: N random solves against a\n"
+           "                    running service\n"
+           "  --clients N       bench: concurrent clients (8)\n"
+           "  --pipeline N      bench: requests in flight per client (1)\n"
+           "  --seed N          bench, scramble: random seed (1)\n"
+           "  --bench-coords N  check the coordinates' numbering, time them\n"
+           "                    over N random values, and a table build\n"
+           "  --scramble N      write N uniformly random cubes, as facelets\n"
+           "  --scramble-moves L scramble: random L-move sequences "
+           "instead\n"
+           "  --output FILE     scramble: to a binary state file, not stdout\n"
+           "  --dump FILE       write a state file out as text\n",
+           prog);
+}
+}
+
+int main(int argc, char **argv)
+{
+    MyOptions opts;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasArg = i + 1 < argc;
+        if (!strcmp(argv[i], "--socket") && hasArg) {
+            opts.socketPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--tables") && hasArg) {
+            opts.tables = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--threads") && hasArg) {
+            opts.threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--solver") && hasArg) {
+            const char *name = argv[++i];
+            opts.thistlethwaite = !strcmp(name, "thistlethwaite");
+            if (!opts.thistlethwaite && strcmp(name, "two-phase")) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--queue") && hasArg) {
+            opts.maxQueue = atoi(argv[++i]);
+            if (opts.maxQueue < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        // The same limits as a request's max and deadline
+        else if (!strcmp(argv[i], "--max-length") && hasArg) {
+            if (!parseLength(argv[++i], opts.maxLength)) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--deadline") && hasArg) {
+            if (!parseDeadline(argv[++i], opts.deadlineMs)) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--endgame-depth") && hasArg) {
+            opts.endgameDepth = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--bench") && hasArg) {
+            opts.benchRequests = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--clients") && hasArg) {
+            opts.benchClients = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--pipeline") && hasArg) {
+            opts.benchPipeline = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--bench-coords") && hasArg) {
+            opts.benchCoords = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--scramble") && hasArg) {
+            opts.scrambles = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--scramble-moves") && hasArg) {
+            opts.scrambleMoves = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--output") && hasArg) {
+            opts.output = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--dump") && hasArg) {
+            opts.dump = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--seed") && hasArg) {
+            opts.seed = atoi(argv[++i]);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (opts.maxLength == 0) {
+        opts.maxLength = opts.thistlethwaite
+                       ? MyThistlethwaiteSolver::maxSolutionLength : 21;
+    }
+    if (opts.benchRequests > 0) {
+        return runBench(opts);
+    }
+    if (opts.benchCoords > 0) {
+        return runCoordBench(opts);
+    }
+    if (opts.scrambles > 0) {
+        return runScramble(opts);
+    }
+    if (opts.dump) {
+        return runDump(opts);
+    }
+
+    // Logs go to files, keep them current
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+    MySolverDaemon daemon(opts);
+    if (!daemon.start()) {
+        return 1;
+    }
+    daemon.run();
+    daemon.stop();
+    return 0;
+}
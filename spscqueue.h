@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Unbounded lock-free queue for one producer thread and one consumer
+// thread. Items live in a linked list of fixed size blocks: the producer
+// appends a new block when the last one is full, so a push never fails
+// nor waits, and the consumer frees the blocks it has drained. The only
+// shared state is the pushed and popped counters, each written by one side.
+template <typename T, size_t BlockSize = 64>
+struct MySpscQueue {
+    MySpscQueue()
+    {
+        head = tail = new Block;
+    }
+    MySpscQueue(MySpscQueue&) = delete;
+    ~MySpscQueue()
+    {
+        while (head) {
+            Block *next = head->next.load(std::memory_order_relaxed);
+            delete head;
+            head = next;
+        }
+    }
+
+    // Producer side
+    void push(const T& item)
+    {
+        const size_t n = pushed.load(std::memory_order_relaxed);
+        if (tailIndex == BlockSize) {
+            Block *b = new Block;
+            tail->next.store(b, std::memory_order_relaxed);
+            tail = b;
+            tailIndex = 0;
+        }
+        tail->items[tailIndex++] = item;
+        // Publishes the item and, if any, the new block
+        pushed.store(n + 1, std::memory_order_release);
+    }
+
+    // Consumer side: the next item, nullptr when empty. It stays valid
+    // until the following pop().
+    T *front()
+    {
+        const size_t n = popped.load(std::memory_order_relaxed);
+        if (n == pushed.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        if (headIndex == BlockSize) {
+            Block *next = head->next.load(std::memory_order_relaxed);
+            delete head;
+            head = next;
+            headIndex = 0;
+        }
+        return &head->items[headIndex];
+    }
+
+    bool pop(T& item)
+    {
+        T *f = front();
+        if (!f) {
+            return false;
+        }
+        item = *f;
+        pop();
+        return true;
+    }
+
+    // Drops the front item, which must exist
+    void pop()
+    {
+        ++headIndex;
+        popped.store(popped.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+    }
+
+    // Exact from the consumer thread
+    bool empty() const
+    {
+        return popped.load(std::memory_order_acquire)
+            == pushed.load(std::memory_order_acquire);
+    }
+    size_t size() const
+    {
+        return pushed.load(std::memory_order_acquire)
+             - popped.load(std::memory_order_acquire);
+    }
+
+  private:
+    struct Block {
+        T items[BlockSize];
+        std::atomic<Block *> next{nullptr};
+    };
+
+    // Producer only
+    alignas(64) Block *tail;
+    size_t tailIndex = 0;
+    alignas(64) std::atomic<size_t> pushed{0};
+
+    // Consumer only
+    alignas(64) Block *head;
+    size_t headIndex = 0;
+    alignas(64) std::atomic<size_t> popped{0};
+};
@@ -0,0 +1,698 @@
+#include "statefile.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cube.h"
+
+namespace {
+typedef MyCubieCube C;
+typedef MyStateFormat F;
+
+const char stateMagic[8] = "CUBESTA";
+
+// Little endian, whatever the machine
+void put32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i) {
+        p[i] = uint8_t(v >> (8 * i));
+    }
+}
+
+void put64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i) {
+        p[i] = uint8_t(v >> (8 * i));
+    }
+}
+
+uint32_t get32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+uint64_t get64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+struct Header {
+    uint32_t version;
+    uint32_t contents;
+    uint32_t recordsPerBlock;
+    uint64_t indexOffset;
+
+    void write(uint8_t *p) const
+    {
+        memset(p, 0, F::headerSize);
+        memcpy(p, stateMagic, sizeof(stateMagic));
+        put32(p + 8, version);
+        put32(p + 12, contents);
+        put32(p + 16, recordsPerBlock);
+        put64(p + 24, indexOffset);
+    }
+    bool read(const uint8_t *p)
+    {
+        version = get32(p + 8);
+        contents = get32(p + 12);
+        recordsPerBlock = get32(p + 16);
+        indexOffset = get64(p + 24);
+        return !memcmp(p, stateMagic, sizeof(stateMagic))
+            && version == F::version
+            && contents >= 1 && contents <= (F::STATES | F::MOVES)
+            && recordsPerBlock > 0;
+    }
+};
+
+size_t recordSize(uint32_t contents, const uint8_t *p)
+{
+    const size_t state = contents & F::STATES ? sizeof(MyPackedState) : 0;
+    if (!(contents & F::MOVES)) {
+        return state;
+    }
+    return state + 1 + (p[state] * 5 + 7) / 8;
+}
+
+// A direction, or a cubie's place with the center of the cube at 0
+struct Vec {
+    int v[3];
+
+    bool operator==(const Vec& o) const
+    {
+        return v[0] == o.v[0] && v[1] == o.v[1] && v[2] == o.v[2];
+    }
+};
+
+struct Rotation {
+    int m[3][3];
+    MyQuaternion q;
+
+    Vec apply(const Vec& a) const
+    {
+        Vec r;
+        for (int i = 0; i < 3; ++i) {
+            r.v[i] = m[i][0] * a.v[0] + m[i][1] * a.v[1] + m[i][2] * a.v[2];
+        }
+        return r;
+    }
+};
+
+// Nearest of 0, 1/2, 1/sqrt(2) and 1, with the sign
+float snap(float x)
+{
+    static const float values[] = { 0.0f, 0.5f, float(M_SQRT1_2), 1.0f };
+    float best = 0.0f;
+    for (float v : values) {
+        if (fabsf(fabsf(x) - v) < fabsf(fabsf(x) - best)) {
+            best = v;
+        }
+    }
+    return x < 0.0f ? -best : best;
+}
+
+// The matrix of q, false if q does not turn the axes onto axes
+bool matrixOf(const MyQuaternion& q, int m[3][3])
+{
+    static const MyPoint axes[3] = {
+        MyPoint(1, 0, 0), MyPoint(0, 1, 0), MyPoint(0, 0, 1)
+    };
+    for (int j = 0; j < 3; ++j) {
+        const MyPoint r = axes[j].transform(q);
+        const float column[3] = { r.x, r.y, r.z };
+        for (int i = 0; i < 3; ++i) {
+            m[i][j] = int(lroundf(column[i]));
+            if (fabsf(column[i] - m[i][j]) > 0.01f) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The 24 rotations of the cube as integer matrices, m[row][column], and
+// as quaternions with exact components
+struct Rotations {
+    Rotation r[24];
+
+    Rotations()
+    {
+        MyQuaternion quarter[3];
+        quarter[0].setRotation(M_PI / 2, MyPoint(1, 0, 0));
+        quarter[1].setRotation(M_PI / 2, MyPoint(0, 1, 0));
+        quarter[2].setRotation(M_PI / 2, MyPoint(0, 0, 1));
+        // Breadth first from the identity
+        int n = 1;
+        matrixOf(r[0].q, r[0].m);
+        for (int i = 0; i < n; ++i) {
+            for (const MyQuaternion& g : quarter) {
+                MyQuaternion q = g * r[i].q;
+                q = MyQuaternion(snap(q.w), snap(q.x), snap(q.y), snap(q.z));
+                Rotation next;
+                next.q = q;
+                matrixOf(q, next.m);
+                bool seen = false;
+                for (int k = 0; k < n && !seen; ++k) {
+                    seen = !memcmp(r[k].m, next.m, sizeof(next.m));
+                }
+                if (!seen) {
+                    r[n++] = next;
+                }
+            }
+        }
+    }
+
+    // The rotation taking a to b and c to d, a and c not parallel
+    const Rotation *find(const Vec& a, const Vec& b, const Vec& c,
+                         const Vec& d) const
+    {
+        for (const Rotation& k : r) {
+            if (k.apply(a) == b && k.apply(c) == d) {
+                return &k;
+            }
+        }
+        return nullptr;
+    }
+};
+
+const Rotations& rotations()
+{
+    static const Rotations r;
+    return r;
+}
+
+// Outward normals of the faces, in C::Face order
+const Vec faceNormal[6] = {
+    { { 0, 1, 0 } }, { { 1, 0, 0 } }, { { 0, 0, 1 } },
+    { { 0, -1, 0 } }, { { -1, 0, 0 } }, { { 0, 0, -1 } }
+};
+
+// v, square to the face's normal n, after a clockwise quarter turn of
+// the face seen from outside: -(n x v)
+Vec quarterTurn(int face, const Vec& v)
+{
+    const int *n = faceNormal[face].v;
+    return { { n[2] * v.v[1] - n[1] * v.v[2],
+               n[0] * v.v[2] - n[2] * v.v[0],
+               n[1] * v.v[0] - n[0] * v.v[1] } };
+}
+
+// MyRubik's cubies are indexed x, then y, then z from the front
+Vec cubiePosition(int i)
+{
+    return { { i % 3 - 1, i / 3 % 3 - 1, 1 - i / 9 } };
+}
+
+int cubieIndex(const Vec& p)
+{
+    return (p.v[0] + 1) + 3 * (p.v[1] + 1) + 9 * (1 - p.v[2]);
+}
+
+// Faces a position touches, as bits
+int faceBits(const Vec& p)
+{
+    int bits = 0;
+    for (int f = 0; f < 6; ++f) {
+        const int *n = faceNormal[f].v;
+        if (n[0] * p.v[0] + n[1] * p.v[1] + n[2] * p.v[2] == 1) {
+            bits |= 1 << f;
+        }
+    }
+    return bits;
+}
+
+int cornerAt(const Vec& p)
+{
+    const int bits = faceBits(p);
+    for (int c = 0; c < 8; ++c) {
+        const uint8_t *f = C::cornerFaces[c];
+        if ((1 << f[0] | 1 << f[1] | 1 << f[2]) == bits) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+int edgeAt(const Vec& p)
+{
+    const int bits = faceBits(p);
+    for (int e = 0; e < 12; ++e) {
+        const uint8_t *f = C::edgeFaces[e];
+        if ((1 << f[0] | 1 << f[1]) == bits) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+int faceAt(const Vec& p)
+{
+    const int bits = faceBits(p);
+    for (int f = 0; f < 6; ++f) {
+        if (bits == 1 << f) {
+            return f;
+        }
+    }
+    return -1;
+}
+
+// Some direction square to the face's normal
+Vec squareTo(int face)
+{
+    return faceNormal[face == C::U || face == C::D ? C::F : C::U];
+}
+}
+
+bool MyCubeState::fromRubik(const MyRubik& rubik)
+{
+    centers = 0;
+    for (int i = 0; i < 27; ++i) {
+        Rotation r;
+        if (!matrixOf(rubik.qTransforms[i], r.m)) {
+            return false;
+        }
+        const Vec home = cubiePosition(i);
+        const Vec p = r.apply(home);
+        if (rubik.pos[cubieIndex(p)] != i) {
+            return false;
+        }
+        const int corner = cornerAt(home);
+        const int edge = edgeAt(home);
+        const int face = faceAt(home);
+        if (corner >= 0) {
+            const int j = cornerAt(p);
+            const Vec n = r.apply(faceNormal[C::cornerFaces[corner][0]]);
+            cube.cp[j] = corner;
+            cube.co[j] = 0;
+            while (cube.co[j] < 2
+                && !(faceNormal[C::cornerFaces[j][cube.co[j]]] == n)) {
+                ++cube.co[j];
+            }
+        }
+        else if (edge >= 0) {
+            const int j = edgeAt(p);
+            const Vec n = r.apply(faceNormal[C::edgeFaces[edge][0]]);
+            cube.ep[j] = edge;
+            cube.eo[j] = !(faceNormal[C::edgeFaces[j][0]] == n);
+        }
+        else if (face >= 0) {
+            const Vec u = squareTo(face);
+            const Vec turned = r.apply(u);
+            Vec v = u;
+            int spin = 0;
+            while (spin < 4 && !(v == turned)) {
+                v = quarterTurn(face, v);
+                ++spin;
+            }
+            centers |= (spin & 3) << (2 * face);
+        }
+    }
+    return cube.isValid();
+}
+
+void MyCubeState::toRubik(MyRubik& rubik) const
+{
+    const Rotations& all = rotations();
+    for (int i = 0; i < 27; ++i) {
+        const Vec home = cubiePosition(i);
+        const int corner = cornerAt(home);
+        const int edge = edgeAt(home);
+        const int face = faceAt(home);
+        const Rotation *r = &all.r[0];
+        if (corner >= 0) {
+            const int j = std::find(cube.cp, cube.cp + 8, corner) - cube.cp;
+            const uint8_t *from = C::cornerFaces[corner];
+            const uint8_t *to = C::cornerFaces[j];
+            r = all.find(faceNormal[from[0]], faceNormal[to[cube.co[j]]],
+                         faceNormal[from[1]],
+                         faceNormal[to[(cube.co[j] + 1) % 3]]);
+        }
+        else if (edge >= 0) {
+            const int j = std::find(cube.ep, cube.ep + 12, edge) - cube.ep;
+            const uint8_t *from = C::edgeFaces[edge];
+            const uint8_t *to = C::edgeFaces[j];
+            r = all.find(faceNormal[from[0]], faceNormal[to[cube.eo[j]]],
+                         faceNormal[from[1]], faceNormal[to[!cube.eo[j]]]);
+        }
+        else if (face >= 0) {
+            Vec v = squareTo(face);
+            for (int k = 0; k < (centers >> (2 * face) & 3); ++k) {
+                v = quarterTurn(face, v);
+            }
+            r = all.find(faceNormal[face], faceNormal[face], squareTo(face),
+                         v);
+        }
+        rubik.qTransforms[i] = r->q;
+        rubik.mTransforms[i] = r->q.toMatrix();
+        rubik.pos[cubieIndex(r->apply(home))] = i;
+    }
+}
+
+MyPackedState MyPackedState::pack(const MyCubeState& state)
+{
+    const MyCubieCube& c = state.cube;
+    unsigned __int128 v = 0;
+    for (int i = 11; i >= 0; --i) {
+        v = v << 5 | (c.ep[i] * 2 + c.eo[i]);
+    }
+    for (int i = 7; i >= 0; --i) {
+        v = v << 5 | (c.cp[i] * 3 + c.co[i]);
+    }
+    v |= (unsigned __int128) (state.centers & 0xfff) << 100;
+    MyPackedState p;
+    for (int i = 0; i < 16; ++i) {
+        p.bytes[i] = uint8_t(v >> (8 * i));
+    }
+    return p;
+}
+
+bool MyPackedState::unpack(MyCubeState& state) const
+{
+    unsigned __int128 v = 0;
+    for (int i = 15; i >= 0; --i) {
+        v = v << 8 | bytes[i];
+    }
+    MyCubieCube& c = state.cube;
+    for (int i = 0; i < 8; ++i) {
+        const int x = int(v & 31);
+        v >>= 5;
+        c.cp[i] = x / 3;
+        c.co[i] = x % 3;
+    }
+    for (int i = 0; i < 12; ++i) {
+        const int x = int(v & 31);
+        v >>= 5;
+        c.ep[i] = x / 2;
+        c.eo[i] = x % 2;
+    }
+    state.centers = int(v & 0xfff);
+    return (v >> 12) == 0 && c.isValid();
+}
+
+size_t MyStateFormat::encode(uint32_t contents, const MyStateRecord& record,
+                             uint8_t *out)
+{
+    size_t n = 0;
+    if (contents & STATES) {
+        const MyPackedState p = MyPackedState::pack(record.state);
+        memcpy(out, p.bytes, sizeof(p.bytes));
+        n += sizeof(p.bytes);
+    }
+    if (contents & MOVES) {
+        out[n++] = uint8_t(record.numMoves);
+        uint32_t bits = 0;
+        int numBits = 0;
+        for (int i = 0; i < record.numMoves; ++i) {
+            bits |= uint32_t(record.moves[i]) << numBits;
+            numBits += 5;
+            if (numBits >= 8) {
+                out[n++] = uint8_t(bits);
+                bits >>= 8;
+                numBits -= 8;
+            }
+        }
+        if (numBits > 0) {
+            out[n++] = uint8_t(bits);
+        }
+    }
+    return n;
+}
+
+size_t MyStateFormat::decode(uint32_t contents, const uint8_t *in,
+                             size_t size, MyStateRecord& record)
+{
+    size_t n = 0;
+    if (contents & STATES) {
+        MyPackedState p;
+        if (size < sizeof(p.bytes)) {
+            return 0;
+        }
+        memcpy(p.bytes, in, sizeof(p.bytes));
+        if (!p.unpack(record.state)) {
+            return 0;
+        }
+        n += sizeof(p.bytes);
+    }
+    else {
+        record.state = MyCubeState();
+    }
+    record.numMoves = 0;
+    if (contents & MOVES) {
+        if (n + 1 > size) {
+            return 0;
+        }
+        const int numMoves = in[n++];
+        if (n + (numMoves * 5 + 7) / 8 > size) {
+            return 0;
+        }
+        uint32_t bits = 0;
+        int numBits = 0;
+        for (int i = 0; i < numMoves; ++i) {
+            if (numBits < 5) {
+                bits |= uint32_t(in[n++]) << numBits;
+                numBits += 8;
+            }
+            record.moves[i] = bits & 31;
+            bits >>= 5;
+            numBits -= 5;
+            if (record.moves[i] >= C::numMoves) {
+                return 0;
+            }
+        }
+        record.numMoves = numMoves;
+    }
+    return n;
+}
+
+bool MyStateWriter::open(const char *p, uint32_t c)
+{
+    close();
+    file = fopen(p, "wb");
+    if (!file) {
+        printf("Could not open %s\n", p);
+        return false;
+    }
+    path = p;
+    contents = c;
+    count = 0;
+    blocks.clear();
+    buffer.clear();
+    failed = false;
+    // Rewritten with the index offset on close
+    uint8_t header[F::headerSize];
+    Header{F::version, contents, F::recordsPerBlock, 0}.write(header);
+    buffer.insert(buffer.end(), header, header + F::headerSize);
+    offset = F::headerSize;
+    return true;
+}
+
+bool MyStateWriter::write(const MyStateRecord& record)
+{
+    if (!file) {
+        return false;
+    }
+    if (count % F::recordsPerBlock == 0) {
+        blocks.push_back(offset);
+    }
+    uint8_t out[F::maxRecordSize];
+    const size_t n = F::encode(contents, record, out);
+    buffer.insert(buffer.end(), out, out + n);
+    offset += n;
+    ++count;
+    return buffer.size() < (1 << 16) || flush();
+}
+
+bool MyStateWriter::flush()
+{
+    if (!buffer.empty()
+     && fwrite(buffer.data(), buffer.size(), 1, file) != 1) {
+        failed = true;
+    }
+    buffer.clear();
+    return !failed;
+}
+
+bool MyStateWriter::close()
+{
+    if (!file) {
+        return false;
+    }
+    uint8_t word[8];
+    put64(word, count);
+    buffer.insert(buffer.end(), word, word + 8);
+    for (uint64_t b : blocks) {
+        put64(word, b);
+        buffer.insert(buffer.end(), word, word + 8);
+    }
+    flush();
+    uint8_t header[F::headerSize];
+    Header{F::version, contents, F::recordsPerBlock, offset}.write(header);
+    if (fseek(file, 0, SEEK_SET) != 0
+     || fwrite(header, sizeof(header), 1, file) != 1) {
+        failed = true;
+    }
+    if (fclose(file) != 0) {
+        failed = true;
+    }
+    file = nullptr;
+    if (failed) {
+        printf("Could not write %s\n", path.c_str());
+    }
+    return !failed;
+}
+
+bool MyStateReader::open(const char *path)
+{
+    close();
+    file = fopen(path, "rb");
+    if (!file) {
+        printf("Could not open %s\n", path);
+        return false;
+    }
+    uint8_t bytes[F::headerSize];
+    Header header;
+    if (fread(bytes, sizeof(bytes), 1, file) != 1 || !header.read(bytes)) {
+        printf("%s is not a version %u state file\n", path, F::version);
+        close();
+        return false;
+    }
+    fileContents = header.contents;
+    indexed = header.indexOffset != 0;
+    remaining = indexed ? header.indexOffset - F::headerSize : UINT64_MAX;
+    count = 0;
+    if (indexed) {
+        uint8_t word[8];
+        if (fseek(file, long(header.indexOffset), SEEK_SET) != 0
+         || fread(word, sizeof(word), 1, file) != 1
+         || fseek(file, long(F::headerSize), SEEK_SET) != 0) {
+            printf("%s is damaged: no index\n", path);
+            close();
+            return false;
+        }
+        count = get64(word);
+    }
+    records = 0;
+    broken = false;
+    buffer.resize(1 << 16);
+    start = end = 0;
+    return true;
+}
+
+void MyStateReader::close()
+{
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool MyStateReader::next(MyStateRecord& record)
+{
+    if (!file) {
+        return false;
+    }
+    if (end - start < F::maxRecordSize) {
+        std::copy(buffer.begin() + start, buffer.begin() + end,
+                  buffer.begin());
+        end -= start;
+        start = 0;
+        const size_t want = size_t(std::min<uint64_t>(buffer.size() - end,
+                                                      remaining));
+        const size_t got = fread(buffer.data() + end, 1, want, file);
+        end += got;
+        remaining -= got;
+    }
+    if (start == end) {
+        broken = indexed && (remaining > 0 || records != count);
+        return false;
+    }
+    const size_t n = F::decode(fileContents, buffer.data() + start,
+                               end - start, record);
+    if (n == 0) {
+        broken = true;
+        return false;
+    }
+    start += n;
+    ++records;
+    return true;
+}
+
+bool MyStateFile::map(const char *path)
+{
+    unmap();
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= F::headerSize) {
+        p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    base = (const uint8_t *) p;
+    mappedSize = st.st_size;
+
+    Header header;
+    bool ok = header.read(base) && header.indexOffset >= F::headerSize
+           && header.recordsPerBlock == F::recordsPerBlock
+           && header.indexOffset + 8 <= mappedSize;
+    if (ok) {
+        count = get64(base + header.indexOffset);
+        const size_t blocks = (count + F::recordsPerBlock - 1)
+                            / F::recordsPerBlock;
+        ok = header.indexOffset + 8 * (1 + blocks) == mappedSize;
+    }
+    if (!ok) {
+        unmap();
+        return false;
+    }
+    fileContents = header.contents;
+    indexOffset = header.indexOffset;
+    index = base + indexOffset + 8;
+    return true;
+}
+
+void MyStateFile::unmap()
+{
+    if (base) {
+        munmap((void *) base, mappedSize);
+        base = nullptr;
+        mappedSize = 0;
+        count = 0;
+    }
+}
+
+bool MyStateFile::read(size_t i, MyStateRecord& record) const
+{
+    if (i >= count) {
+        return false;
+    }
+    // Skips to record i, sizes only
+    size_t at = get64(index + 8 * (i / F::recordsPerBlock));
+    for (size_t k = i % F::recordsPerBlock; k > 0; --k) {
+        if (at >= indexOffset) {
+            return false;
+        }
+        at += recordSize(fileContents, base + at);
+    }
+    return at < indexOffset
+        && F::decode(fileContents, base + at, indexOffset - at, record) > 0;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "cubiecube.h"
+
+struct MyRubik;
+
+// A cube as the viewer holds it: the corners and edges, and how far each
+// center is turned, which the solvers ignore but MyRubik keeps
+struct MyCubeState {
+    MyCubieCube cube;
+    // 2 bits a face, U in the low bits then R, F, D, L, B: clockwise
+    // quarter turns
+    int centers = 0;
+
+    // False mid-turn, when some cubie is not square to the axes
+    bool fromRubik(const MyRubik& rubik);
+    // Sets pos and the transforms, exactly: no rounding left over from
+    // the turns
+    void toRubik(MyRubik& rubik) const;
+};
+
+// 16 bytes: 5 bits a corner (cp * 3 + co) then an edge (ep * 2 + eo), 12
+// bits of centers, 16 zero bits; little endian whatever the machine
+struct MyPackedState {
+    uint8_t bytes[16];
+
+    static MyPackedState pack(const MyCubeState& state);
+    // False if it is not a reachable cube
+    bool unpack(MyCubeState& state) const;
+};
+
+// A position and the moves found for it, or a scramble, or both
+struct MyStateRecord {
+    static constexpr int maxMoves = 255;
+
+    MyCubeState state;
+    int numMoves = 0;
+    uint8_t moves[maxMoves];
+};
+
+// Corpus files: a header, then records in blocks, then an index of the
+// blocks. What records hold is fixed per file: a packed state, and/or a
+// move count and the moves at 5 bits each, padded to a byte.
+//
+//   header   "CUBESTA", version, contents, records per block, reserved,
+//            index offset (0 until the writer closes)
+//   blocks   records back to back
+//   index    the record count, then the offset of each block
+//
+// Readers stream through the records, or map the file and seek to a
+// record through the index, reading at most a block's worth before it.
+struct MyStateFormat {
+    static constexpr uint32_t version = 1;
+    enum Contents { STATES = 1, MOVES = 2 };
+    static constexpr uint32_t recordsPerBlock = 256;
+    static constexpr size_t headerSize = 32;
+    static constexpr size_t maxRecordSize =
+        sizeof(MyPackedState) + 1 + (MyStateRecord::maxMoves * 5 + 7) / 8;
+
+    // Bytes written to out, at most maxRecordSize
+    static size_t encode(uint32_t contents, const MyStateRecord& record,
+                         uint8_t *out);
+    // Bytes read from in, 0 if size is too short or the record invalid
+    static size_t decode(uint32_t contents, const uint8_t *in, size_t size,
+                         MyStateRecord& record);
+};
+
+struct MyStateWriter {
+    MyStateWriter() = default;
+    MyStateWriter(MyStateWriter&) = delete;
+    ~MyStateWriter() { close(); }
+
+    bool open(const char *path, uint32_t contents);
+    bool write(const MyStateRecord& record);
+    // Writes the index; false if anything failed since open
+    bool close();
+
+  private:
+    bool flush();
+
+    FILE *file = nullptr;
+    std::string path;
+    uint32_t contents = 0;
+    uint64_t offset = 0;
+    uint64_t count = 0;
+    std::vector<uint64_t> blocks;
+    std::vector<uint8_t> buffer;
+    bool failed = false;
+};
+
+struct MyStateReader {
+    MyStateReader() = default;
+    MyStateReader(MyStateReader&) = delete;
+    ~MyStateReader() { close(); }
+
+    bool open(const char *path);
+    void close();
+    uint32_t contents() const { return fileContents; }
+    // False at the end, or on a damaged record
+    bool next(MyStateRecord& record);
+    // Whether next() stopped on a damaged record, or short of the count
+    // in the index, rather than at the end
+    bool damaged() const { return broken; }
+
+  private:
+    FILE *file = nullptr;
+    uint32_t fileContents = 0;
+    // Bytes of records left, the whole file if it has no index
+    uint64_t remaining = 0;
+    // Records the index says there are, and read so far
+    bool indexed = false;
+    uint64_t count = 0;
+    uint64_t records = 0;
+    bool broken = false;
+    std::vector<uint8_t> buffer;
+    size_t start = 0;
+    size_t end = 0;
+};
+
+struct MyStateFile {
+    MyStateFile() = default;
+    MyStateFile(MyStateFile&) = delete;
+    ~MyStateFile() { unmap(); }
+
+    // False if path is missing, of another version, or has no index
+    bool map(const char *path);
+    void unmap();
+
+    uint32_t contents() const { return fileContents; }
+    size_t size() const { return count; }
+    bool read(size_t i, MyStateRecord& record) const;
+
+  private:
+    const uint8_t *base = nullptr;
+    size_t mappedSize = 0;
+    uint32_t fileContents = 0;
+    size_t count = 0;
+    const uint8_t *index = nullptr;
+    size_t indexOffset = 0;
+};
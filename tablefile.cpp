@@ -0,0 +1,87 @@
+#include "tablefile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+}
+
+bool MyTableFile::map(const char *path, const char *magic, uint32_t version,
+                      size_t size)
+{
+    unmap();
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const size_t fileSize = sizeof(Header) + size;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) == fileSize) {
+        p = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    const Header *h = (const Header *) p;
+    if (strncmp(h->magic, magic, sizeof(h->magic)) || h->version != version) {
+        munmap(p, fileSize);
+        return false;
+    }
+    base = p;
+    mappedSize = fileSize;
+    return true;
+}
+
+void MyTableFile::unmap()
+{
+    if (base) {
+        munmap(base, mappedSize);
+        base = nullptr;
+        mappedSize = 0;
+    }
+}
+
+bool MyTableFile::write(const char *path, const char *magic,
+                        uint32_t version, const void *data, size_t size)
+{
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic, std::min(strlen(magic), sizeof(h.magic)));
+    h.version = version;
+
+    std::string tmp = path;
+    tmp += ".tmp" + std::to_string(getpid());
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        printf("Could not open %s\n", tmp.c_str());
+        return false;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+           && fwrite(data, size, 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path) != 0) {
+        printf("Could not write %s\n", path);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+const void *MyTableFile::data() const
+{
+    return base ? (const char *) base + sizeof(Header) : nullptr;
+}
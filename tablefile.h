@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Precomputed solver table in a file: a small header (magic and version)
+// then the raw data, mapped read-only. Every process mapping the same file
+// shares its pages through the page cache, so N solver processes cost the
+// memory of one.
+struct MyTableFile {
+    MyTableFile() = default;
+    MyTableFile(MyTableFile&) = delete;
+    ~MyTableFile() { unmap(); }
+
+    // False if path is missing or holds another table or version
+    bool map(const char *path, const char *magic, uint32_t version,
+             size_t size);
+    void unmap();
+    // Written aside then renamed, so that a concurrent reader never maps
+    // a partial file
+    static bool write(const char *path, const char *magic, uint32_t version,
+                      const void *data, size_t size);
+
+    const void *data() const;
+
+  private:
+    void *base = nullptr;
+    size_t mappedSize = 0;
+};
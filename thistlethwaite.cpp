@@ -0,0 +1,421 @@
+#include "thistlethwaite.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+namespace {
+typedef MyCubieCube C;
+typedef MyThistlethwaiteTables T;
+
+// The moves of each subgroup: all, then without the F and B quarter
+// turns, then without the R and L ones, then half turns
+const int phase1Moves[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                            15, 16, 17 };
+const int phase2Moves[] = { 0, 1, 2, 3, 4, 5, 7, 9, 10, 11, 12, 13, 14, 16 };
+const int phase3Moves[] = { 0, 1, 2, 4, 7, 9, 10, 11, 13, 16 };
+const int phase4Moves[] = { 1, 4, 7, 10, 13, 16 };
+
+// Positions of the edges of each slice, which are also its edges
+const uint8_t sliceEdges[3][4] = {
+    { C::UF, C::UB, C::DF, C::DB },
+    { C::UR, C::UL, C::DR, C::DL },
+    { C::FR, C::FL, C::BL, C::BR }
+};
+
+int slicePerm(const MyCubieCube& cube, int s)
+{
+    int p[4];
+    for (int i = 0; i < 4; ++i) {
+        p[i] = std::find(sliceEdges[s], sliceEdges[s] + 4,
+                         cube.ep[sliceEdges[s][i]]) - sliceEdges[s];
+    }
+    int rank = 0;
+    for (int i = 0; i < 4; ++i) {
+        int smaller = 0;
+        for (int j = i + 1; j < 4; ++j) {
+            smaller += p[j] < p[i];
+        }
+        rank = rank * (4 - i) + smaller;
+    }
+    return rank;
+}
+
+void setSlicePerm(MyCubieCube& cube, int s, int rank)
+{
+    int digits[4];
+    for (int i = 3; i >= 0; --i) {
+        digits[i] = rank % (4 - i);
+        rank /= 4 - i;
+    }
+    // Each position takes the digit-th edge of those left
+    bool used[4] = {};
+    for (int i = 0; i < 4; ++i) {
+        int k = 0;
+        int skip = digits[i];
+        while (used[k] || skip-- > 0) {
+            ++k;
+        }
+        used[k] = true;
+        cube.ep[sliceEdges[s][i]] = sliceEdges[s][k];
+    }
+}
+
+// Bits of the U and D edge positions holding M edges
+int mSliceBits(const MyCubieCube& cube)
+{
+    int bits = 0;
+    for (int i = 0; i < 8; ++i) {
+        if (std::count(sliceEdges[T::M_SLICE], sliceEdges[T::M_SLICE] + 4,
+                       cube.ep[i])) {
+            bits |= 1 << i;
+        }
+    }
+    return bits;
+}
+
+// M edges at bits, S edges in the other U and D positions
+void setMSliceBits(MyCubieCube& cube, int bits)
+{
+    int m = 0;
+    int s = 0;
+    for (int i = 0; i < 8; ++i) {
+        cube.ep[i] = bits >> i & 1 ? sliceEdges[T::M_SLICE][m++]
+                                   : sliceEdges[T::S_SLICE][s++];
+    }
+}
+
+template<typename Entry>
+int indexOf(const Entry *sorted, int n, int value)
+{
+    return std::lower_bound(sorted, sorted + n, value) - sorted;
+}
+}
+
+void MyThistlethwaiteTables::build()
+{
+    Data *d = new Data;
+    generateMoves(*d);
+    generatePrune(*d);
+    owned = d;
+    data = d;
+}
+
+const int *MyThistlethwaiteTables::phaseMoves(int phase, int& n)
+{
+    switch (phase) {
+      case 0:
+        n = sizeof(phase1Moves) / sizeof(phase1Moves[0]);
+        return phase1Moves;
+      case 1:
+        n = sizeof(phase2Moves) / sizeof(phase2Moves[0]);
+        return phase2Moves;
+      case 2:
+        n = sizeof(phase3Moves) / sizeof(phase3Moves[0]);
+        return phase3Moves;
+      default:
+        n = sizeof(phase4Moves) / sizeof(phase4Moves[0]);
+        return phase4Moves;
+    }
+}
+
+MyThistlethwaiteTables::Coords MyThistlethwaiteTables::coords(
+    int phase, const MyCubieCube& cube) const
+{
+    const Data& t = *data;
+    Coords c;
+    switch (phase) {
+      case 0:
+        c.a = cube.flip();
+        break;
+      case 1:
+        c.a = cube.twist();
+        c.b = cube.slice();
+        break;
+      case 2:
+        c.a = coset(t, cube);
+        c.b = std::find(t.mSlices, t.mSlices + numMSlices, mSliceBits(cube))
+            - t.mSlices;
+        break;
+      default:
+        c.a = indexOf(t.halfTurnCorners, numHalfTurnCorners,
+                      cube.cornerPerm());
+        c.b = slicePerm(cube, M_SLICE);
+        c.c = slicePerm(cube, S_SLICE);
+        c.d = slicePerm(cube, E_SLICE);
+        break;
+    }
+    return c;
+}
+
+// Index of the coset of the cube's corner permutation, from its smallest
+// permutation
+int MyThistlethwaiteTables::coset(const Data& t, const MyCubieCube& cube)
+{
+    int smallest = C::numCornerPerms;
+    for (int i = 0; i < numHalfTurnCorners; ++i) {
+        C h;
+        h.setCornerPerm(t.halfTurnCorners[i]);
+        h.multiply(cube);
+        smallest = std::min(smallest, h.cornerPerm());
+    }
+    return indexOf(t.cosets, numCornerCosets, smallest);
+}
+
+void MyThistlethwaiteTables::generateMoves(Data& d)
+{
+    memset(d.cosetMove, 0, sizeof(d.cosetMove));
+    memset(d.mSliceMove, 0, sizeof(d.mSliceMove));
+    memset(d.cornerMove, 0, sizeof(d.cornerMove));
+    memset(d.slicePermMove, 0, sizeof(d.slicePermMove));
+    for (int i = 0; i < C::numFlips; ++i) {
+        for (int m = 0; m < C::numMoves; ++m) {
+            C c;
+            c.setFlip(i);
+            c.move(m);
+            d.flipMove[i][m] = c.flip();
+        }
+    }
+    for (int i = 0; i < C::numTwists; ++i) {
+        for (int m = 0; m < C::numMoves; ++m) {
+            C c;
+            c.setTwist(i);
+            c.move(m);
+            d.twistMove[i][m] = c.twist();
+        }
+    }
+    for (int i = 0; i < C::numSlices; ++i) {
+        for (int m = 0; m < C::numMoves; ++m) {
+            C c;
+            c.setSliceSorted(i * 24);
+            c.move(m);
+            d.sliceMove[i][m] = c.slice();
+        }
+    }
+
+    // The corner permutations half turns make, breadth first from solved
+    int n = 1;
+    d.halfTurnCorners[0] = 0;
+    for (int i = 0; i < n; ++i) {
+        for (int m : phase4Moves) {
+            C c;
+            c.setCornerPerm(d.halfTurnCorners[i]);
+            c.move(m);
+            const int p = c.cornerPerm();
+            if (std::find(d.halfTurnCorners, d.halfTurnCorners + n, p)
+             == d.halfTurnCorners + n) {
+                d.halfTurnCorners[n++] = p;
+            }
+        }
+    }
+    std::sort(d.halfTurnCorners, d.halfTurnCorners + n);
+    for (int i = 0; i < numHalfTurnCorners; ++i) {
+        for (int m : phase4Moves) {
+            C c;
+            c.setCornerPerm(d.halfTurnCorners[i]);
+            c.move(m);
+            d.cornerMove[i][m] = indexOf(d.halfTurnCorners,
+                                         numHalfTurnCorners, c.cornerPerm());
+        }
+    }
+
+    // Cosets in order of their smallest permutation: the first one no
+    // coset so far holds. Solving looks cosets up by that permutation,
+    // the build keeps them all for now.
+    std::vector<uint16_t> cosetOf(C::numCornerPerms, numCornerCosets);
+    n = 0;
+    for (int p = 0; p < C::numCornerPerms; ++p) {
+        if (cosetOf[p] != numCornerCosets) {
+            continue;
+        }
+        C c;
+        c.setCornerPerm(p);
+        for (int i = 0; i < numHalfTurnCorners; ++i) {
+            C h;
+            h.setCornerPerm(d.halfTurnCorners[i]);
+            h.multiply(c);
+            cosetOf[h.cornerPerm()] = n;
+        }
+        d.cosets[n++] = p;
+    }
+    for (int i = 0; i < numCornerCosets; ++i) {
+        for (int m : phase3Moves) {
+            C c;
+            c.setCornerPerm(d.cosets[i]);
+            c.move(m);
+            d.cosetMove[i][m] = cosetOf[c.cornerPerm()];
+        }
+    }
+
+    n = 0;
+    const int solvedBits = mSliceBits(C());
+    d.mSlices[n++] = solvedBits;
+    for (int bits = 0; bits < 256; ++bits) {
+        if (__builtin_popcount(bits) == 4 && bits != solvedBits) {
+            d.mSlices[n++] = bits;
+        }
+    }
+    for (int i = 0; i < numMSlices; ++i) {
+        for (int m : phase3Moves) {
+            C c;
+            setMSliceBits(c, d.mSlices[i]);
+            c.move(m);
+            d.mSliceMove[i][m] = std::find(d.mSlices, d.mSlices + numMSlices,
+                                           mSliceBits(c)) - d.mSlices;
+        }
+    }
+
+    for (int s = M_SLICE; s <= E_SLICE; ++s) {
+        for (int i = 0; i < numSlicePerms; ++i) {
+            for (int m : phase4Moves) {
+                C c;
+                setSlicePerm(c, s, i);
+                c.move(m);
+                d.slicePermMove[s][i][m] = slicePerm(c, s);
+            }
+        }
+    }
+}
+
+void MyThistlethwaiteTables::generatePrune(Data& d)
+{
+    const std::atomic<bool> never{false};
+    MyPruneProgress progress[6];
+    auto fill = [&](uint8_t *table, size_t size, int phase,
+                     MyPruneProgress& p, auto next) {
+        int n;
+        const int *moves = phaseMoves(phase, n);
+        std::fill(table, table + MyNibbles::bytes(size), 0xff);
+        buildPackedPruneTable<MyNibbles>(table, size, moves, n, 1, p, never,
+                                         next);
+    };
+    fill(d.flipPrune, C::numFlips, 0, progress[0],
+          [&d](size_t i, int m) { return d.flipMove[i][m]; });
+    fill(d.twistPrune, C::numTwists, 1, progress[1],
+          [&d](size_t i, int m) { return d.twistMove[i][m]; });
+    fill(d.slicePrune, C::numSlices, 1, progress[2],
+          [&d](size_t i, int m) { return d.sliceMove[i][m]; });
+    fill(d.cosetPrune, numCornerCosets * numMSlices, 2, progress[3],
+          [&d](size_t i, int m) {
+        return d.cosetMove[i / numMSlices][m] * numMSlices
+             + d.mSliceMove[i % numMSlices][m];
+    });
+    fill(d.cornerEdgePrune,
+          numHalfTurnCorners * numSlicePerms * numSlicePerms, 3,
+          progress[4], [&d](size_t i, int m) {
+        const size_t corner = i / (numSlicePerms * numSlicePerms);
+        const size_t mEdges = i / numSlicePerms % numSlicePerms;
+        const size_t sEdges = i % numSlicePerms;
+        return (d.cornerMove[corner][m] * numSlicePerms
+              + d.slicePermMove[M_SLICE][mEdges][m]) * numSlicePerms
+             + d.slicePermMove[S_SLICE][sEdges][m];
+    });
+    fill(d.cornerSlicePrune, numHalfTurnCorners * numSlicePerms, 3,
+          progress[5], [&d](size_t i, int m) {
+        return d.cornerMove[i / numSlicePerms][m] * numSlicePerms
+             + d.slicePermMove[E_SLICE][i % numSlicePerms][m];
+    });
+}
+
+MySolver::Result MyThistlethwaiteSolver::solve(
+    const MyCubieCube& cube, int maxLength, Clock::time_point end,
+    const std::atomic<bool> *cancelFlag, std::string& solution)
+{
+    nodes = 0;
+    solution.clear();
+    if (!cube.isValid()) {
+        return UNSOLVABLE;
+    }
+    deadline = end;
+    cancel = cancelFlag;
+    stopped = false;
+
+    MyCubieCube c = cube;
+    length = 0;
+    for (int phase = 0; phase < MyThistlethwaiteTables::numPhases;
+         ++phase) {
+        moveList = MyThistlethwaiteTables::phaseMoves(phase, numPhaseMoves);
+        phaseStart = length;
+        const Coords start = tables.coords(phase, c);
+        for (int depth = tables.distance(phase, start);; ++depth) {
+            if (search(phase, start, depth, phaseStart)) {
+                break;
+            }
+            if (stopped) {
+                return stopReason;
+            }
+        }
+        for (int i = phaseStart; i < length; ++i) {
+            c.move(moves[i]);
+        }
+    }
+
+    // A phase may end with a turn of the face the next one starts with
+    int n = 0;
+    for (int i = 0; i < length; ++i) {
+        const int m = moves[i];
+        if (n > 0 && C::moveFace(moves[n - 1]) == C::moveFace(m)) {
+            const int quarters = (moves[n - 1] % 3 + m % 3 + 2) % 4;
+            if (quarters == 0) {
+                --n;
+            }
+            else {
+                moves[n - 1] = C::moveFace(m) * 3 + quarters - 1;
+            }
+            continue;
+        }
+        moves[n++] = m;
+    }
+    if (n > maxLength) {
+        return UNSOLVABLE;
+    }
+    solution = MyCubieCube::formatMoves(moves, n);
+    return SOLVED;
+}
+
+bool MyThistlethwaiteSolver::checkStop()
+{
+    if (cancel && cancel->load(std::memory_order_relaxed)) {
+        stopReason = CANCELLED;
+        stopped = true;
+    }
+    else if (Clock::now() >= deadline) {
+        stopReason = TIMEOUT;
+        stopped = true;
+    }
+    return stopped;
+}
+
+bool MyThistlethwaiteSolver::search(int phase, const Coords& c, int depth,
+                                    int n)
+{
+    if ((++nodes & 4095) == 0 && checkStop()) {
+        return false;
+    }
+    if (depth == 0) {
+        if (tables.distance(phase, c) != 0) {
+            return false;
+        }
+        length = n;
+        return true;
+    }
+    for (int k = 0; k < numPhaseMoves; ++k) {
+        const int m = moveList[k];
+        if (n > phaseStart && C::redundantAfter(m, moves[n - 1])) {
+            continue;
+        }
+        const Coords next = tables.move(phase, c, m);
+        if (tables.distance(phase, next) >= depth) {
+            continue;
+        }
+        moves[n] = m;
+        if (search(phase, next, depth - 1, n + 1)) {
+            return true;
+        }
+        if (stopped) {
+            return false;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,121 @@
+#include "trace.h"
+
+#ifdef CUBE_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace {
+struct TraceEvent {
+    const char *name;
+    uint64_t ts;
+    uint64_t dur;
+    uint64_t id;
+    char phase;
+};
+
+// Only the owning thread writes to a buffer. head is published with release
+// semantics so writeJson() sees complete events; events being overwritten
+// while a dump is in progress may come out torn, which is acceptable for a
+// debugging aid.
+struct ThreadBuffer {
+    constexpr static uint64_t capacity = 1 << 16;
+    TraceEvent events[capacity];
+    atomic<uint64_t> head{0};
+    unsigned tid = 0;
+    const char *threadName = nullptr;
+};
+
+mutex registryMutex;
+vector<ThreadBuffer *> registry;
+const chrono::steady_clock::time_point traceEpoch = chrono::steady_clock::now();
+
+ThreadBuffer *threadBuffer()
+{
+    thread_local ThreadBuffer *buf = nullptr;
+    if (!buf) {
+        // Buffers are kept until exit so events of finished threads can
+        // still be dumped
+        buf = new ThreadBuffer;
+        lock_guard<mutex> lock(registryMutex);
+        buf->tid = registry.size() + 1;
+        registry.push_back(buf);
+    }
+    return buf;
+}
+}
+
+uint64_t MyTrace::nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+                        chrono::steady_clock::now() - traceEpoch).count();
+}
+
+void MyTrace::record(const char *name, char phase, uint64_t ts, uint64_t dur,
+                     uint64_t id)
+{
+    ThreadBuffer *buf = threadBuffer();
+    const uint64_t h = buf->head.load(memory_order_relaxed);
+    TraceEvent& e = buf->events[h % ThreadBuffer::capacity];
+    e.name = name;
+    e.ts = ts;
+    e.dur = dur;
+    e.id = id;
+    e.phase = phase;
+    buf->head.store(h + 1, memory_order_release);
+}
+
+void MyTrace::setThreadName(const char *name)
+{
+    threadBuffer()->threadName = name;
+}
+
+bool MyTrace::writeJson(const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        printf("Could not open %s\n", filename);
+        return false;
+    }
+
+    lock_guard<mutex> lock(registryMutex);
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const ThreadBuffer *buf : registry) {
+        if (buf->threadName) {
+            fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+                       "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", buf->tid, buf->threadName);
+            first = false;
+        }
+        const uint64_t head = buf->head.load(memory_order_acquire);
+        const uint64_t begin = head > ThreadBuffer::capacity
+                             ? head - ThreadBuffer::capacity : 0;
+        for (uint64_t i = begin; i < head; ++i) {
+            const TraceEvent& e = buf->events[i % ThreadBuffer::capacity];
+            fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"cube\",\"ph\":\"%c\","
+                       "\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+                    first ? "" : ",\n", e.name, e.phase, buf->tid,
+                    e.ts / 1000.0);
+            first = false;
+            switch (e.phase) {
+              case 'X': fprintf(f, ",\"dur\":%.3f", e.dur / 1000.0); break;
+              case 'i': fprintf(f, ",\"s\":\"t\""); break;
+              case 'b':
+              case 'e': fprintf(f, ",\"id\":\"0x%llx\"",
+                                (unsigned long long) e.id); break;
+            }
+            fprintf(f, "}");
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return true;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+// Chrome trace-event instrumentation. Build with -DCUBE_TRACE to enable,
+// otherwise all the TRACE_* macros compile to nothing.
+//
+// Events go to a per-thread ring buffer (the oldest events are overwritten)
+// and are only formatted when MyTrace::writeJson() is called, so recording
+// is a clock read and a few stores. The output loads in chrome://tracing
+// and ui.perfetto.dev.
+
+#ifdef CUBE_TRACE
+
+#include <cstdint>
+
+namespace MyTrace {
+uint64_t nowNs();
+
+// phase follows the trace-event format: 'X' complete, 'B'/'E' begin/end,
+// 'i' instant, 'b'/'e' async begin/end (matched by id)
+void record(const char *name, char phase, uint64_t ts, uint64_t dur,
+            uint64_t id);
+
+void setThreadName(const char *name);
+
+bool writeJson(const char *filename);
+}
+
+struct MyTraceScope {
+    const char *name;
+    uint64_t start;
+
+    explicit MyTraceScope(const char *n) : name(n), start(MyTrace::nowNs()) {}
+    ~MyTraceScope()
+    {
+        MyTrace::record(name, 'X', start, MyTrace::nowNs() - start, 0);
+    }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+
+#define TRACE_SCOPE(name) \
+    MyTraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_BEGIN(name) MyTrace::record(name, 'B', MyTrace::nowNs(), 0, 0)
+#define TRACE_END(name) MyTrace::record(name, 'E', MyTrace::nowNs(), 0, 0)
+#define TRACE_INSTANT(name) MyTrace::record(name, 'i', MyTrace::nowNs(), 0, 0)
+#define TRACE_ASYNC_BEGIN(name, id) \
+    MyTrace::record(name, 'b', MyTrace::nowNs(), 0, id)
+#define TRACE_ASYNC_END(name, id) \
+    MyTrace::record(name, 'e', MyTrace::nowNs(), 0, id)
+#define TRACE_THREAD_NAME(name) MyTrace::setThreadName(name)
+#define TRACE_WRITE(filename) MyTrace::writeJson(filename)
+
+#else
+
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_INSTANT(name) do {} while (0)
+#define TRACE_ASYNC_BEGIN(name, id) do {} while (0)
+#define TRACE_ASYNC_END(name, id) do {} while (0)
+#define TRACE_THREAD_NAME(name) do {} while (0)
+#define TRACE_WRITE(filename) false
+
+#endif
@@ -0,0 +1,69 @@
+#version 410 core
+
+// vertex.glsl for the batch renderer: one instance per cube state, the
+// cubie transforms come from a buffer texture (27 matrices per instance)
+// and every instance is squeezed into its own tile of the atlas.
+
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 color;
+layout (location = 2) in vec3 normal;
+uniform mat4 projMatrix;
+uniform mat4 mvMatrix;
+uniform mat4 shadowMvp;
+uniform samplerBuffer transforms;
+uniform int passThroughShader;
+uniform int tilesPerRow;
+uniform vec2 tileSize; // in NDC units
+
+out vec3 vsColor;
+out vec3 vertPos;
+out vec3 outNormal;
+out vec4 shadowCoord;
+
+const mat4 depthBias = mat4(
+0.5, 0.0, 0.0, 0.0,
+0.0, 0.5, 0.0, 0.0,
+0.0, 0.0, 0.5, 0.0,
+0.5, 0.5, 0.5, 1.0);
+
+mat4 cubieTransform()
+{
+    int base = (gl_InstanceID * 27 + gl_VertexID / 36) * 4;
+    return mat4(texelFetch(transforms, base),
+                texelFetch(transforms, base + 1),
+                texelFetch(transforms, base + 2),
+                texelFetch(transforms, base + 3));
+}
+
+void main(void)
+{
+    vsColor = color;
+    vec4 clip;
+    if (passThroughShader == 0) {
+        mat4 vTransform = cubieTransform();
+        mat4 trans = mvMatrix * vTransform;
+        shadowCoord = (depthBias * shadowMvp * vTransform*vec4(position, 1.0));
+        mat4 nTrans = inverse(trans);
+        nTrans = transpose(nTrans);
+        vec4 pos = trans * vec4(position, 1.0f);
+        clip = projMatrix * pos;
+        outNormal = (nTrans * vec4(normal, 0.0f)).xyz;
+        vertPos = vec3(pos.xyz) / pos.w;
+    }
+    else {
+        shadowCoord = (depthBias * shadowMvp * vec4(position, 1.0));
+        clip = projMatrix * mvMatrix * vec4(position, 1.0f);
+    }
+
+    // Clip against the view volume before the remap, so that nothing
+    // spills over the neighbouring tiles
+    gl_ClipDistance[0] = clip.w + clip.x;
+    gl_ClipDistance[1] = clip.w - clip.x;
+    gl_ClipDistance[2] = clip.w + clip.y;
+    gl_ClipDistance[3] = clip.w - clip.y;
+
+    vec2 tile = vec2(gl_InstanceID % tilesPerRow, gl_InstanceID / tilesPerRow);
+    vec2 lo = vec2(-1.0) + tile * tileSize;
+    clip.xy = lo * clip.w + (clip.xy + clip.w) * 0.5 * tileSize;
+    gl_Position = clip;
+}